@@ -0,0 +1,69 @@
+/*
+ * ESP-NOW Mesh - Deferred Receive Example
+ * 
+ * With rxMode = RX_POLL the ESP-NOW receive callback only copies each frame into
+ * a ring buffer and returns. Validation, forwarding and your message callback run
+ * later, inside mesh.poll() in loop(). Slow work in the callback no longer stalls
+ * the Wi-Fi task - no hand-written queue needed (compare "queued_messages").
+ * 
+ * Use RX_TASK instead to have a dedicated FreeRTOS task drain the ring, so the
+ * node keeps forwarding even while loop() is busy.
+ */
+
+#include "ENowMesh.h"
+
+ENowMesh mesh;
+
+const int LED_PIN = 2;
+
+// Runs from mesh.poll() in loop() context - delays are fine here
+void onMessage(const uint8_t *src_mac, const char *payload, size_t len) {
+  Serial.printf("From %s: %s\n", mesh.macToStr(src_mac).c_str(), payload);
+
+  if (strcmp(payload, "BLINK") == 0) {
+    for (int i = 0; i < 3; i++) {
+      digitalWrite(LED_PIN, HIGH);
+      delay(200);
+      digitalWrite(LED_PIN, LOW);
+      delay(200);
+    }
+    mesh.sendData("BLINK_DONE", src_mac);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  pinMode(LED_PIN, OUTPUT);
+
+  mesh.setRole(ENowMesh::ROLE_REPEATER);
+  mesh.rxMode = ENowMesh::RX_POLL;  // or ENowMesh::RX_TASK
+  mesh.rxBatchSize = 8;             // Packets handled per poll() call
+
+  mesh.initWiFi();
+  mesh.initEspNow();
+  mesh.setChannel();
+  mesh.registerCallbacks();
+  mesh.setMessageCallback(onMessage);
+}
+
+void loop() {
+  // Process queued packets (forwarding + callbacks)
+  mesh.poll();
+
+  // Mesh maintenance
+  mesh.sendHelloBeacon();
+  mesh.checkPendingMessages();
+  mesh.prunePeers();
+
+  // Size RX_QUEUE_SIZE from these under your peak traffic
+  static unsigned long lastStats = 0;
+  if (millis() - lastStats > 30000) {
+    lastStats = millis();
+    ENowMesh::RxQueueStats st = mesh.getRxQueueStats();
+    Serial.printf("RX queue: depth=%u highWater=%u dropped=%u avgLatency=%uus maxLatency=%uus\n",
+                  st.depth, st.highWater, (unsigned)st.dropped, (unsigned)st.avgLatencyUs, (unsigned)st.maxLatencyUs);
+  }
+
+  delay(10);  // Keep short: queued packets wait until the next poll()
+}
@@ -11,6 +11,9 @@
  * - Parse complex data or do calculations
  * - Send multiple responses
  * 
+ * Alternative: set mesh.rxMode = ENowMesh::RX_POLL and the library queues packets
+ * itself; see the "deferred_receive" example.
+ * 
  * Commands this node responds to:
  * - "BLINK" - Blinks LED 3 times
  * - "READ_TEMP" - Reads temperature sensor and replies
@@ -0,0 +1,56 @@
+// Peer lookup microbenchmark: hashed findPeer() vs the previous linear slot scan
+#include "sim.h"
+
+#include <chrono>
+
+// The pre-index implementation: walk every slot with memcmp
+static int linearFindPeer(ENowMesh::PeerInfo *table, const uint8_t *mac) {
+    for (size_t i = 0; i < ENowMesh::PEER_TABLE_SIZE; ++i)
+        if (table[i].valid && memcmp(table[i].mac, mac, 6) == 0)
+            return (int)i;
+    return -1;
+}
+
+template <typename F>
+static double nsPerLookup(F find, const std::vector<std::array<uint8_t, 6>> &keys, size_t rounds) {
+    volatile int sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+        for (const auto &k : keys) sink = sink + find(k.data());
+    auto t1 = std::chrono::steady_clock::now();
+    (void)sink;
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / (double)(rounds * keys.size());
+}
+
+int main() {
+    Simulator sim;
+    sim.cfg.driverPeers = 1000;  // Lift the driver limit so the logical table can fill up
+
+    printf("%-6s %-8s %12s %12s %8s\n", "peers", "lookup", "linear ns", "hashed ns", "speedup");
+    for (size_t n : {16, 64, 128}) {
+        ENowMesh mesh;
+        std::vector<std::array<uint8_t, 6>> hits, misses;
+        for (size_t i = 0; i < n; i++) {
+            // Same OUI, sequential NIC bytes: the realistic worst case for a weak hash
+            std::array<uint8_t, 6> mac = {0x24, 0x6F, 0x28, 0x10, (uint8_t)(i >> 8), (uint8_t)i};
+            std::array<uint8_t, 6> other = {0x24, 0x6F, 0x28, 0x20, (uint8_t)(i >> 8), (uint8_t)i};
+            hits.push_back(mac);
+            misses.push_back(other);
+        }
+
+        // touchPeer() registers with the driver shim, which acts on the current node
+        SimNode node;
+        sim.current = &node;
+        for (const auto &m : hits) mesh.touchPeer(m.data());
+
+        ENowMesh::PeerInfo *table = mesh.getPeerTable();
+        const size_t rounds = 200000 / n;
+        for (int miss = 0; miss < 2; miss++) {
+            const auto &keys = miss ? misses : hits;
+            double lin = nsPerLookup([&](const uint8_t *m) { return linearFindPeer(table, m); }, keys, rounds);
+            double hsh = nsPerLookup([&](const uint8_t *m) { return mesh.findPeer(m); }, keys, rounds);
+            printf("%-6zu %-8s %12.1f %12.1f %7.1fx\n", n, miss ? "miss" : "hit", lin, hsh, lin / hsh);
+        }
+    }
+    return 0;
+}
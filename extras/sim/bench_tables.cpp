@@ -0,0 +1,92 @@
+// Table sweep microbenchmark: the periodic passes over the pending, peer, route and
+// duplicate-detection tables, with a few, half or all of their slots live.
+// Each call is repeated back to back, so the tables stay in the CPU cache.
+#include "sim.h"
+
+#include <chrono>
+
+// Best of five batches, so a preempted batch doesn't count
+template <typename F>
+static double nsPerCall(F fn, size_t reps) {
+    double best = 0;
+    for (int b = 0; b < 5; b++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < reps; r++) fn();
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / (double)reps;
+        if (b == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+// A node with nothing expiring, so every call only sweeps its tables
+static void setupNode(Simulator &sim, SimNode &node) {
+    node.mac[0] = 0x02; node.mac[5] = 0x01;
+    sim.current = &node;
+    ENowMesh &mesh = node.mesh;
+    mesh.setRole(ENowMesh::ROLE_REPEATER);
+    mesh.maxPendingMessages = ENowMesh::MAX_PENDING_MESSAGES;
+    mesh.txMaxInFlight = 0;
+    mesh.ackTimeout = mesh.ackTimeoutMax = 3600000;
+    mesh.peerTimeout = mesh.routeTimeout = mesh.dupDetectWindowMs = 3600000;
+    mesh.initWiFi();
+    mesh.initEspNow();
+}
+
+static void printRow(const char *call, size_t live, size_t slots, double ns) {
+    printf("%-22s %5zu/%-5zu %10.1f\n", call, live, slots, ns);
+}
+
+int main() {
+    Simulator sim;
+    sim.cfg.driverQueue = 0xFFFF;
+    sim.cfg.driverPeers = 1000;
+
+    printf("%-22s %11s %10s\n", "call", "live/slots", "ns/call");
+
+    // Unicasts to a neighbour that never ACKs: each one holds a pending slot
+    for (size_t n : {0, 4, 16, 32}) {
+        SimNode node;
+        setupNode(sim, node);
+        ENowMesh &mesh = node.mesh;
+        uint8_t dest[6] = {0x02, 0, 0, 0, 0, 0x0B};
+        mesh.touchPeer(dest);
+        uint8_t payload[100] = {};
+        for (size_t i = 0; i < n; i++) if (mesh.sendBytes(payload, sizeof(payload), dest) != ESP_OK) printf("send failed\n");
+        node.txQueue.clear();
+
+        auto call = [&] { mesh.checkPendingMessages(); };
+        printRow("checkPendingMessages", n, ENowMesh::MAX_PENDING_MESSAGES, nsPerCall(call, 100000));
+    }
+
+    // n neighbours, and n sources heard through the first of them (routes and dedup entries)
+    for (size_t n : {8, 32, 64}) {
+        SimNode node;
+        setupNode(sim, node);
+        ENowMesh &mesh = node.mesh;
+        uint8_t via[6] = {0x02, 0, 0, 0, 0, 0x0A};
+        for (size_t i = 0; i < n; i++) {
+            uint8_t mac[6] = {0x02, 0, 0, 0x10, (uint8_t)(i >> 8), (uint8_t)i};
+            mesh.touchPeer(i ? mac : via);
+        }
+
+        uint8_t frame[sizeof(ENowMesh::packet_hdr_t) + 8] = {};
+        ENowMesh::packet_hdr_t *hdr = (ENowMesh::packet_hdr_t*)frame;
+        memcpy(hdr->dest_mac, node.mac, 6);
+        hdr->hop_count = 1;
+        hdr->msg_type = ENowMesh::MSG_TYPE_DATA | ENowMesh::MSG_TYPE_NO_ACK;
+        hdr->payload_len = 8;
+        wifi_pkt_rx_ctrl_t ctrl = {};
+        esp_now_recv_info_t info = {via, node.mac, &ctrl};
+        for (size_t i = 0; i < n; i++) {
+            uint8_t src[6] = {0x02, 0, 0, 0x20, (uint8_t)(i >> 8), (uint8_t)i};
+            memcpy(hdr->src_mac, src, 6);
+            mesh.handleDataRecv(&info, frame, sizeof(frame));
+        }
+        node.txQueue.clear();
+
+        auto call = [&] { mesh.prunePeers(); };
+        printRow("prunePeers", n, ENowMesh::PEER_TABLE_SIZE, nsPerCall(call, 100000));
+    }
+    return 0;
+}
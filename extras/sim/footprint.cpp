@@ -0,0 +1,12 @@
+// Footprint probe: RAM of one ENowMesh instance for the preset this file is built with.
+// `make footprint` builds it once per ENOWMESH_PRESET and adds the code size of the library object.
+#include "ENowMesh.h"
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+    printf("%-6s %8zu", argc > 1 ? argv[1] : "?", sizeof(ENowMesh));
+    printf(" %5zu %5zu %5zu %5zu %2d\n", ENowMesh::PEER_TABLE_SIZE, ENowMesh::ROUTE_TABLE_SIZE,
+           ENowMesh::DUP_SOURCE_TABLE_SIZE, ENowMesh::MAX_PENDING_MESSAGES, (int)ENowMesh::FORWARDING);
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Host shim: the Arduino-ESP32 core surface used by ENowMesh
+// Time, randomness and Serial are owned by the simulator (see sim.h)
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+
+#define IRAM_ATTR
+
+// ----- Time -----
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+
+// ----- Random -----
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+template <typename T, typename L, typename H>
+static inline T constrain(T x, L lo, H hi) { return x < lo ? lo : (x > hi ? hi : x); }
+
+// ----- Critical sections -----
+// The simulator is single threaded, so spinlocks only need to exist
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux)  ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)  ((void)(mux))
+
+// ----- FreeRTOS -----
+// Tasks cannot run inside the discrete-event loop: xTaskCreate() always fails,
+// so code that needs a task must fall back to being polled
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdPASS          1
+#define pdFAIL          0
+#define pdTRUE          1
+#define pdFALSE         0
+#define portMAX_DELAY   ((TickType_t)0xFFFFFFFF)
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+#define taskYIELD() ((void)0)
+
+// ----- String -----
+class String {
+    public:
+        String() {}
+        String(const char *s) : str(s ? s : "") {}
+        String(const std::string &s) : str(s) {}
+        const char* c_str() const { return str.c_str(); }
+        size_t length() const { return str.size(); }
+        String operator+(const String &o) const { return String(str + o.str); }
+        bool operator==(const String &o) const { return str == o.str; }
+    private:
+        std::string str;
+};
+
+// ----- Serial -----
+// Output goes through the simulator, which drops it unless verbose logging is on
+class HardwareSerial {
+    public:
+        void begin(unsigned long baud) { (void)baud; }
+        int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+        size_t print(const char *s);
+        size_t println(const char *s = "");
+        size_t println(const String &s) { return println(s.c_str()); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
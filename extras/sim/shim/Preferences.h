@@ -0,0 +1,25 @@
+// Host shim: Arduino-ESP32 Preferences (NVS) used by the ENowMesh peer cache
+// Each simulated node has its own store, which survives simulated reboots
+#ifndef SIM_PREFERENCES_H
+#define SIM_PREFERENCES_H
+
+#include "Arduino.h"
+
+class Preferences {
+    public:
+        bool begin(const char *name, bool readOnly = false, const char *partitionLabel = nullptr);
+        void end();
+        bool clear();
+        bool remove(const char *key);
+        size_t putUChar(const char *key, uint8_t value);
+        size_t putBytes(const char *key, const void *value, size_t len);
+        uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+        size_t getBytesLength(const char *key);
+        size_t getBytes(const char *key, void *buf, size_t maxLen);
+    private:
+        std::string ns;
+        bool open = false;
+        bool readOnly = false;
+};
+
+#endif
@@ -0,0 +1,23 @@
+// Host shim: WiFi object used by ENowMesh::initWiFi()
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+    WIFI_OFF = 0,
+    WIFI_STA,
+    WIFI_AP,
+    WIFI_AP_STA,
+} wifi_mode_t;
+
+class WiFiClass {
+    public:
+        bool mode(wifi_mode_t m);
+        bool disconnect(bool wifioff = false, bool eraseap = false);
+        uint8_t* macAddress(uint8_t *mac);
+};
+
+extern WiFiClass WiFi;
+
+#endif
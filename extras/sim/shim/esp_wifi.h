@@ -0,0 +1,34 @@
+// Host shim: the slice of esp_wifi.h used by ENowMesh
+#ifndef SIM_ESP_WIFI_H
+#define SIM_ESP_WIFI_H
+
+#include "esp_err.h"
+
+typedef enum {
+    WIFI_IF_STA = 0,
+    WIFI_IF_AP  = 1,
+} wifi_interface_t;
+
+typedef enum {
+    WIFI_SECOND_CHAN_NONE = 0,
+    WIFI_SECOND_CHAN_ABOVE,
+    WIFI_SECOND_CHAN_BELOW,
+} wifi_second_chan_t;
+
+typedef struct {
+    signed rssi : 8;
+    unsigned rate : 5;
+    unsigned channel : 4;
+    unsigned sig_len : 12;
+    uint32_t timestamp;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+    uint8_t *des_addr;
+    uint8_t *src_addr;
+    wifi_interface_t ifidx;
+} wifi_tx_info_t;
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second);
+
+#endif
@@ -0,0 +1,221 @@
+// Host shim implementations: every call acts on the simulator's current node
+#include "Arduino.h"
+#include "WiFi.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "Preferences.h"
+#include "esp_timer.h"
+#include "../sim.h"
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+
+// ----- Time -----
+unsigned long millis() {
+    return (unsigned long)(g_sim->localUs() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)g_sim->localUs();
+}
+
+int64_t esp_timer_get_time() {
+    return g_sim->localUs();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle) {
+    return g_sim->timerCreate(args, out_handle);
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return g_sim->timerStart(timer, timeout_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer || !timer->armed) return ESP_ERR_INVALID_STATE;
+    timer->armed = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer) timer->callback = nullptr;
+    return ESP_OK;
+}
+
+void delay(uint32_t ms) {
+    // Simulated code must never block; time only advances between events
+    (void)ms;
+}
+
+// ----- Random -----
+long random(long howbig) {
+    return g_sim->randomBelow(howbig);
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return howsmall + g_sim->randomBelow(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    (void)seed;  // The simulator owns the seed
+}
+
+// ----- FreeRTOS -----
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    if (handle) *handle = nullptr;
+    return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+void xTaskNotifyGive(TaskHandle_t task) {}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+    return 0;
+}
+
+// ----- Serial -----
+int HardwareSerial::printf(const char *fmt, ...) {
+    if (!g_sim->cfg.verbose && !g_sim->cfg.formatSerial) return 0;
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    g_sim->serialBytes += n;
+    if (g_sim->cfg.verbose) g_sim->log(buf);
+    return n;
+}
+
+size_t HardwareSerial::print(const char *s) {
+    size_t n = strlen(s);
+    if (g_sim->cfg.verbose || g_sim->cfg.formatSerial) g_sim->serialBytes += n;
+    if (g_sim->cfg.verbose) g_sim->log(s);
+    return n;
+}
+
+size_t HardwareSerial::println(const char *s) {
+    size_t n = strlen(s) + 1;
+    if (g_sim->cfg.verbose || g_sim->cfg.formatSerial) g_sim->serialBytes += n;
+    if (g_sim->cfg.verbose) {
+        std::string line = std::string(s) + "\n";
+        g_sim->log(line.c_str());
+    }
+    return n;
+}
+
+// ----- WiFi -----
+bool WiFiClass::mode(wifi_mode_t m) {
+    (void)m;
+    return true;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap) {
+    (void)wifioff;
+    (void)eraseap;
+    return true;
+}
+
+uint8_t* WiFiClass::macAddress(uint8_t *mac) {
+    memcpy(mac, g_sim->current->mac, 6);
+    return mac;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second) {
+    (void)primary;
+    (void)second;
+    return ESP_OK;
+}
+
+// ----- ESP-NOW -----
+esp_err_t esp_now_init(void) { return ESP_OK; }
+esp_err_t esp_now_deinit(void) { return ESP_OK; }
+
+// Receive/send dispatch is done per node by the simulator (handleDataRecv/handleDataSent)
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) { (void)cb; return ESP_OK; }
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) { (void)cb; return ESP_OK; }
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len) {
+    return g_sim->driverSend(peer_addr, data, len);
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer) {
+    if (!peer) return ESP_ERR_ESPNOW_ARG;
+    return g_sim->driverAddPeer(peer->peer_addr);
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr) {
+    return g_sim->driverDelPeer(peer_addr);
+}
+
+bool esp_now_is_peer_exist(const uint8_t *peer_addr) {
+    return g_sim->driverHasPeer(peer_addr);
+}
+
+esp_err_t esp_now_get_peer_num(esp_now_peer_num_t *num) {
+    if (!num) return ESP_ERR_ESPNOW_ARG;
+    num->total_num = g_sim->driverPeerCount();
+    num->encrypt_num = 0;
+    return ESP_OK;
+}
+
+// ----- Preferences -----
+// Namespaces live in the current node's SimNode::nvs
+bool Preferences::begin(const char *name, bool ro, const char *partitionLabel) {
+    (void)partitionLabel;
+    if (!name || !*name) return false;
+    auto &nvs = g_sim->current->nvs;
+    if (ro && nvs.find(name) == nvs.end()) return false;   // As on the ESP32: nothing to open read-only
+    nvs[name];
+    ns = name;
+    readOnly = ro;
+    open = true;
+    return true;
+}
+
+void Preferences::end() {
+    open = false;
+}
+
+bool Preferences::clear() {
+    if (!open || readOnly) return false;
+    g_sim->current->nvs[ns].clear();
+    return true;
+}
+
+bool Preferences::remove(const char *key) {
+    if (!open || readOnly) return false;
+    return g_sim->current->nvs[ns].erase(key) > 0;
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value) {
+    return putBytes(key, &value, 1);
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+    if (!open || readOnly || !key) return 0;
+    const uint8_t *p = (const uint8_t*)value;
+    g_sim->current->nvs[ns][key].assign(p, p + len);
+    g_sim->nvsWrites++;
+    return len;
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) {
+    uint8_t v;
+    return (getBytesLength(key) == 1 && getBytes(key, &v, 1) == 1) ? v : defaultValue;
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!open || !key) return 0;
+    auto &kv = g_sim->current->nvs[ns];
+    auto it = kv.find(key);
+    return it == kv.end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+    size_t len = getBytesLength(key);
+    if (len == 0 || len > maxLen) return 0;
+    memcpy(buf, g_sim->current->nvs[ns][key].data(), len);
+    return len;
+}
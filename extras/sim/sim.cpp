@@ -0,0 +1,1108 @@
+#include "sim.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <new>
+#include <sstream>
+
+Simulator *g_sim = nullptr;
+
+// ----- Radio model constants (802.11b DSSS, long preamble) -----
+static constexpr uint32_t PHY_PREAMBLE_US = 192;
+static constexpr uint32_t ESPNOW_FRAME_OVERHEAD = 43;  // MAC header + vendor action/IE header + FCS
+static constexpr uint32_t SIFS_US = 10;
+static constexpr uint32_t DIFS_US = 50;
+static constexpr uint32_t SLOT_US = 20;
+static constexpr uint32_t CW_MIN = 31;
+static constexpr uint32_t MAC_ACK_US = PHY_PREAMBLE_US + 14 * 8;
+
+static const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// ----- Receive callback shared by all simulated nodes -----
+static void simOnReceive(const ENowMesh::RxInfo &info, const uint8_t *payload, size_t len) {
+    (void)info;
+    g_sim->onDelivered(payload, len);
+}
+
+// ----- Delivery report callback shared by all simulated nodes -----
+static void simOnSendResult(const ENowMesh::SendResult &result) {
+    g_sim->onSendResult(result);
+}
+
+// ----- Telemetry callback shared by all simulated nodes -----
+static void simOnTelemetry(const uint8_t *src_mac, const ENowMesh::TelemetryReport &report) {
+    g_sim->onTelemetry(src_mac, report);
+}
+
+static bool parseRole(const std::string &s, ENowMesh::NodeRole &role) {
+    std::string u = s;
+    for (auto &c : u) c = (char)toupper((unsigned char)c);
+    if (u == "MASTER") role = ENowMesh::ROLE_MASTER;
+    else if (u == "REPEATER") role = ENowMesh::ROLE_REPEATER;
+    else if (u == "LEAF") role = ENowMesh::ROLE_LEAF;
+    else return false;
+    return true;
+}
+
+Simulator::Simulator() {
+    g_sim = this;
+}
+
+// =======================================
+// ===== TOPOLOGY ====
+// =======================================
+
+SimNode* Simulator::findNode(const std::string &name) {
+    for (auto &n : nodes)
+        if (n->name == name) return n.get();
+    return nullptr;
+}
+
+SimNode* Simulator::addNode(const std::string &name, ENowMesh::NodeRole role) {
+    std::unique_ptr<SimNode> n(new SimNode());
+    n->id = (int)nodes.size();
+    n->name = name;
+    n->role = role;
+    // Locally administered unicast MACs: 02:00:00:00:hi:lo
+    n->mac[0] = 0x02;
+    n->mac[4] = (uint8_t)(n->id >> 8);
+    n->mac[5] = (uint8_t)(n->id & 0xFF);
+    nodes.push_back(std::move(n));
+    return nodes.back().get();
+}
+
+bool Simulator::addLink(const std::string &a, const std::string &b, double loss, int rssi, std::string &err) {
+    SimNode *na = findNode(a), *nb = findNode(b);
+    if (!na || !nb) {
+        err = "unknown node in link " + a + " " + b;
+        return false;
+    }
+    // Repeating a link (e.g. with -o) replaces its loss and RSSI
+    auto set = [&](SimNode *from, SimNode *to) {
+        for (SimLink &l : from->links) {
+            if (l.to == to->id) {
+                l.loss = loss;
+                l.rssi = (int8_t)rssi;
+                return;
+            }
+        }
+        from->links.push_back({to->id, loss, (int8_t)rssi});
+    };
+    set(na, nb);
+    set(nb, na);
+    return true;
+}
+
+bool Simulator::loadTopology(const char *path, std::string &err) {
+    std::ifstream in(path);
+    if (!in) {
+        err = std::string("cannot open ") + path;
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        lineNo++;
+        if (!applyDirective(line, err)) {
+            err = std::string(path) + ":" + std::to_string(lineNo) + ": " + err;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Directives (one per line, '#' starts a comment):
+//   node <name> <MASTER|REPEATER|LEAF>
+//   link <a> <b> [loss] [rssi]
+//   grid <prefix> <rows> <cols> <ROLE> [loss] [rssi]   4-neighbour grid named <prefix>_<r>_<c>
+//   role <name> <ROLE>
+//   set [ROLE] <meshParam> <value>                      e.g. "set LEAF helloInterval 60000"
+//   sim <simParam> <value>                              clock_ppm: node clock rate error bound (and boot offsets),
+//                                                       callback_us: driver callback latency bound
+//   traffic <src> <dst> <interval_ms> <count> [size] [start_ms]
+//     src: node name, role name or '*'; dst: node name, '*' (broadcast), master or repeaters
+//   reboot <name> <at_ms> [probe_dst]                   fresh ENowMesh instance, all RAM state lost; with
+//                                                       probe_dst, unicasts to it right after boot until ACKed
+//   sleep <name|ROLE> <sleep_ms> <awake_ms>             radio off between wakes (RAM kept, like light sleep);
+//                                                       calls pollMailbox(awake_ms) on each wake
+bool Simulator::applyDirective(const std::string &raw, std::string &err) {
+    std::string line = raw.substr(0, raw.find('#'));
+    std::istringstream ss(line);
+    std::string cmd;
+    if (!(ss >> cmd)) return true;
+
+    if (cmd == "node") {
+        std::string name, roleStr;
+        ENowMesh::NodeRole role;
+        if (!(ss >> name >> roleStr) || !parseRole(roleStr, role)) { err = "usage: node <name> <ROLE>"; return false; }
+        if (findNode(name)) { err = "duplicate node " + name; return false; }
+        addNode(name, role);
+    } else if (cmd == "link") {
+        std::string a, b;
+        double loss = 0.0;
+        int rssi = -60;
+        if (!(ss >> a >> b)) { err = "usage: link <a> <b> [loss] [rssi]"; return false; }
+        ss >> loss >> rssi;
+        return addLink(a, b, loss, rssi, err);
+    } else if (cmd == "grid") {
+        std::string prefix, roleStr;
+        int rows = 0, cols = 0;
+        double loss = 0.0;
+        int rssi = -60;
+        ENowMesh::NodeRole role;
+        if (!(ss >> prefix >> rows >> cols >> roleStr) || !parseRole(roleStr, role) || rows <= 0 || cols <= 0) {
+            err = "usage: grid <prefix> <rows> <cols> <ROLE> [loss] [rssi]";
+            return false;
+        }
+        ss >> loss >> rssi;
+        auto nm = [&](int r, int c) { return prefix + "_" + std::to_string(r) + "_" + std::to_string(c); };
+        for (int r = 0; r < rows; r++)
+            for (int c = 0; c < cols; c++)
+                addNode(nm(r, c), role);
+        for (int r = 0; r < rows; r++) {
+            for (int c = 0; c < cols; c++) {
+                if (c + 1 < cols && !addLink(nm(r, c), nm(r, c + 1), loss, rssi, err)) return false;
+                if (r + 1 < rows && !addLink(nm(r, c), nm(r + 1, c), loss, rssi, err)) return false;
+            }
+        }
+    } else if (cmd == "cluster") {
+        std::string prefix, roleStr;
+        int count = 0;
+        double loss = 0.0;
+        int rssi = -60;
+        ENowMesh::NodeRole role;
+        if (!(ss >> prefix >> count >> roleStr) || !parseRole(roleStr, role) || count <= 0) {
+            err = "usage: cluster <prefix> <count> <ROLE> [loss] [rssi]";
+            return false;
+        }
+        ss >> loss >> rssi;
+        auto nm = [&](int i) { return prefix + "_" + std::to_string(i); };
+        for (int i = 0; i < count; i++) addNode(nm(i), role);
+        for (int i = 0; i < count; i++)
+            for (int j = i + 1; j < count; j++)
+                if (!addLink(nm(i), nm(j), loss, rssi, err)) return false;
+    } else if (cmd == "role") {
+        std::string name, roleStr;
+        ENowMesh::NodeRole role;
+        if (!(ss >> name >> roleStr) || !parseRole(roleStr, role)) { err = "usage: role <name> <ROLE>"; return false; }
+        SimNode *n = findNode(name);
+        if (!n) { err = "unknown node " + name; return false; }
+        n->role = role;
+    } else if (cmd == "set") {
+        meshSettings.push_back(line);
+    } else if (cmd == "sim") {
+        std::string key;
+        double v;
+        if (!(ss >> key >> v)) { err = "usage: sim <param> <value>"; return false; }
+        if (key == "duration_ms") cfg.durationMs = (uint64_t)v;
+        else if (key == "warmup_ms") cfg.warmupMs = (uint64_t)v;
+        else if (key == "drain_ms") cfg.drainMs = (uint64_t)v;
+        else if (key == "seed") cfg.seed = (uint32_t)v;
+        else if (key == "loop_ms") cfg.loopMs = (uint32_t)v;
+        else if (key == "bitrate_mbps") cfg.bitrateMbps = v;
+        else if (key == "mac_retries") cfg.macRetries = (uint8_t)v;
+        else if (key == "driver_queue") cfg.driverQueue = (uint16_t)v;
+        else if (key == "driver_peers") cfg.driverPeers = (uint16_t)v;
+        else if (key == "clock_ppm") cfg.clockPpm = v;
+        else if (key == "callback_us") cfg.callbackUs = (uint32_t)v;
+        else { err = "unknown sim parameter " + key; return false; }
+    } else if (cmd == "traffic") {
+        SimTraffic t;
+        t.size = 20;
+        t.startMs = UINT64_MAX;  // Resolved to warmup_ms when traffic starts
+        if (!(ss >> t.src >> t.dst >> t.intervalMs >> t.count)) {
+            err = "usage: traffic <src> <dst> <interval_ms> <count> [size] [start_ms]";
+            return false;
+        }
+        ss >> t.size >> t.startMs;
+        traffic.push_back(t);
+    } else if (cmd == "reboot") {
+        std::string name, probe;
+        uint64_t atMs;
+        if (!(ss >> name >> atMs)) { err = "usage: reboot <name> <at_ms> [probe_dst]"; return false; }
+        SimNode *n = findNode(name);
+        if (!n) { err = "unknown node " + name; return false; }
+        SimNode *d = nullptr;
+        if (ss >> probe && !(d = findNode(probe))) { err = "unknown node " + probe; return false; }
+        reboots.push_back({n->id, atMs, d ? d->id : -1});
+    } else if (cmd == "sleep") {
+        SimSleep sl;
+        if (!(ss >> sl.who >> sl.sleepMs >> sl.awakeMs) || sl.sleepMs == 0 || sl.awakeMs == 0) {
+            err = "usage: sleep <name|ROLE> <sleep_ms> <awake_ms>";
+            return false;
+        }
+        sleeps.push_back(sl);
+    } else if (cmd == "expect") {
+        static const char *known[] = {"delivery_ratio", "failed_sends", "acked_lost", "duplicate_deliveries"};
+        SimExpect e;
+        std::string op;
+        if (!(ss >> e.metric >> op >> e.value) || (op != "<=" && op != ">=") ||
+            std::find(std::begin(known), std::end(known), e.metric) == std::end(known)) {
+            err = "usage: expect <delivery_ratio|failed_sends|acked_lost|duplicate_deliveries> <=|>= <value>";
+            return false;
+        }
+        e.atMost = op == "<=";
+        expects.push_back(e);
+    } else {
+        err = "unknown directive " + cmd;
+        return false;
+    }
+    return true;
+}
+
+bool Simulator::applyMeshSetting(SimNode &n, const std::string &key, long v) {
+    ENowMesh &m = n.mesh;
+    if (key == "maxHops") m.maxHops = (uint8_t)v;
+    else if (key == "maxPeers") m.maxPeers = (uint16_t)v;
+    else if (key == "maxPayload") m.maxPayload = (uint16_t)v;
+    else if (key == "peerTimeout") m.peerTimeout = (uint32_t)v;
+    else if (key == "routeTimeout") m.routeTimeout = (uint32_t)v;
+    else if (key == "ackTimeout") m.ackTimeout = (uint32_t)v;
+    else if (key == "maxRetries") m.maxRetries = (uint8_t)v;
+    else if (key == "ackDelayMs") m.ackDelayMs = (uint16_t)v;
+    else if (key == "ackTimeoutMin") m.ackTimeoutMin = (uint32_t)v;
+    else if (key == "ackTimeoutMax") m.ackTimeoutMax = (uint32_t)v;
+    else if (key == "telemetryInterval") m.telemetryInterval = (uint32_t)v;
+    else if (key == "fragWindow") m.fragWindow = (uint8_t)v;
+    else if (key == "fragTimeout") m.fragTimeout = (uint32_t)v;
+    else if (key == "aggregateDelayMs") m.aggregateDelayMs = (uint16_t)v;
+    else if (key == "aggregateFlushBytes") m.aggregateFlushBytes = (uint8_t)v;
+    else if (key == "dupDetectBufferSize") m.dupDetectBufferSize = (uint8_t)v;
+    else if (key == "dupDetectWindowMs") m.dupDetectWindowMs = (uint32_t)v;
+    else if (key == "maxPendingMessages") m.maxPendingMessages = (uint8_t)v;
+    else if (key == "helloInterval") m.helloInterval = (uint32_t)v;
+    else if (key == "rxMode") m.rxMode = (ENowMesh::RxMode)v;
+    else if (key == "txMaxInFlight") m.txMaxInFlight = (uint8_t)v;
+    else if (key == "rxBatchSize") m.rxBatchSize = (uint8_t)v;
+    else if (key == "floodBroadcastMinPeers") m.floodBroadcastMinPeers = (uint8_t)v;
+    else if (key == "floodCounterK") m.floodCounterK = (uint8_t)v;
+    else if (key == "floodBackoffMs") m.floodBackoffMs = (uint16_t)v;
+    else if (key == "peerCacheInterval") m.peerCacheInterval = (uint32_t)v;
+    else if (key == "helloIntervalMin") m.helloIntervalMin = (uint32_t)v;
+    else if (key == "helloRedundancy") m.helloRedundancy = (uint8_t)v;
+    else if (key == "masterUplink") m.masterUplink = v != 0;
+    else if (key == "compactHeaders") m.compactHeaders = v != 0;
+    else if (key == "floodForwardPct") m.floodForwardPct = (uint8_t)v;
+    else if (key == "sleepIntervalMs") m.sleepIntervalMs = (uint32_t)v;
+    else if (key == "mailboxPerLeaf") m.mailboxPerLeaf = (uint8_t)v;
+    else if (key == "timeSync") m.timeSync = v != 0;
+    else if (key == "tdmaSlots") m.tdmaSlots = (uint8_t)v;
+    else if (key == "tdmaSlotMs") m.tdmaSlotMs = (uint16_t)v;
+    else return false;
+    return true;
+}
+
+// =======================================
+// ===== SCHEDULER ====
+// =======================================
+
+void Simulator::schedule(uint64_t atUs, std::function<void()> fn) {
+    events.push({atUs, eventSeq++, std::move(fn)});
+}
+
+void Simulator::runAs(SimNode &n, const std::function<void()> &fn) {
+    SimNode *prev = current;
+    current = &n;
+    fn();
+    current = prev;
+}
+
+long Simulator::randomBelow(long n) {
+    if (n <= 0) return 0;
+    return (long)(rng() % (uint32_t)n);
+}
+
+bool Simulator::chance(double p) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < p;
+}
+
+void Simulator::log(const char *text) {
+    fprintf(stdout, "[%10.3f %s] %s", now / 1e6, current ? current->name.c_str() : "-", text);
+}
+
+// ----- Apply "set" directives and run the sketch's setup() on one node -----
+void Simulator::bootNode(SimNode &n) {
+    for (const std::string &s : meshSettings) {
+        std::istringstream ss(s);
+        std::string cmd, a, key;
+        long value;
+        ss >> cmd >> a;
+        ENowMesh::NodeRole only;
+        bool scoped = parseRole(a, only);
+        if (scoped) ss >> key; else key = a;
+        if (!(ss >> value)) {
+            fprintf(stderr, "bad set directive: %s\n", s.c_str());
+            continue;
+        }
+        if (scoped && only != n.role) continue;
+        if (!applyMeshSetting(n, key, value))
+            fprintf(stderr, "unknown mesh parameter %s\n", key.c_str());
+    }
+
+    runAs(n, [&]() {
+        n.mesh.setRole(n.role);
+        n.mesh.initWiFi();
+        n.mesh.initEspNow();
+        n.mesh.setChannel();
+        n.mesh.registerCallbacks();
+        n.mesh.setReceiveCallback(simOnReceive);
+        n.mesh.setSendCallback(simOnSendResult);
+        n.mesh.setTelemetryCallback(simOnTelemetry);
+    });
+}
+
+void Simulator::setupNodes() {
+    // Clocks come from their own generator, so clock_ppm leaves every other random draw as it was
+    if (cfg.clockPpm > 0) {
+        std::mt19937 clockRng(cfg.seed * 2654435761u + 1);
+        std::uniform_real_distribution<double> ppm(-cfg.clockPpm, cfg.clockPpm);
+        for (auto &np : nodes) {
+            np->clockPpm = ppm(clockRng);
+            np->clockBaseUs = clockRng() % 10000000;
+        }
+    }
+
+    bool sync = false;
+    for (auto &np : nodes) {
+        SimNode &n = *np;
+        bootNode(n);
+        sync = sync || n.mesh.timeSync || n.mesh.tdmaSlots;
+
+        // Maintenance loop with a random phase so nodes don't beacon in lockstep
+        uint64_t loopUs = (uint64_t)cfg.loopMs * 1000;
+        struct Loop {
+            static void run(Simulator *s, SimNode *node, uint64_t periodUs) {
+                if (!node->asleep) s->runAs(*node, [node]() {
+                    node->mesh.poll();
+                    node->mesh.sendHelloBeacon();
+                    node->mesh.checkPendingMessages();
+                    node->mesh.prunePeers();
+                    node->mesh.sendTelemetry();
+                });
+                s->schedule(s->nowUs() + periodUs, [s, node, periodUs]() { run(s, node, periodUs); });
+            }
+        };
+        SimNode *node = &n;
+        schedule((uint64_t)randomBelow((long)loopUs), [this, node, loopUs]() { Loop::run(this, node, loopUs); });
+    }
+
+    // Sleepers join the mesh awake, then start their cycle halfway through the warmup at a random phase
+    for (const SimSleep &sl : sleeps) {
+        ENowMesh::NodeRole role;
+        bool byRole = parseRole(sl.who, role);
+        for (auto &np : nodes) {
+            SimNode *n = np.get();
+            if (!(byRole && n->role == role) && sl.who != n->name) continue;
+            n->sleepMs = sl.sleepMs;
+            n->awakeMs = sl.awakeMs;
+            uint64_t at = cfg.warmupMs * 500 + (uint64_t)randomBelow((long)(sl.sleepMs + sl.awakeMs) * 1000);
+            n->sleepStartUs = at;
+            schedule(at, [this, n]() { sleepCycle(*n, false); });
+        }
+    }
+
+    if (sync) schedule(cfg.warmupMs * 1000, [this]() { sampleSync(); });
+
+    for (const SimReboot &r : reboots) {
+        SimNode *node = nodes[r.node].get();
+        int probeDst = r.probeDst;
+        schedule(r.atMs * 1000, [this, node, probeDst]() {
+            // The radio keeps whatever is already on air; driver registrations and the mesh start over
+            node->mesh.~ENowMesh();
+            new (&node->mesh) ENowMesh();
+            node->driverPeers.clear();
+            node->txQueue.clear();
+            node->bootedUs = now;
+            node->awaitingFirstDelivery = true;
+            bootNode(*node);
+            if (cfg.verbose) runAs(*node, [this]() { log("Rebooted\n"); });
+            // The sketch's first unicast, sent as soon as setup() is done
+            node->probeDst = probeDst;
+            if (probeDst < 0) return;
+            probes++;
+            uint64_t booted = now;
+            schedule(now + 100000, [this, node, booted]() { sendProbe(*node, booted); });
+        });
+    }
+}
+
+// =======================================
+// ===== TRAFFIC ====
+// =======================================
+
+void Simulator::startTraffic() {
+    for (const SimTraffic &t : traffic) {
+        ENowMesh::NodeRole role;
+        bool byRole = parseRole(t.src, role);
+        for (auto &np : nodes) {
+            SimNode *n = np.get();
+            if (t.src != "*" && !(byRole && n->role == role) && t.src != n->name) continue;
+            if (t.dst == n->name) continue;
+            uint64_t startMs = t.startMs == UINT64_MAX ? cfg.warmupMs : t.startMs;
+            uint64_t phase = (uint64_t)randomBelow((long)t.intervalMs * 1000);
+            for (uint32_t k = 0; k < t.count; k++) {
+                uint64_t at = startMs * 1000 + phase + (uint64_t)k * t.intervalMs * 1000;
+                SimTraffic tc = t;
+                schedule(at, [this, n, tc]() { sendMessage(*n, tc); });
+            }
+        }
+    }
+}
+
+// Every second: each synced node's mesh time against the first MASTER's, read at the same instant
+void Simulator::sampleSync() {
+    SimNode *master = nullptr;
+    for (auto &np : nodes) if (np->role == ENowMesh::ROLE_MASTER) { master = np.get(); break; }
+    if (!master || now >= cfg.durationMs * 1000) return;
+    int64_t ref = 0;
+    runAs(*master, [&]() { ref = (int64_t)master->mesh.getMeshTimeUs(); });
+    for (auto &np : nodes) {
+        SimNode &n = *np;
+        if (&n == master || n.asleep) continue;
+        ENowMesh::SyncStatus st;
+        int64_t mesh = 0;
+        runAs(n, [&]() {
+            st = n.mesh.getSyncStatus();
+            mesh = (int64_t)n.mesh.getMeshTimeUs();
+        });
+        if (!st.synced) {
+            syncSamplesUnsynced++;
+            continue;
+        }
+        syncErrorUs[st.hops].push_back((double)std::llabs(mesh - ref));
+        double truePpb = ((1.0 + master->clockPpm * 1e-6) / (1.0 + n.clockPpm * 1e-6) - 1.0) * 1e9;
+        driftErrorPpm.push_back(std::fabs(st.driftPpb - truePpb) / 1000.0);
+    }
+    schedule(now + 1000000, [this]() { sampleSync(); });
+}
+
+void Simulator::sleepCycle(SimNode &n, bool wake) {
+    SimNode *node = &n;
+    if (wake) {
+        n.asleep = false;
+        n.sleptUs += now - n.asleepSinceUs;
+        runAs(n, [&]() { n.mesh.pollMailbox((uint16_t)n.awakeMs); });
+        kickTx(n);
+        schedule(now + (uint64_t)n.awakeMs * 1000, [this, node]() { sleepCycle(*node, false); });
+    } else {
+        n.asleep = true;
+        n.asleepSinceUs = now;
+        n.nextWakeUs = now + (uint64_t)n.sleepMs * 1000;
+        schedule(n.nextWakeUs, [this, node]() { sleepCycle(*node, true); });
+    }
+}
+
+void Simulator::sendMessage(SimNode &src, const SimTraffic &t) {
+    // A sleeping sensor sends when it next wakes
+    if (src.asleep) {
+        SimNode *node = &src;
+        schedule(src.nextWakeUs + 1000, [this, node, t]() { sendMessage(*node, t); });
+        return;
+    }
+
+    SimMessage msg = {};
+    msg.src = src.id;
+    msg.dst = -1;
+    msg.sentUs = now;
+    msg.size = t.size;
+
+    if (t.dst == "*") {
+        msg.kind = 'b';
+        msg.expected = (int)nodes.size() - 1;
+    } else if (t.dst == "master") {
+        msg.kind = 'm';
+        msg.expected = 1;
+    } else if (t.dst == "repeaters") {
+        msg.kind = 'r';
+        msg.expected = 0;
+        for (auto &n : nodes)
+            if (n->role == ENowMesh::ROLE_REPEATER && n->id != src.id) msg.expected++;
+    } else if (t.dst == "random") {
+        if (nodes.size() < 2) return;
+        int d = (int)randomBelow((long)nodes.size() - 1);
+        msg.kind = 'u';
+        msg.dst = d >= src.id ? d + 1 : d;
+        msg.expected = 1;
+    } else {
+        SimNode *d = findNode(t.dst);
+        if (!d) return;
+        msg.kind = 'u';
+        msg.dst = d->id;
+        msg.expected = 1;
+    }
+
+    // Binary payload: 32-bit message id, zero-padded to the requested size (over maxPayload = fragmented)
+    static uint8_t payload[ENowMesh::FRAG_MAX_MESSAGE_SIZE];
+    memset(payload, 0, sizeof(payload));
+    uint32_t id = (uint32_t)messages.size();
+    memcpy(payload, &id, sizeof(id));
+    size_t size = std::min<size_t>(std::max<size_t>(t.size, sizeof(id)), sizeof(payload));
+
+    messages.push_back(msg);
+    runAs(src, [&]() {
+        switch (msg.kind) {
+            case 'b': src.mesh.sendBytes(payload, size); break;
+            case 'm': src.mesh.sendBytesToMaster(payload, size); break;
+            case 'r': src.mesh.sendBytesToRepeaters(payload, size); break;
+            default:
+                // Matched to its SendResult, to catch ACKs for payloads that never arrived
+                if (src.mesh.sendBytes(payload, size, nodes[msg.dst]->mac) == ESP_OK)
+                    ackedSendSeqs[{src.id, src.mesh.getLastSeq()}].push_back(id);
+                break;
+        }
+    });
+}
+
+// Repeats every 500 ms until one is ACKed (onSendResult), or the node reboots again
+void Simulator::sendProbe(SimNode &src, uint64_t bootedUs) {
+    if (src.bootedUs != bootedUs || src.probeDst < 0 || now >= cfg.durationMs * 1000) return;
+    SimTraffic t = {};
+    t.dst = nodes[src.probeDst]->name;
+    t.size = 20;
+    size_t before = messages.size();
+    sendMessage(src, t);
+    if (messages.size() > before) messages.back().probe = true;
+    SimNode *node = &src;
+    schedule(now + 500000, [this, node, bootedUs]() { sendProbe(*node, bootedUs); });
+}
+
+void Simulator::onSendResult(const ENowMesh::SendResult &result) {
+    if (result.delivered) {
+        sendsAcked++;
+        ackRttMs.push_back(result.rttMs);
+    } else {
+        sendsFailed++;
+    }
+    sendAttempts += result.attempts;
+    if (!current) return;
+    auto it = ackedSendSeqs.find({current->id, result.seq});
+    if (it == ackedSendSeqs.end()) return;
+    if (result.delivered) for (uint32_t id : it->second) messages[id].acked = true;
+    bool probe = false;
+    for (uint32_t id : it->second) probe |= messages[id].probe;
+    ackedSendSeqs.erase(it);
+    if (!probe || current->probeDst < 0) return;
+    if (!result.delivered) {
+        probeFailures++;
+        return;
+    }
+    current->probeDst = -1;
+    probeFirstAckMs.push_back((now - current->bootedUs) / 1000.0);
+    probeFloods += current->mesh.getRouteStats().misses;
+}
+
+void Simulator::onTelemetry(const uint8_t *src_mac, const ENowMesh::TelemetryReport &report) {
+    (void)report;
+    telemetryReports++;
+    std::string key((const char*)src_mac, 6);
+    telemetrySources.insert(key);
+}
+
+void Simulator::onDelivered(const uint8_t *payload, size_t len) {
+    uint32_t id;
+    if (!current || len < sizeof(id)) return;
+    memcpy(&id, payload, sizeof(id));
+    if (id >= messages.size()) return;
+    SimMessage &msg = messages[id];
+    if (current->id == msg.src) return;
+
+    bool eligible;
+    switch (msg.kind) {
+        case 'u': eligible = current->id == msg.dst; break;
+        case 'm': eligible = current->role == ENowMesh::ROLE_MASTER && msg.receivedBy.empty(); break;
+        case 'r': eligible = current->role == ENowMesh::ROLE_REPEATER; break;
+        default:  eligible = true; break;
+    }
+    if (!eligible) return;
+    if (std::find(msg.receivedBy.begin(), msg.receivedBy.end(), current->id) != msg.receivedBy.end()) {
+        duplicateDeliveries++;
+        return;
+    }
+    msg.receivedBy.push_back(current->id);
+    deliveryLatencyMs.push_back((now - msg.sentUs) / 1000.0);
+    SimNode &src = *nodes[msg.src];
+    if (src.awaitingFirstDelivery && msg.sentUs >= src.bootedUs) {
+        src.awaitingFirstDelivery = false;
+        rebootFirstDeliveryMs.push_back((now - src.bootedUs) / 1000.0);
+    }
+    if (len > ESP_NOW_MAX_IE_DATA_LEN) deliveryThroughput.push_back(len * 1e6 / 1024.0 / std::max<uint64_t>(now - msg.sentUs, 1));
+}
+
+// =======================================
+// ===== VIRTUAL RADIO ====
+// =======================================
+
+uint64_t Simulator::airtimeUs(size_t len) const {
+    return PHY_PREAMBLE_US + (uint64_t)((len + ESPNOW_FRAME_OVERHEAD) * 8 / cfg.bitrateMbps + 0.5);
+}
+
+uint64_t Simulator::callbackDelayUs() {
+    return cfg.callbackUs ? callbackRng() % (cfg.callbackUs + 1) : 0;
+}
+
+esp_err_t Simulator::driverSend(const uint8_t *peer_addr, const uint8_t *data, size_t len) {
+    SimNode &n = *current;
+    if (!data || len == 0 || len > ESP_NOW_MAX_DATA_LEN) return ESP_ERR_ESPNOW_ARG;
+
+    // NULL peer address means "every registered peer", as in the real driver
+    std::vector<const uint8_t*> targets;
+    if (peer_addr) {
+        if (!driverHasPeer(peer_addr)) return ESP_ERR_ESPNOW_NOT_FOUND;
+        targets.push_back(peer_addr);
+    } else {
+        for (auto &p : n.driverPeers) targets.push_back(p.data());
+    }
+
+    for (const uint8_t *t : targets) {
+        if (n.txQueue.size() >= cfg.driverQueue) {
+            n.driverDrops++;
+            return ESP_ERR_ESPNOW_NO_MEM;
+        }
+        SimFrame f;
+        memcpy(f.dest, t, 6);
+        f.data.assign(data, data + len);
+        f.broadcast = memcmp(t, BROADCAST_MAC, 6) == 0;
+        f.attempt = 0;
+        n.txQueue.push_back(std::move(f));
+    }
+    kickTx(n);
+    return ESP_OK;
+}
+
+esp_err_t Simulator::driverAddPeer(const uint8_t *mac) {
+    if (!mac) return ESP_ERR_ESPNOW_ARG;
+    if (driverHasPeer(mac)) return ESP_ERR_ESPNOW_EXIST;
+    if (current->driverPeers.size() >= cfg.driverPeers) return ESP_ERR_ESPNOW_FULL;
+    current->driverPeers.emplace_back(mac, mac + 6);
+    current->driverPeersPeak = std::max(current->driverPeersPeak, current->driverPeers.size());
+    return ESP_OK;
+}
+
+esp_err_t Simulator::driverDelPeer(const uint8_t *mac) {
+    auto &peers = current->driverPeers;
+    for (auto it = peers.begin(); it != peers.end(); ++it) {
+        if (memcmp(it->data(), mac, 6) == 0) {
+            peers.erase(it);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_ESPNOW_NOT_FOUND;
+}
+
+bool Simulator::driverHasPeer(const uint8_t *mac) {
+    for (auto &p : current->driverPeers)
+        if (memcmp(p.data(), mac, 6) == 0) return true;
+    return false;
+}
+
+int Simulator::driverPeerCount() {
+    return (int)current->driverPeers.size();
+}
+
+// =======================================
+// ===== NODE CLOCKS AND TIMERS ====
+// =======================================
+
+int64_t Simulator::localUs() const {
+    if (!current) return (int64_t)now;
+    return (int64_t)(current->clockBaseUs + now) + (int64_t)std::llround(now * current->clockPpm * 1e-6);
+}
+
+esp_err_t Simulator::timerCreate(const esp_timer_create_args_t *args, esp_timer_handle_t *out) {
+    if (!args || !args->callback || !out || !current) return ESP_ERR_INVALID_ARG;
+    timers.push_back(std::unique_ptr<SimTimer>(new SimTimer{args->callback, args->arg, current, current->bootedUs, 0}));
+    *out = timers.back().get();
+    return ESP_OK;
+}
+
+// The timeout runs on the node's own clock; a sleeping node's timer is lost (the wake kicks its radio anyway)
+esp_err_t Simulator::timerStart(SimTimer *t, uint64_t timeoutUs) {
+    if (!t || !t->callback) return ESP_ERR_INVALID_ARG;
+    if (t->armed) return ESP_ERR_INVALID_STATE;
+    uint64_t gen = t->armed = ++timerGen;
+    uint64_t at = now + (uint64_t)std::llround(timeoutUs / (1.0 + t->node->clockPpm * 1e-6));
+    schedule(at, [this, t, gen]() {
+        if (t->armed != gen || !t->callback || t->node->bootedUs != t->bootedUs) return;
+        t->armed = 0;
+        if (!t->node->asleep) runAs(*t->node, [t]() { t->callback(t->arg); });
+    });
+    return ESP_OK;
+}
+
+// CSMA/CA: wait for the medium to go idle, then DIFS plus a random backoff
+void Simulator::kickTx(SimNode &n) {
+    if (n.txActive || n.txQueue.empty()) return;
+    n.txActive = true;
+    uint64_t start = std::max(now, n.mediumBusyUs) + DIFS_US + (uint64_t)randomBelow(CW_MIN + 1) * SLOT_US;
+    SimNode *node = &n;
+    schedule(start, [this, node]() { beginTx(*node); });
+}
+
+void Simulator::beginTx(SimNode &n) {
+    if (n.txQueue.empty() || n.asleep) {
+        n.txActive = false;  // Queue flushed by a reboot during backoff, or the radio went off (kicked on wake)
+        return;
+    }
+    if (n.mediumBusyUs > now) {
+        // Someone started transmitting during our backoff: defer again
+        uint64_t start = n.mediumBusyUs + DIFS_US + (uint64_t)randomBelow(CW_MIN + 1) * SLOT_US;
+        SimNode *node = &n;
+        schedule(start, [this, node]() { beginTx(*node); });
+        return;
+    }
+
+    Tx tx;
+    tx.id = nextTxId++;
+    tx.src = n.id;
+    tx.frame = std::move(n.txQueue.front());
+    n.txQueue.pop_front();
+
+    uint64_t dur = airtimeUs(tx.frame.data.size());
+    if (!tx.frame.broadcast) dur += SIFS_US + MAC_ACK_US;  // Medium held for the MAC-level ACK
+    uint64_t end = now + dur;
+    n.txEndUs = end;
+    n.framesTx++;
+    n.frameBytes += tx.frame.data.size();
+    const std::vector<uint8_t> &d = tx.frame.data;
+    if (!d.empty() && (d[0] & ENowMesh::COMPACT_HEADER)) {
+        const ENowMesh::compact_hdr_t *c = (const ENowMesh::compact_hdr_t*)d.data();
+        if (((c->flags >> 3) & 0x03) == ENowMesh::ADDR_BROADCAST) floodFrames++;   // Never a HELLO
+    } else if (d.size() >= sizeof(ENowMesh::packet_hdr_t)) {
+        const ENowMesh::packet_hdr_t *h = (const ENowMesh::packet_hdr_t*)d.data();
+        if (memcmp(h->dest_mac, BROADCAST_MAC, 6) == 0 && (h->msg_type & ENowMesh::MSG_TYPE_CONTROL) != ENowMesh::MSG_TYPE_HELLO)
+            floodFrames++;
+    }
+    n.airtimeUs += dur;
+
+    // Half duplex: anything this node was receiving is lost
+    for (auto &rx : n.receiving) rx.corrupted = true;
+
+    for (const SimLink &l : n.links) {
+        SimNode &r = *nodes[l.to];
+        r.mediumBusyUs = std::max(r.mediumBusyUs, end);
+        r.receiving.erase(std::remove_if(r.receiving.begin(), r.receiving.end(),
+                                         [this](const SimNode::Rx &x) { return x.endUs <= now; }),
+                          r.receiving.end());
+        bool corrupted = r.txActive && r.txEndUs > now;
+        if (!r.receiving.empty()) {
+            for (auto &rx : r.receiving) rx.corrupted = true;
+            corrupted = true;
+        }
+        r.receiving.push_back({tx.id, end, corrupted});
+    }
+
+    SimNode *node = &n;
+    schedule(end, [this, node, tx]() { endTx(*node, tx); });
+}
+
+void Simulator::endTx(SimNode &n, const Tx &tx) {
+    const SimFrame &f = tx.frame;
+    bool acked = false;
+
+    for (const SimLink &l : n.links) {
+        SimNode &r = *nodes[l.to];
+        bool corrupted = true;
+        for (auto it = r.receiving.begin(); it != r.receiving.end(); ++it) {
+            if (it->txId == tx.id) {
+                corrupted = it->corrupted;
+                r.receiving.erase(it);
+                break;
+            }
+        }
+        bool addressed = f.broadcast || memcmp(f.dest, r.mac, 6) == 0;
+        if (!addressed) continue;
+        if (r.asleep) { asleepMisses++; continue; }
+        if (corrupted) { collisions++; continue; }
+        if (chance(l.loss)) { lossDrops++; continue; }
+        if (!f.broadcast) acked = true;
+
+        SimNode *rp = &r;
+        std::vector<uint8_t> data = f.data;
+        uint8_t src[6], dst[6];
+        memcpy(src, n.mac, 6);
+        memcpy(dst, f.dest, 6);
+        int8_t rssi = l.rssi;
+        schedule(now + callbackDelayUs(), [this, rp, data, src, dst, rssi]() mutable {
+            wifi_pkt_rx_ctrl_t ctrl = {};
+            ctrl.rssi = rssi;
+            esp_now_recv_info_t info = {src, dst, &ctrl};
+            runAs(*rp, [&]() { rp->mesh.handleDataRecv(&info, data.data(), (int)data.size()); });
+        });
+    }
+
+    if (!f.broadcast && !acked && f.attempt < cfg.macRetries) {
+        SimFrame retry = f;
+        retry.attempt++;
+        macRetransmissions++;
+        n.txQueue.push_front(std::move(retry));
+    } else {
+        esp_now_send_status_t status = (f.broadcast || acked) ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL;
+        uint8_t dst[6], src[6];
+        memcpy(dst, f.dest, 6);
+        memcpy(src, n.mac, 6);
+        SimNode *np = &n;
+        schedule(now + callbackDelayUs(), [this, np, dst, src, status]() mutable {
+            esp_now_send_info_t info = {dst, src, WIFI_IF_STA};
+            runAs(*np, [&]() { np->mesh.handleDataSent(&info, status); });
+        });
+    }
+
+    n.txActive = false;
+    kickTx(n);
+}
+
+// =======================================
+// ===== RUN / REPORT ====
+// =======================================
+
+void Simulator::run() {
+    rng.seed(cfg.seed);
+    callbackRng.seed(cfg.seed * 2246822519u + 1);
+    setupNodes();
+    startTraffic();
+
+    uint64_t endUs = (cfg.durationMs + cfg.drainMs) * 1000;
+    while (!events.empty()) {
+        Event ev = events.top();
+        if (ev.at > endUs) break;
+        events.pop();
+        now = ev.at;
+        ev.fn();
+    }
+    now = endUs;
+}
+
+static double percentile(std::vector<double> &v, double p) {
+    if (v.empty()) return 0.0;
+    size_t idx = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+    return v[std::min(idx, v.size() - 1)];
+}
+
+void Simulator::report(FILE *out) {
+    size_t links = 0;
+    uint64_t frames = 0, frameBytes = 0, airtime = 0, drops = 0;
+    uint64_t routes = 0, routeHits = 0, routeMisses = 0, uplinkSends = 0, uplinkMisses = 0;
+    uint32_t poolHighWater = 0, poolExhausted = 0;
+    uint32_t rxHighWater = 0, rxDropped = 0, rxProcessed = 0, rxMaxLatencyUs = 0;
+    uint64_t rxLatencySumUs = 0;
+    uint32_t txHighWater[ENowMesh::TX_CLASS_COUNT] = {}, txDropped[ENowMesh::TX_CLASS_COUNT] = {};
+    uint32_t txQueued = 0, txMaxWaitUs = 0, txStalls = 0;
+    uint64_t txWaitSumUs = 0;
+    for (auto &n : nodes) {
+        ENowMesh::RxQueueStats rq = n->mesh.getRxQueueStats();
+        rxHighWater = std::max<uint32_t>(rxHighWater, rq.highWater);
+        rxDropped += rq.dropped;
+        rxProcessed += rq.processed;
+        rxMaxLatencyUs = std::max(rxMaxLatencyUs, rq.maxLatencyUs);
+        rxLatencySumUs += (uint64_t)rq.avgLatencyUs * rq.processed;
+        ENowMesh::TxQueueStats tq = n->mesh.getTxQueueStats();
+        for (size_t c = 0; c < ENowMesh::TX_CLASS_COUNT; ++c) {
+            txHighWater[c] = std::max<uint32_t>(txHighWater[c], tq.highWater[c]);
+            txDropped[c] += tq.dropped[c];
+        }
+        txQueued += tq.queued;
+        txMaxWaitUs = std::max(txMaxWaitUs, tq.maxWaitUs);
+        txWaitSumUs += (uint64_t)tq.avgWaitUs * tq.queued;
+        txStalls += tq.stalls;
+        ENowMesh::PacketPoolStats ps = n->mesh.getPacketPoolStats();
+        poolHighWater = std::max<uint32_t>(poolHighWater, ps.highWater);
+        poolExhausted += ps.exhausted;
+        ENowMesh::RouteStats rs = n->mesh.getRouteStats();
+        routes += n->mesh.getRouteCount();
+        routeHits += rs.hits;
+        routeMisses += rs.misses;
+        uplinkSends += rs.uplinkSends;
+        uplinkMisses += rs.uplinkMisses;
+        links += n->links.size();
+        frames += n->framesTx;
+        frameBytes += n->frameBytes;
+        airtime += n->airtimeUs;
+        drops += n->driverDrops;
+    }
+
+    uint64_t expected = 0, delivered = 0, floodDelivered = 0, deliveredBytes = 0;
+    size_t byKind[4] = {};
+    for (const SimMessage &m : messages) {
+        expected += m.expected;
+        delivered += m.receivedBy.size();
+        deliveredBytes += (uint64_t)m.size * m.receivedBy.size();
+        if (m.kind != 'u') floodDelivered += m.receivedBy.size();
+        byKind[m.kind == 'u' ? 0 : m.kind == 'b' ? 1 : m.kind == 'm' ? 2 : 3]++;
+    }
+    std::vector<double> latencies = deliveryLatencyMs;
+    std::sort(latencies.begin(), latencies.end());
+
+    fprintf(out, "nodes               %zu\n", nodes.size());
+    fprintf(out, "links               %zu\n", links / 2);
+    fprintf(out, "simulated time      %.1f s (+%.1f s drain)\n", cfg.durationMs / 1000.0, cfg.drainMs / 1000.0);
+    fprintf(out, "messages sent       %zu (unicast %zu, broadcast %zu, master %zu, repeaters %zu)\n",
+            messages.size(), byKind[0], byKind[1], byKind[2], byKind[3]);
+    fprintf(out, "deliveries          %llu / %llu expected, %llu duplicate\n", (unsigned long long)delivered,
+            (unsigned long long)expected, (unsigned long long)duplicateDeliveries);
+    metrics["delivery_ratio"] = expected ? (double)delivered / expected : 0.0;
+    metrics["duplicate_deliveries"] = (double)duplicateDeliveries;
+    metrics["failed_sends"] = (double)sendsFailed;
+    fprintf(out, "delivery ratio      %.4f\n", expected ? (double)delivered / expected : 0.0);
+    fprintf(out, "latency ms          p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+            percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+            latencies.empty() ? 0.0 : latencies.back());
+    if (!deliveryThroughput.empty()) {
+        std::vector<double> tp = deliveryThroughput;
+        std::sort(tp.begin(), tp.end());
+        fprintf(out, "large msg goodput   p10 %.1f  p50 %.1f  p90 %.1f KiB/s (%zu fragmented deliveries)\n",
+                percentile(tp, 10), percentile(tp, 50), percentile(tp, 90), tp.size());
+    }
+    if (!reboots.empty()) {
+        std::vector<double> fd = rebootFirstDeliveryMs;
+        std::sort(fd.begin(), fd.end());
+        fprintf(out, "after reboot        first delivery p50 %.1f  max %.1f ms (%zu of %zu reboots), %llu NVS writes\n",
+                percentile(fd, 50), fd.empty() ? 0.0 : fd.back(), fd.size(), reboots.size(),
+                (unsigned long long)nvsWrites);
+        // The cache's cost: flash writes per node-hour, next to what it buys a unicast sent right after boot
+        double nodeHours = nodes.size() * (cfg.durationMs + cfg.drainMs) / 3600000.0;
+        std::vector<double> fa = probeFirstAckMs;
+        std::sort(fa.begin(), fa.end());
+        if (probes)
+            fprintf(out, "boot probes         first ACK p50 %.1f  max %.1f ms (%zu of %zu), %llu failed, %llu flooded; "
+                    "%.2f NVS writes per node-hour\n",
+                    percentile(fa, 50), fa.empty() ? 0.0 : fa.back(), fa.size(), probes,
+                    (unsigned long long)probeFailures, (unsigned long long)probeFloods,
+                    nodeHours > 0 ? nvsWrites / nodeHours : 0.0);
+    }
+    if (sendsAcked || sendsFailed) {
+        std::vector<double> rtts = ackRttMs;
+        std::sort(rtts.begin(), rtts.end());
+        size_t lost = 0;   // ACKed, yet the destination never got the payload
+        for (const SimMessage &m : messages) if (m.acked && m.receivedBy.empty()) lost++;
+        metrics["acked_lost"] = (double)lost;
+        fprintf(out, "acked sends         %llu delivered, %llu failed, %.2f attempts avg, rtt p50 %.0f p99 %.0f ms, %zu acked but never received\n",
+                (unsigned long long)sendsAcked, (unsigned long long)sendsFailed,
+                (double)sendAttempts / (sendsAcked + sendsFailed), percentile(rtts, 50), percentile(rtts, 99), lost);
+    }
+    ENowMesh::MeshStats total = {};
+    for (auto &np : nodes) {
+        ENowMesh::MeshStats st = np->mesh.getStats();
+        total.forwarded += st.forwarded;
+        total.flooded += st.flooded;
+        total.duplicates += st.duplicates;
+        total.hopLimitDrops += st.hopLimitDrops;
+        total.retries += st.retries;
+        total.peersAdded += st.peersAdded;
+        total.peersRemoved += st.peersRemoved;
+        total.sendFailures += st.sendFailures;
+        total.floodSuppressed += st.floodSuppressed;
+        total.helloSent += st.helloSent;
+        total.helloSuppressed += st.helloSuppressed;
+        total.driverAdds += st.driverAdds;
+        total.driverEvictions += st.driverEvictions;
+        total.compactSent += st.compactSent;
+        total.idMisses += st.idMisses;
+        total.idConflicts += st.idConflicts;
+        total.mailboxHeld += st.mailboxHeld;
+        total.mailboxDropped += st.mailboxDropped;
+    }
+    fprintf(out, "mesh counters       forwarded %u, flooded %u, duplicates %u, hop-limit drops %u, retries %u, flood suppressed %u\n",
+            (unsigned)total.forwarded, (unsigned)total.flooded, (unsigned)total.duplicates,
+            (unsigned)total.hopLimitDrops, (unsigned)total.retries, (unsigned)total.floodSuppressed);
+    double nodeMinutes = nodes.size() * (cfg.durationMs + cfg.drainMs) / 60000.0;
+    fprintf(out, "hello beacons       %u sent (%.2f per node-minute), %u suppressed\n", (unsigned)total.helloSent,
+            nodeMinutes > 0 ? total.helloSent / nodeMinutes : 0.0, (unsigned)total.helloSuppressed);
+    fprintf(out, "peer churn          added %u, removed %u, driver send failures %u\n",
+            (unsigned)total.peersAdded, (unsigned)total.peersRemoved, (unsigned)total.sendFailures);
+    size_t driverPeak = 0;
+    for (auto &np : nodes) driverPeak = std::max(driverPeak, np->driverPeersPeak);
+    fprintf(out, "driver peers        %u adds, %u evictions (%.2f adds per node-minute), peak %zu registered\n",
+            (unsigned)total.driverAdds, (unsigned)total.driverEvictions,
+            nodeMinutes > 0 ? total.driverAdds / nodeMinutes : 0.0, driverPeak);
+    if (total.compactSent || total.idMisses)
+        fprintf(out, "compact headers     %u frames (%.1f%%), %u node ID misses, %u node ID conflicts\n",
+                (unsigned)total.compactSent, frames ? 100.0 * total.compactSent / frames : 0.0,
+                (unsigned)total.idMisses, (unsigned)total.idConflicts);
+    size_t sleepers = 0;
+    uint64_t sleptUs = 0, sleepSpanUs = 0;
+    for (auto &np : nodes) {
+        if (!np->sleepMs || np->sleepStartUs >= now) continue;
+        sleepers++;
+        sleptUs += np->sleptUs + (np->asleep ? now - np->asleepSinceUs : 0);
+        sleepSpanUs += now - np->sleepStartUs;
+    }
+    if (sleepers)
+        fprintf(out, "sleeping nodes      %zu, radio on %.1f%% of the time, %llu frames missed asleep; mailbox held %u, dropped %u\n",
+                sleepers, 100.0 * (sleepSpanUs - sleptUs) / sleepSpanUs, (unsigned long long)asleepMisses,
+                (unsigned)total.mailboxHeld, (unsigned)total.mailboxDropped);
+    if (!syncErrorUs.empty() || syncSamplesUnsynced) {
+        std::vector<double> all;
+        std::string byHops;
+        for (auto &h : syncErrorUs) {
+            std::vector<double> v = h.second;
+            std::sort(v.begin(), v.end());
+            all.insert(all.end(), v.begin(), v.end());
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%s%d: %.0f/%.0f", byHops.empty() ? "" : ", ", h.first, percentile(v, 50), percentile(v, 99));
+            byHops += buf;
+        }
+        std::sort(all.begin(), all.end());
+        std::sort(driftErrorPpm.begin(), driftErrorPpm.end());
+        fprintf(out, "time sync           error p50 %.0f  p90 %.0f  p99 %.0f  max %.0f us (%.1f%% of samples synced), drift error p50 %.2f p99 %.2f ppm\n",
+                percentile(all, 50), percentile(all, 90), percentile(all, 99), all.empty() ? 0.0 : all.back(),
+                100.0 * all.size() / (all.size() + syncSamplesUnsynced), percentile(driftErrorPpm, 50), percentile(driftErrorPpm, 99));
+        fprintf(out, "sync error by hops  %s (p50/p99 us)\n", byHops.c_str());
+        size_t slotted = 0;
+        uint32_t changes = 0, steps = 0, outliers = 0;
+        for (auto &np : nodes) {
+            ENowMesh::SyncStatus st = np->mesh.getSyncStatus();
+            if (st.slot != ENowMesh::TDMA_SLOT_NONE) slotted++;
+            changes += st.slotChanges;
+            steps += st.steps;
+            outliers += st.outliers;
+        }
+        fprintf(out, "sync/slots          %u clock steps, %u outlier pairs; %zu nodes with a TDMA slot, %u slot changes\n",
+                (unsigned)steps, (unsigned)outliers, slotted, (unsigned)changes);
+    }
+    if (telemetryReports) {
+        fprintf(out, "telemetry           %llu reports from %zu nodes\n",
+                (unsigned long long)telemetryReports, telemetrySources.size());
+    }
+    fprintf(out, "frames transmitted  %llu (mac retransmissions %llu)\n",
+            (unsigned long long)frames, (unsigned long long)macRetransmissions);
+    fprintf(out, "airtime total       %.1f ms\n", airtime / 1000.0);
+    fprintf(out, "airtime/delivery    %.3f ms\n", delivered ? airtime / 1000.0 / delivered : 0.0);
+    fprintf(out, "frames/delivery     %.2f\n", delivered ? (double)frames / delivered : 0.0);
+    fprintf(out, "airtime goodput     %.1f kbit/s (delivered payload bits per second on air), %.1f bytes per frame\n",
+            airtime ? deliveredBytes * 8000.0 / airtime : 0.0, frames ? (double)frameBytes / frames : 0.0);
+    if (floodDelivered)
+        fprintf(out, "flood tx/delivery   %.2f (%llu broadcast, master and repeaters deliveries)\n",
+                (double)floodFrames / floodDelivered, (unsigned long long)floodDelivered);
+    fprintf(out, "routes              %.1f per node (lookups: %llu hit, %llu miss; to master: %llu via uplink, %llu flooded)\n",
+            nodes.empty() ? 0.0 : (double)routes / nodes.size(),
+            (unsigned long long)routeHits, (unsigned long long)routeMisses,
+            (unsigned long long)uplinkSends, (unsigned long long)uplinkMisses);
+    fprintf(out, "packet pool         high-water %u / %u, exhausted %u\n",
+            (unsigned)poolHighWater, (unsigned)ENowMesh::PACKET_POOL_SIZE, (unsigned)poolExhausted);
+    if (rxProcessed || rxDropped)
+        fprintf(out, "rx queue            high-water %u / %u, dropped %u, latency avg %.2f ms max %.2f ms\n",
+                (unsigned)rxHighWater, (unsigned)ENowMesh::RX_QUEUE_SIZE - 1, (unsigned)rxDropped,
+                rxProcessed ? rxLatencySumUs / 1000.0 / rxProcessed : 0.0, rxMaxLatencyUs / 1000.0);
+    if (txQueued || txDropped[ENowMesh::TX_APP] || txDropped[ENowMesh::TX_FORWARD])
+        fprintf(out, "tx queue            high-water ack/ctl/app/fwd %u/%u/%u/%u, dropped %u/%u/%u/%u, wait avg %.2f ms max %.2f ms, stalls %u\n",
+                (unsigned)txHighWater[0], (unsigned)txHighWater[1], (unsigned)txHighWater[2], (unsigned)txHighWater[3],
+                (unsigned)txDropped[0], (unsigned)txDropped[1], (unsigned)txDropped[2], (unsigned)txDropped[3],
+                txQueued ? txWaitSumUs / 1000.0 / txQueued : 0.0, txMaxWaitUs / 1000.0, (unsigned)txStalls);
+    fprintf(out, "collisions          %llu\n", (unsigned long long)collisions);
+    fprintf(out, "channel losses      %llu\n", (unsigned long long)lossDrops);
+    fprintf(out, "driver queue drops  %llu\n", (unsigned long long)drops);
+}
+
+// ----- Expectations -----
+bool Simulator::checkExpectations(FILE *out) {
+    bool ok = true;
+    for (const SimExpect &e : expects) {
+        double v = metrics[e.metric];
+        bool held = e.atMost ? v <= e.value : v >= e.value;
+        fprintf(out, "expect              %s %.4g %s %.4g: %s\n", e.metric.c_str(), v, e.atMost ? "<=" : ">=", e.value,
+                held ? "ok" : "FAILED");
+        ok = ok && held;
+    }
+    return ok;
+}
@@ -0,0 +1,257 @@
+// ENowMesh host simulator
+// Discrete-event model of an ESP-NOW radio that drives unmodified src/ENowMesh.cpp.
+// Every node owns a real ENowMesh instance; the shims in shim/ route esp_now_*,
+// millis() and Serial through the Simulator for whichever node is currently executing.
+#ifndef ENOWMESH_SIM_H
+#define ENOWMESH_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ENowMesh.h"
+
+struct SimConfig {
+    uint64_t durationMs = 600000;   // Simulated time to run
+    uint64_t warmupMs = 30000;      // Traffic starts after this (lets HELLOs populate peer tables)
+    uint64_t drainMs = 30000;       // Quiet period at the end so in-flight messages can land
+    uint32_t seed = 1;
+    uint32_t loopMs = 100;          // How often each node runs its maintenance loop
+    double bitrateMbps = 1.0;       // ESP-NOW default PHY rate
+    uint8_t macRetries = 3;         // 802.11 retransmissions for unicast frames
+    uint16_t driverQueue = 32;      // Frames the driver accepts before ESP_ERR_ESPNOW_NO_MEM
+    uint16_t driverPeers = ESP_NOW_MAX_TOTAL_PEER_NUM;
+    double clockPpm = 0;            // Node clocks run up to this fast or slow, from up to 10 s apart (0 = one clock)
+    uint32_t callbackUs = 0;        // Driver callbacks run up to this long after the frame ends on air
+    bool verbose = false;           // Print every Serial line with time and node prefix
+    bool formatSerial = false;      // Format Serial output without printing it (benchmarks)
+};
+
+struct SimLink {
+    int to;
+    double loss;    // Per-attempt frame loss probability
+    int8_t rssi;
+};
+
+struct SimFrame {
+    uint8_t dest[6];
+    std::vector<uint8_t> data;
+    bool broadcast;
+    uint8_t attempt;
+};
+
+struct SimNode {
+    int id = 0;
+    std::string name;
+    ENowMesh::NodeRole role = ENowMesh::ROLE_REPEATER;
+    uint8_t mac[6] = {};
+    ENowMesh mesh;
+    std::vector<SimLink> links;
+    std::vector<std::vector<uint8_t>> driverPeers;  // esp_now_add_peer registrations
+    size_t driverPeersPeak = 0;                     // Most registrations at once, broadcast peer included
+    std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs;  // Preferences namespaces, kept across reboots
+    uint64_t bootedUs = 0;      // Last reboot, 0 = never rebooted
+    bool awaitingFirstDelivery = false;  // Rebooted, none of its messages delivered since
+    int probeDst = -1;          // Boot probe target until a probe is ACKed, -1 = none
+    double clockPpm = 0;        // Rate error of its esp_timer/millis() clock
+    uint64_t clockBaseUs = 0;   // Its clock reading at simulated time 0
+
+    // Sleep schedule ("sleep" directive): radio and loop off except awakeMs out of every sleepMs + awakeMs
+    uint32_t sleepMs = 0;
+    uint32_t awakeMs = 0;
+    bool asleep = false;
+    uint64_t sleepStartUs = 0;  // First time it went to sleep
+    uint64_t asleepSinceUs = 0;
+    uint64_t nextWakeUs = 0;
+    uint64_t sleptUs = 0;       // Total time asleep, the current sleep excluded
+
+    // Radio state
+    std::deque<SimFrame> txQueue;
+    bool txActive = false;
+    uint64_t txEndUs = 0;       // End of this node's current transmission
+    uint64_t mediumBusyUs = 0;  // Latest end of any transmission this node can hear
+    struct Rx { uint64_t txId; uint64_t endUs; bool corrupted; };
+    std::vector<Rx> receiving;
+
+    // Counters
+    uint64_t framesTx = 0;
+    uint64_t frameBytes = 0;    // ESP-NOW payload bytes of those frames
+    uint64_t airtimeUs = 0;
+    uint64_t driverDrops = 0;
+};
+
+struct SimMessage {
+    int src;
+    int dst;            // Node index, or -1 for role/broadcast traffic
+    char kind;          // 'u' unicast, 'b' broadcast, 'm' to master, 'r' to repeaters
+    uint64_t sentUs;
+    uint16_t size;
+    int expected;
+    std::vector<int> receivedBy;
+    bool acked = false;     // A SendResult reported it delivered
+    bool probe = false;     // Sent by a rebooted node's boot probe
+};
+
+struct SimTraffic {
+    std::string src;    // Node name, role name, or "*"
+    std::string dst;    // Node name, "*", "master", "repeaters" or "random" (another node per message)
+    uint32_t intervalMs;
+    uint32_t count;
+    uint16_t size;
+    uint64_t startMs;
+};
+
+struct SimReboot {
+    int node;
+    uint64_t atMs;
+    int probeDst;       // Node unicast to right after boot until one is ACKed, -1 = none
+};
+
+// esp_timer one-shot timer; a reboot of its node orphans it
+struct SimTimer {
+    esp_timer_cb_t callback;
+    void *arg;
+    SimNode *node;
+    uint64_t bootedUs;  // Node boot that created it
+    uint64_t armed;     // Generation of the pending expiry, 0 = stopped
+};
+
+// Report metric checked after the run: the simulator exits non-zero when it doesn't hold
+struct SimExpect {
+    std::string metric;
+    bool atMost;        // <= value, else >= value
+    double value;
+};
+
+struct SimSleep {
+    std::string who;    // Node name or role name
+    uint32_t sleepMs;
+    uint32_t awakeMs;
+};
+
+class Simulator {
+    public:
+        SimConfig cfg;
+
+        Simulator();
+
+        // Topology / scenario
+        bool loadTopology(const char *path, std::string &err);
+        bool applyDirective(const std::string &line, std::string &err);
+
+        void run();
+        void report(FILE *out);
+        bool checkExpectations(FILE *out);   // After report(): false if an `expect` failed
+
+        // Clock and scheduling
+        uint64_t nowUs() const { return now; }
+        int64_t localUs() const;    // The current node's clock
+        void schedule(uint64_t atUs, std::function<void()> fn);
+
+        // Entry points for the shims, always acting on the current node
+        SimNode* current = nullptr;
+        uint64_t serialBytes = 0;   // Bytes written to Serial by the mesh code (verbose or formatSerial)
+        uint64_t nvsWrites = 0;     // Preferences put* calls (flash wear)
+        long randomBelow(long n);
+        void log(const char *text);
+        esp_err_t driverSend(const uint8_t *peer_addr, const uint8_t *data, size_t len);
+        esp_err_t driverAddPeer(const uint8_t *mac);
+        esp_err_t driverDelPeer(const uint8_t *mac);
+        bool driverHasPeer(const uint8_t *mac);
+        int driverPeerCount();
+        esp_err_t timerCreate(const esp_timer_create_args_t *args, esp_timer_handle_t *out);
+        esp_err_t timerStart(SimTimer *t, uint64_t timeoutUs);
+
+        // Delivery hooks from the node message and send callbacks
+        void onDelivered(const uint8_t *payload, size_t len);
+        void onSendResult(const ENowMesh::SendResult &result);
+        void onTelemetry(const uint8_t *src_mac, const ENowMesh::TelemetryReport &report);
+
+    private:
+        struct Event {
+            uint64_t at;
+            uint64_t seq;
+            std::function<void()> fn;
+            bool operator>(const Event &o) const { return at != o.at ? at > o.at : seq > o.seq; }
+        };
+
+        struct Tx {
+            uint64_t id;
+            int src;
+            SimFrame frame;
+        };
+
+        std::vector<std::unique_ptr<SimNode>> nodes;
+        std::vector<SimTraffic> traffic;
+        std::vector<SimReboot> reboots;
+        std::vector<SimSleep> sleeps;
+        std::vector<SimExpect> expects;
+        std::map<std::string, double> metrics;  // Values `expect` can check, filled by report()
+        std::vector<std::unique_ptr<SimTimer>> timers;
+        uint64_t timerGen = 0;
+        std::vector<SimMessage> messages;
+        std::vector<double> deliveryLatencyMs;  // First receipt minus send time, per delivery
+        std::vector<double> ackRttMs;           // SendResult.rttMs of ACKed unicasts
+        std::vector<double> deliveryThroughput; // KiB/s of fragmented messages: size / delivery latency
+        std::vector<double> rebootFirstDeliveryMs;  // Reboot to first delivery of a message the node sent after it
+        std::vector<double> probeFirstAckMs;    // Reboot to the first ACKed boot probe
+        size_t probes = 0;                      // Reboots with a boot probe
+        uint64_t probeFailures = 0;             // Boot probes whose SendResult failed
+        uint64_t probeFloods = 0;               // Unicasts rebooted nodes flooded (no route) before their probe's ACK
+        std::map<int, std::vector<double>> syncErrorUs; // |mesh time - MASTER's| of synced nodes, by hops, every second
+        std::vector<double> driftErrorPpm;      // |SyncStatus.driftPpb - true relative rate| at the same samples
+        size_t syncSamplesUnsynced = 0;         // Samples of nodes with timeSync not (yet) synced
+        uint64_t duplicateDeliveries = 0;       // Payloads handed to the same node's application again
+        uint64_t sendsAcked = 0;
+        uint64_t sendsFailed = 0;
+        uint64_t sendAttempts = 0;
+        std::map<std::pair<int, uint16_t>, std::vector<uint32_t>> ackedSendSeqs;  // (node, seq) -> unicast messages awaiting a SendResult
+        uint64_t telemetryReports = 0;
+        std::set<std::string> telemetrySources;  // Raw 6-byte MACs that reported
+        std::vector<std::string> meshSettings;  // "set" directives, applied after all nodes exist
+        std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+        std::mt19937 rng;
+        std::mt19937 callbackRng;   // Own generator, so callback_us leaves the other draws as they were
+        uint64_t now = 0;
+        uint64_t eventSeq = 0;
+        uint64_t nextTxId = 1;
+
+        // Radio counters
+        uint64_t collisions = 0;
+        uint64_t lossDrops = 0;
+        uint64_t macRetransmissions = 0;
+        uint64_t floodFrames = 0;   // Transmissions of mesh broadcasts (dest_mac all 0xFF, HELLOs excluded)
+        uint64_t asleepMisses = 0;  // Frames addressed to a node whose radio was off
+
+        SimNode* findNode(const std::string &name);
+        SimNode* addNode(const std::string &name, ENowMesh::NodeRole role);
+        bool addLink(const std::string &a, const std::string &b, double loss, int rssi, std::string &err);
+        bool applyMeshSetting(SimNode &n, const std::string &key, long value);
+        void bootNode(SimNode &n);
+        void setupNodes();
+        void startTraffic();
+        void sleepCycle(SimNode &n, bool wake);
+        void sampleSync();
+        void sendMessage(SimNode &src, const SimTraffic &t);
+        void sendProbe(SimNode &src, uint64_t bootedUs);
+
+        uint64_t airtimeUs(size_t len) const;
+        uint64_t callbackDelayUs();
+        void runAs(SimNode &n, const std::function<void()> &fn);
+        void kickTx(SimNode &n);
+        void beginTx(SimNode &n);
+        void endTx(SimNode &n, const Tx &tx);
+        bool chance(double p);
+};
+
+extern Simulator *g_sim;
+
+#endif
@@ -1,25 +1,79 @@
 #include "ENowMesh.h"
+#include <Preferences.h>
 
-// ----- Static storage -----
-ENowMesh::PeerInfo ENowMesh::peersStatic[ENowMesh::PEER_TABLE_SIZE] = {};
-uint8_t ENowMesh::myMacStatic[6] = {};
-ENowMesh* ENowMesh::instance = nullptr;
+// =======================================
+// ===== LOGGING ===
+// =======================================
+// Compile-time log level and subsystem mask. Set with build flags, e.g.
+//   -DENOWMESH_LOG_LEVEL=ENOWMESH_LOG_OFF                        (silent, no logging code at all)
+//   -DENOWMESH_LOG_LEVEL=3 -DENOWMESH_LOG_MASK=0x18              (trace RX + forwarding only)
+// Disabled calls compile to nothing, so their arguments (macToStr() Strings,
+// msgTypeToStr()) are never built.
+#define ENOWMESH_LOG_OFF    0
+#define ENOWMESH_LOG_ERROR  1   // Failures: driver errors, full tables, exhausted pools
+#define ENOWMESH_LOG_INFO   2   // Events: peers added/pruned, retries, malformed packets
+#define ENOWMESH_LOG_TRACE  3   // Every packet: send, receive, forward, ACK, HELLO
+
+#define ENOWMESH_LOG_SYS    0x01  // Init and configuration
+#define ENOWMESH_LOG_PEER   0x02  // Peer table
+#define ENOWMESH_LOG_ROUTE  0x04  // Route learning and lookups
+#define ENOWMESH_LOG_RX     0x08  // Receive path and delivery
+#define ENOWMESH_LOG_FWD    0x10  // Forwarding decisions
+#define ENOWMESH_LOG_TX     0x20  // Originated sends and driver errors
+#define ENOWMESH_LOG_ACK    0x40  // ACKs, retries, delivery confirmation
+#define ENOWMESH_LOG_HELLO  0x80  // HELLO beacons
+#define ENOWMESH_LOG_ALL    0xFF
+
+#ifndef ENOWMESH_LOG_LEVEL
+#define ENOWMESH_LOG_LEVEL ENOWMESH_PICK(ENOWMESH_LOG_INFO, ENOWMESH_LOG_INFO, ENOWMESH_LOG_ERROR)
+#endif
+
+#ifndef ENOWMESH_LOG_MASK
+#define ENOWMESH_LOG_MASK ENOWMESH_LOG_ALL
+#endif
+
+#define MESH_LOG_IF(sub, ...) do { if ((sub) & (ENOWMESH_LOG_MASK)) Serial.printf(__VA_ARGS__); } while (0)
+#define MESH_LOG_NONE(...)    do { if (0) Serial.printf(__VA_ARGS__); } while (0)  // Type-checked, compiled out
 
-ENowMesh::SeenPacket ENowMesh::seenPacketsStatic[ENowMesh::DUP_DETECT_BUFFER_SIZE] = {};
-uint16_t ENowMesh::seenPacketsIndex = 0;
-portMUX_TYPE ENowMesh::seenPacketsMux = portMUX_INITIALIZER_UNLOCKED;
+#if ENOWMESH_LOG_LEVEL >= ENOWMESH_LOG_ERROR
+#define MESH_LOGE(sub, ...) MESH_LOG_IF(sub, __VA_ARGS__)
+#else
+#define MESH_LOGE(sub, ...) MESH_LOG_NONE(__VA_ARGS__)
+#endif
 
-ENowMesh::PendingMessage ENowMesh::pendingMessages[ENowMesh::MAX_PENDING_MESSAGES] = {};
-portMUX_TYPE ENowMesh::pendingMux = portMUX_INITIALIZER_UNLOCKED;
+#if ENOWMESH_LOG_LEVEL >= ENOWMESH_LOG_INFO
+#define MESH_LOGI(sub, ...) MESH_LOG_IF(sub, __VA_ARGS__)
+#else
+#define MESH_LOGI(sub, ...) MESH_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if ENOWMESH_LOG_LEVEL >= ENOWMESH_LOG_TRACE
+#define MESH_LOGT(sub, ...) MESH_LOG_IF(sub, __VA_ARGS__)
+#else
+#define MESH_LOGT(sub, ...) MESH_LOG_NONE(__VA_ARGS__)
+#endif
+
+// ----- Static storage -----
+ENowMesh* ENowMesh::instance = nullptr;
 
 // ----- Constructor -----
 ENowMesh::ENowMesh() {
-    instance = this;
+    resetPeerTable();
+    resetRouteTable();
+    resetSeenSources();
+    resetTxQueue();
+    resetNodeIds();
 }
 
 // ----- Role Management -----
 void ENowMesh::setRole(NodeRole r) {
+    if (!FORWARDING && r != ROLE_LEAF) {
+        MESH_LOGE(ENOWMESH_LOG_SYS, "Built without forwarding (ENOWMESH_FORWARDING=0) - staying LEAF.\n");
+        return;
+    }
+    if (r == role) return;
     role = r;
+    resetHelloTimer();   // Neighbours learn the new role (and MASTER distance) soon
 }
 
 ENowMesh::NodeRole ENowMesh::getRole() const {
@@ -37,31 +91,78 @@ const char* ENowMesh::getRoleName() const {
 
 // ----- Accessors -----
 ENowMesh::PeerInfo* ENowMesh::getPeerTable() {
-    return peersStatic;
+    return peers;
 }
 
 uint8_t* ENowMesh::getNodeMac() {
-    return myMacStatic;
+    return myMac;
 }
 
 // ----- WiFi Setup -----
 void ENowMesh::initWiFi() {
     WiFi.mode(WIFI_STA);
     WiFi.disconnect(false, true);
-    WiFi.macAddress(myMacStatic);
-    Serial.printf("Node MAC: %s\n", macToStr(myMacStatic).c_str());
+    WiFi.macAddress(myMac);
+    MESH_LOGI(ENOWMESH_LOG_SYS, "Node MAC: %s\n", macToStr(myMac).c_str());
 }
 
 // ----- ESP-NOW Init -----
 void ENowMesh::initEspNow() {
     if (esp_now_init() != ESP_OK) {
-        Serial.println("Error initializing ESP-NOW!");
+        MESH_LOGE(ENOWMESH_LOG_SYS, "Error initializing ESP-NOW!\n");
         while (true) delay(100);
     }
+
+    // New epoch and sequence start per boot (the radio is up, so random() is hardware entropy).
+    // Receivers reset their duplicate window for us when the epoch changes.
+    bootEpoch = (uint8_t)random(1, 256);
+    seqCounter.store((uint16_t)random(0x10000));
+    ackedSeqCounter.store((uint16_t)random(0x10000));
+    fragMsgCounter = (uint16_t)random(0x10000);
+    MESH_LOGI(ENOWMESH_LOG_SYS, "Boot epoch %u\n", (unsigned)bootEpoch);
+
+    // Broadcast peer so HELLO beacons reach nodes that are not in the peer table yet
+    esp_now_peer_info_t info = {};
+    memset(info.peer_addr, 0xFF, 6);
+    info.channel = channel;
+    info.ifidx = WIFI_IF_STA;
+    info.encrypt = 0;
+    esp_err_t result = esp_now_add_peer(&info);
+    if (result != ESP_OK && result != ESP_ERR_ESPNOW_EXIST) {
+        MESH_LOGE(ENOWMESH_LOG_SYS, "Failed to add broadcast peer: %d\n", result);
+    }
+
+    // A fresh driver holds no unicast peers
+    portENTER_CRITICAL(&driverPeersMux);
+    driverPeerUsed.clearAll();
+    portEXIT_CRITICAL(&driverPeersMux);
+
+    if (peerCacheInterval) loadPeerCache();
 }
 
 // ----- Register Callbacks -----
 void ENowMesh::registerCallbacks() {
+    instance = this;
+
+    if (rxMode == RX_TASK && !rxTaskHandle) {
+        if (xTaskCreate(rxTaskLoop, "enowmesh_rx", rxTaskStackSize, this, rxTaskPriority, &rxTaskHandle) != pdPASS) {
+            MESH_LOGE(ENOWMESH_LOG_SYS, "Failed to create RX task - falling back to RX_POLL (call poll() in loop)\n");
+            rxTaskHandle = nullptr;
+            rxMode = RX_POLL;
+        }
+    }
+
+    if (tdmaSlots && !slotTimer) {
+        esp_timer_create_args_t args = {};
+        args.callback = slotTimerCb;
+        args.arg = this;
+        args.name = "enowmesh_slot";
+        if (esp_timer_create(&args, &slotTimer) != ESP_OK) {
+            MESH_LOGE(ENOWMESH_LOG_SYS, "Failed to create slot timer - sending unslotted\n");
+            slotTimer = nullptr;
+        }
+    }
+
     esp_now_register_send_cb(OnDataSent);
     esp_now_register_recv_cb(OnDataRecv);
 }
@@ -71,6 +172,36 @@ void ENowMesh::setMessageCallback(MessageCallback cb) {
     userCallback = cb;
 }
 
+void ENowMesh::setReceiveCallback(ReceiveCallback cb) {
+    receiveCallback = cb;
+}
+
+void ENowMesh::setSendCallback(SendCallback cb) {
+    sendCallback = cb;
+}
+
+uint16_t ENowMesh::getLastSeq() {
+    return lastSeq;
+}
+
+void ENowMesh::setTelemetryCallback(TelemetryCallback cb) {
+    telemetryCallback = cb;
+}
+
+// ----- Statistics -----
+ENowMesh::MeshStats ENowMesh::getStats() {
+    // Field i of MeshStats is counter i; each is read atomically, the set as a whole is not a snapshot
+    uint32_t counters[STAT_COUNT];
+    for (size_t i = 0; i < STAT_COUNT; ++i) counters[i] = stats[i].load(std::memory_order_relaxed);
+    MeshStats out;
+    memcpy(&out, counters, sizeof(out));
+    return out;
+}
+
+void ENowMesh::resetStats() {
+    for (size_t i = 0; i < STAT_COUNT; ++i) stats[i].store(0, std::memory_order_relaxed);
+}
+
 // ----- Set WiFi Channel -----
 void ENowMesh::setChannel() {
     esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
@@ -88,12 +219,17 @@ const char* ENowMesh::msgTypeToStr(uint8_t msg_type) {
     buf[0] = '\0';
     
     if (msg_type & MSG_TYPE_DATA) strcat(buf, "DATA|");
-    if (msg_type & MSG_TYPE_HELLO) strcat(buf, "HELLO|");
-    if (msg_type & MSG_TYPE_ACK) strcat(buf, "ACK|");
+    if ((msg_type & MSG_TYPE_CONTROL) == MSG_TYPE_CONTROL) {
+        strcat(buf, "CTRL|");
+    } else {
+        if (msg_type & MSG_TYPE_HELLO) strcat(buf, "HELLO|");
+        if (msg_type & MSG_TYPE_ACK) strcat(buf, "ACK|");
+    }
     if (msg_type & MSG_TYPE_NO_FORWARD) strcat(buf, "NO_FWD|");
     if (msg_type & MSG_TYPE_NO_ACK) strcat(buf, "NO_ACK|");
     if (msg_type & MSG_TYPE_TO_MASTER) strcat(buf, "TO_MASTER|");
     if (msg_type & MSG_TYPE_TO_REPEATER) strcat(buf, "TO_REPEATER|");
+    if (msg_type & MSG_TYPE_RETRANSMIT) strcat(buf, "RETX|");
     
     // Remove trailing '|'
     size_t len = strlen(buf);
@@ -106,553 +242,3904 @@ const char* ENowMesh::msgTypeToStr(uint8_t msg_type) {
 // ===== PEER MANAGEMENT ===
 // =======================================
 
+// ----- Peer Index -----
+// MacIndex maps MAC -> slot in O(1). Every access happens under peersMux:
+// the Wi-Fi task adds peers while loop() prunes them.
+void ENowMesh::resetPeerTable() {
+    portENTER_CRITICAL(&peersMux);
+    peerIndex.reset();
+    for (size_t i = 0; i < PEER_TABLE_SIZE; ++i) peers[i].valid = false;
+    portEXIT_CRITICAL(&peersMux);
+}
+
+int ENowMesh::findPeerLocked(const uint8_t *mac) {
+    return peerIndex.find(mac, peers[0].mac, sizeof(PeerInfo));
+}
+
+int ENowMesh::insertPeerLocked(const uint8_t *mac) {
+    int slot = peerIndex.insert(mac);
+    if (slot < 0) return -1;
+    PeerInfo &p = peers[slot];
+    memcpy(p.mac, mac, 6);
+    p.lastSeen = millis();
+    p.rssi = 0;
+    p.rssiX16 = 0;
+    p.delivery = 100;
+    p.deliveryX256 = 100 * 256;
+    p.etx = 100;
+    p.failStreak = 0;
+    p.poor = false;
+    p.masterHops = MASTER_HOPS_NONE;
+    p.uplinkViaMe = false;
+    p.cached = false;
+    p.epoch = 0;
+    p.compact = false;
+    p.slot = TDMA_SLOT_NONE;
+    p.slotsHeard = 0;
+    p.helloTimed = false;
+    p.evictedFrames = 0;
+    p.valid = true;
+    return slot;
+}
+
+void ENowMesh::removePeerLocked(size_t slot) {
+    if (!peers[slot].valid) return;
+    peerIndex.remove(slot, peers[0].mac, sizeof(PeerInfo));
+    peers[slot].valid = false;
+}
+
 // ----- Peer Search -----
 int ENowMesh::findPeer(const uint8_t *mac) {
-    for (size_t i = 0; i < ENowMesh::PEER_TABLE_SIZE; ++i)
-        if (peersStatic[i].valid && memcmp(peersStatic[i].mac, mac, 6) == 0)
-            return (int)i;
-    return -1;
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    portEXIT_CRITICAL(&peersMux);
+    return idx;
+}
+
+// ----- RSSI Average -----
+// EWMA with weight 1/8, kept x16 so small steps don't vanish in integer division
+static void addRssiSample(ENowMesh::PeerInfo &p, int8_t rssi) {
+    if (rssi == 0) return;
+    if (p.rssi == 0) p.rssiX16 = rssi * 16;
+    else p.rssiX16 += (rssi * 16 - p.rssiX16) / 8;
+    int r = (p.rssiX16 - 8) / 16;   // Round to nearest (values are negative)
+    p.rssi = (int8_t)(r < 0 ? r : -1);
 }
 
 // ----- Add/Update Peer -----
-void ENowMesh::touchPeer(const uint8_t *mac) {
-    int idx = findPeer(mac);
-    if (idx >= 0) {
-        peersStatic[idx].lastSeen = millis();
-        return;
+void ENowMesh::touchPeer(const uint8_t *mac, int8_t rssi) {
+    // Only the peer table: the driver registers neighbours while they are sent to (acquireDriverPeer)
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    bool known = idx >= 0;
+    if (known) {
+        peers[idx].lastSeen = millis();
+        peers[idx].cached = false;
+    } else if (PEER_TABLE_SIZE - peerIndex.freeCount < maxPeers) {
+        idx = insertPeerLocked(mac);
     }
+    if (idx >= 0) addRssiSample(peers[idx], rssi);
+    portEXIT_CRITICAL(&peersMux);
 
-    for (size_t i = 0; i < ENowMesh::PEER_TABLE_SIZE; ++i) {
-        if (!peersStatic[i].valid) {
-            esp_now_peer_info_t info = {};
-            memcpy(info.peer_addr, mac, 6);
-            info.channel = channel;
-            info.ifidx = WIFI_IF_STA;
-            info.encrypt = 0;
-
-            esp_err_t result = esp_now_add_peer(&info);
-            if (result == ESP_OK || result == ESP_ERR_ESPNOW_EXIST) {
-                memcpy(peersStatic[i].mac, mac, 6);
-                peersStatic[i].lastSeen = millis();
-                peersStatic[i].valid = true;
-                Serial.printf("Added peer %s at slot %u\n", macToStr(mac).c_str(), (unsigned)i);
-            } else {
-                Serial.printf("Failed to add peer %s to ESP-NOW: %d\n", macToStr(mac).c_str(), result);
-            }
-            return;
-        }
+    if (known) return;
+    if (idx >= 0) {
+        countStat(STAT_PEERS_ADDED);
+        resetHelloTimer();
+        MESH_LOGI(ENOWMESH_LOG_PEER, "Added peer %s at slot %u\n", macToStr(mac).c_str(), (unsigned)idx);
+    } else {
+        MESH_LOGE(ENOWMESH_LOG_PEER, "Peer table full! Cannot add new peer.\n");
     }
+}
 
-    Serial.println("Peer table full! Cannot add new peer.");
+esp_err_t ENowMesh::registerDriverPeer(const uint8_t *mac) {
+    esp_now_peer_info_t info = {};
+    memcpy(info.peer_addr, mac, 6);
+    info.channel = channel;
+    info.ifidx = WIFI_IF_STA;
+    info.encrypt = 0;
+
+    esp_err_t result = esp_now_add_peer(&info);
+    return result == ESP_ERR_ESPNOW_EXIST ? ESP_OK : result;
 }
 
-// ----- Peer Pruning -----
-void ENowMesh::prunePeers() {
-    uint32_t now = millis();
-    for (size_t i = 0; i < ENowMesh::PEER_TABLE_SIZE; ++i) {
-        if (peersStatic[i].valid && (now - peersStatic[i].lastSeen > peerTimeout)) {
-            Serial.printf("Pruning peer %s slot %u\n", macToStr(peersStatic[i].mac).c_str(), (unsigned)i);
-            esp_now_del_peer(peersStatic[i].mac);
-            peersStatic[i].valid = false;
+// ----- Driver Peer Slots -----
+// The ESP-NOW driver sends unicasts only to registered peers and holds about 20 of them, far
+// fewer than the peer table. Registration is a cache in front of esp_now_send(): a neighbour
+// is added right before a frame goes to it, and when DRIVER_PEER_SLOTS are taken the least
+// recently sent-to one is deleted. Deleting a neighbour may fail frames the driver still holds
+// for it, so each slot counts its frames until they are reported and the victim is the LRU one
+// with none. Only when every slot has frames out is a busy one deleted, and failures then
+// reported for the frames it held don't count against its link quality.
+// Receiving needs no registration and broadcasts use the broadcast peer.
+
+esp_err_t ENowMesh::acquireDriverPeer(const uint8_t *mac) {
+    if (mac[0] & 0x01) return ESP_OK;   // Group address: the broadcast peer, registered by initEspNow()
+
+    int slot = -1;
+    bool evict = false;
+    uint8_t victim[6];
+    uint8_t victimFrames = 0;
+    portENTER_CRITICAL(&driverPeersMux);
+    uint32_t tick = ++driverPeerTick;
+    for (int i : driverPeerUsed) {
+        if (memcmp(driverPeers[i].mac, mac, 6) == 0) {
+            driverPeers[i].lastUsed = tick;
+            if (driverPeers[i].inDriver < 0xFF) driverPeers[i].inDriver++;
+            portEXIT_CRITICAL(&driverPeersMux);
+            return ESP_OK;
         }
     }
-}
+    slot = driverPeerUsed.firstFree(DRIVER_PEER_SLOTS);
+    if (slot < 0) {
+        slot = lruDriverPeerLocked(tick, -1);
+        memcpy(victim, driverPeers[slot].mac, 6);
+        victimFrames = driverPeers[slot].inDriver;
+        evict = true;
+    }
+    memcpy(driverPeers[slot].mac, mac, 6);
+    driverPeers[slot].lastUsed = tick;
+    driverPeers[slot].inDriver = 1;
+    driverPeerUsed.set(slot);
+    portEXIT_CRITICAL(&driverPeersMux);
 
-// =======================================
-// ===== HELLO BEACON ====
-// =======================================
+    // Driver calls can't run inside a critical section
+    if (evict) {
+        esp_now_del_peer(victim);
+        if (victimFrames) noteEvictedFrames(victim, victimFrames);
+        countStat(STAT_DRIVER_EVICTIONS);
+        MESH_LOGT(ENOWMESH_LOG_PEER, "Driver peer %s evicted for %s\n", macToStr(victim).c_str(), macToStr(mac).c_str());
+    }
+    esp_err_t r = registerDriverPeer(mac);
+    while (r == ESP_ERR_ESPNOW_FULL) {
+        // The driver holds fewer peers than DRIVER_PEER_SLOTS (the application registered some): make more room
+        portENTER_CRITICAL(&driverPeersMux);
+        int lru = lruDriverPeerLocked(tick, slot);
+        if (lru >= 0) {
+            memcpy(victim, driverPeers[lru].mac, 6);
+            victimFrames = driverPeers[lru].inDriver;
+            driverPeerUsed.clear(lru);
+        }
+        portEXIT_CRITICAL(&driverPeersMux);
+        if (lru < 0) break;
+        esp_now_del_peer(victim);
+        if (victimFrames) noteEvictedFrames(victim, victimFrames);
+        countStat(STAT_DRIVER_EVICTIONS);
+        r = registerDriverPeer(mac);
+    }
+    if (r == ESP_OK) {
+        countStat(STAT_DRIVER_ADDS);
+        return ESP_OK;
+    }
 
-void ENowMesh::sendHelloBeacon() {
-    uint32_t now = millis();
-    
-    // Check if it's time to send HELLO
-    if (now - lastHelloTime < helloInterval) {
-        return;  // Not time yet
+    portENTER_CRITICAL(&driverPeersMux);
+    if (driverPeerUsed.test(slot) && memcmp(driverPeers[slot].mac, mac, 6) == 0) driverPeerUsed.clear(slot);
+    portEXIT_CRITICAL(&driverPeersMux);
+    MESH_LOGE(ENOWMESH_LOG_PEER, "Failed to add peer %s to ESP-NOW: %d\n", macToStr(mac).c_str(), r);
+    return r;
+}
+
+// Least recently used registered neighbour other than skip, preferring one with no frames in the driver
+int ENowMesh::lruDriverPeerLocked(uint32_t tick, int skip) {
+    int lru = -1;
+    for (int i : driverPeerUsed) {
+        if (i == skip) continue;
+        if (lru < 0) { lru = i; continue; }
+        bool idle = driverPeers[i].inDriver == 0, lruIdle = driverPeers[lru].inDriver == 0;
+        if (idle > lruIdle || (idle == lruIdle && tick - driverPeers[i].lastUsed > tick - driverPeers[lru].lastUsed)) lru = i;
     }
-    
-    lastHelloTime = now;
-    
-    // Build HELLO message with role info
-    char helloMsg[32];
-    snprintf(helloMsg, sizeof(helloMsg), "HELLO:%s", getRoleName());
-    
-    size_t mlen = strlen(helloMsg);
-    
-    // --- Build header ---
-    packet_hdr_t hdr = {};
-    memcpy(hdr.src_mac, myMacStatic, 6);
-    memset(hdr.dest_mac, 0xFF, 6);  // Broadcast
-    hdr.seq = random(0xFFFF);
-    hdr.hop_count = 0;
-    hdr.msg_type = MSG_TYPE_HELLO | MSG_TYPE_NO_FORWARD | MSG_TYPE_NO_ACK;  // HELLO flags
-    hdr.payload_len = static_cast<uint8_t>(mlen);
-    
-    // --- Build packet ---
-    size_t total = sizeof(packet_hdr_t) + hdr.payload_len;
-    uint8_t *buf = (uint8_t*)malloc(total);
-    if (!buf) {
-        Serial.println("HELLO: Memory allocation failed");
-        return;
+    return lru;
+}
+
+void ENowMesh::noteEvictedFrames(const uint8_t *mac, uint8_t frames) {
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    if (idx >= 0) {
+        unsigned total = peers[idx].evictedFrames + frames;
+        peers[idx].evictedFrames = (uint8_t)(total < 0xFF ? total : 0xFF);
     }
-    
-    memcpy(buf, &hdr, sizeof(packet_hdr_t));
-    memcpy(buf + sizeof(packet_hdr_t), helloMsg, hdr.payload_len);
-    
-    // --- Broadcast to all peers ---
-    forwardToPeersExcept(nullptr, buf, total);
-    Serial.printf("[HELLO BEACON] Sent to all peers: %s\n", helloMsg);
-    
-    free(buf);
+    portEXIT_CRITICAL(&peersMux);
 }
 
-// =======================================
-// ===== COMMUNICATION FUNCTIONS ====
-// =======================================
+// Reports come in send order, so a neighbour's next evictedFrames reports are for the frames it had when evicted
+bool ENowMesh::takeEvictedFrame(const uint8_t *mac) {
+    bool taken = false;
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    if (idx >= 0 && peers[idx].evictedFrames) {
+        peers[idx].evictedFrames--;
+        taken = true;
+    }
+    portEXIT_CRITICAL(&peersMux);
+    return taken;
+}
 
-// ----- Send Wrapper -----
-esp_err_t ENowMesh::sendToMac(const uint8_t *mac, const uint8_t *data, size_t len) {
-    if (!mac) return ESP_ERR_INVALID_ARG;
-    return esp_now_send(mac, data, len);
+void ENowMesh::releaseDriverSend(const uint8_t *mac) {
+    if (mac[0] & 0x01) return;
+    portENTER_CRITICAL(&driverPeersMux);
+    for (int i : driverPeerUsed) {
+        if (memcmp(driverPeers[i].mac, mac, 6) == 0) {
+            if (driverPeers[i].inDriver) driverPeers[i].inDriver--;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&driverPeersMux);
 }
 
-// ----- Forward Wrapper -----
-void ENowMesh::forwardToPeersExcept(const uint8_t *exclude_mac, const uint8_t *data, size_t len) {
-    for (size_t i = 0; i < ENowMesh::PEER_TABLE_SIZE; ++i) {
-        if (!peersStatic[i].valid) continue;
-        if (exclude_mac && memcmp(peersStatic[i].mac, exclude_mac, 6) == 0) continue;
-        esp_err_t r = esp_now_send(peersStatic[i].mac, data, len);
-        if (r != ESP_OK) {
-            Serial.printf("esp_now_send to %s failed: %d\n", macToStr(peersStatic[i].mac).c_str(), r);
+void ENowMesh::releaseDriverPeer(const uint8_t *mac) {
+    bool registered = false;
+    portENTER_CRITICAL(&driverPeersMux);
+    for (int i : driverPeerUsed) {
+        if (memcmp(driverPeers[i].mac, mac, 6) == 0) {
+            driverPeerUsed.clear(i);
+            registered = true;
+            break;
         }
     }
+    portEXIT_CRITICAL(&driverPeersMux);
+    if (registered) esp_now_del_peer(mac);
 }
 
-// ----- Send Data -----
-esp_err_t ENowMesh::sendData(const char *msg, const uint8_t *dest_mac, uint8_t msg_type) {
-    if (!msg) return ESP_ERR_INVALID_ARG;
+// Another context may evict the neighbour between registration and the send: register it again once.
+// Frames are queued and retried with packet_hdr_t; the compact header is only made here, for the air
+esp_err_t ENowMesh::driverSend(const uint8_t *mac, const uint8_t *data, size_t len) {
+    esp_err_t r = acquireDriverPeer(mac);
+    if (r != ESP_OK) return r;
+    uint8_t wire[ESP_NOW_MAX_IE_DATA_LEN];
+    size_t wireLen = compactHeaders ? encodeCompact(mac, data, len, wire) : 0;
+    bool compacted = wireLen != 0;
+    // Own HELLO with mesh time: stamped here, after whatever wait it had in the transmit queue
+    bool stamp = syncEnabled() && hasHelloSync(data, len);
+    if (stamp && !compacted) {
+        memcpy(wire, data, len);
+        wireLen = len;
+    }
+    uint16_t seq = stamp ? ((const packet_hdr_t*)data)->seq : 0;
+    if (wireLen) {
+        data = wire;
+        len = wireLen;
+    }
+    if (stamp) stampHelloSync(wire, len);
+    r = esp_now_send(mac, data, len);
+    if (r == ESP_ERR_ESPNOW_NOT_FOUND && registerDriverPeer(mac) == ESP_OK) r = esp_now_send(mac, data, len);
+    if (r != ESP_OK) releaseDriverSend(mac);   // No report will come for it
+    if (r == ESP_OK && syncEnabled()) noteDriverSend(stamp, seq);
+    if (r == ESP_OK && compacted) countStat(STAT_COMPACT_SENT);
+    return r;
+}
 
-    // --- Validate message length before allocating ---
-    size_t mlen = strlen(msg);
-    if (mlen == 0) {
-        Serial.println("sendData: empty message, ignoring.");
-        return ESP_ERR_INVALID_ARG;
-    } if (mlen > maxPayload) {
-        Serial.printf("sendData: message too long (%u > maxPayload %u)\n", (unsigned)mlen, (unsigned)maxPayload);
-        return ESP_ERR_INVALID_SIZE;
-    } if (mlen > 255) {
-        Serial.printf("sendData: payload too large for uint8_t field (%u > 255)\n", (unsigned)mlen);
-        return ESP_ERR_INVALID_SIZE;
+// ----- Link Quality -----
+bool ENowMesh::linkUsable(const uint8_t *mac) {
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    bool usable = idx >= 0 && !peers[idx].poor;
+    portEXIT_CRITICAL(&peersMux);
+    return usable;
+}
+
+// Driver send outcome for a unicast to a neighbour: delivery average (weight 1/8, kept x256),
+// ETX = 1 / delivery, the poor/good hysteresis and the consecutive failure count
+bool ENowMesh::recordSendOutcome(const uint8_t *mac, bool ok) {
+    bool evict = false;
+    int change = 0;   // +1 recovered, -1 became poor
+    uint8_t delivery = 0;
+
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    if (idx >= 0) {
+        PeerInfo &p = peers[idx];
+        int32_t target = ok ? 100 * 256 : 0;
+        p.deliveryX256 = (uint16_t)(p.deliveryX256 + (target - (int32_t)p.deliveryX256) / 8);
+        p.delivery = (uint8_t)((p.deliveryX256 + 128) / 256);
+        uint32_t etx = p.deliveryX256 ? 100u * 100 * 256 / p.deliveryX256 : 0xFFFF;
+        p.etx = (uint16_t)(etx > 0xFFFF ? 0xFFFF : etx);
+        p.failStreak = ok ? 0 : (p.failStreak < 0xFF ? p.failStreak + 1 : 0xFF);
+        if (!p.poor && p.delivery < LINK_POOR_PCT) { p.poor = true; change = -1; }
+        else if (p.poor && p.delivery >= LINK_GOOD_PCT) { p.poor = false; change = 1; }
+        evict = (linkFailLimit && p.failStreak >= linkFailLimit) || (!ok && p.cached);
+        delivery = p.delivery;
     }
+    portEXIT_CRITICAL(&peersMux);
 
-    // --- Build header ---
-    packet_hdr_t hdr = {};
-    memcpy(hdr.src_mac, myMacStatic, 6);
+    if (change < 0) MESH_LOGI(ENOWMESH_LOG_PEER, "Link to %s poor (%u%% delivered) - avoiding as next hop\n", macToStr(mac).c_str(), (unsigned)delivery);
+    if (change > 0) MESH_LOGI(ENOWMESH_LOG_PEER, "Link to %s recovered (%u%% delivered)\n", macToStr(mac).c_str(), (unsigned)delivery);
+    return evict;
+}
 
-    if (dest_mac)
-        memcpy(hdr.dest_mac, dest_mac, 6);
-    else
-        memset(hdr.dest_mac, 0xFF, 6); // broadcast
+// ----- Remove Peer -----
+void ENowMesh::removePeer(size_t slot) {
+    if (slot >= PEER_TABLE_SIZE) return;
+    portENTER_CRITICAL(&peersMux);
+    removePeerLocked(slot);
+    portEXIT_CRITICAL(&peersMux);
+}
 
-    hdr.seq = random(0xFFFF);
-    hdr.hop_count = 0;
-    hdr.msg_type = msg_type;  // Use provided message type
+// ----- Peer Pruning -----
+// Victims are chosen one at a time under peersMux, since the Wi-Fi task refreshes lastSeen; the driver
+// and route cleanup, and the sleeper lookup (mailboxMux), happen outside it
+void ENowMesh::prunePeers() {
+    uint32_t now = millis();
+    // A sleeping LEAF hears its neighbours only while awake: it keeps them until sends to them fail (linkFailLimit)
+    bool sleepy = sleepIntervalMs && role == ROLE_LEAF;
+    for (size_t from = 0; !sleepy; ) {
+        int victim = -1;
+        uint8_t mac[6];
+        portENTER_CRITICAL(&peersMux);
+        for (int i : peerIndex.used) {
+            if ((size_t)i < from || (int32_t)(now - peers[i].lastSeen) <= (int32_t)peerTimeout) continue;
+            victim = i;
+            memcpy(mac, peers[i].mac, 6);
+            break;
+        }
+        portEXIT_CRITICAL(&peersMux);
+        if (victim < 0) break;
+        from = victim + 1;
 
-    // Set NO_ACK flag for broadcasts (if not already set)
-    if (!dest_mac && !(msg_type & MSG_TYPE_NO_ACK)) {
-        hdr.msg_type |= MSG_TYPE_NO_ACK;
+        // A registered sleeper is only heard from when it wakes
+        uint32_t limit = peerTimeout + sleeperGrace(mac);
+        portENTER_CRITICAL(&peersMux);
+        bool stale = peerIndex.used.test(victim) && memcmp(peers[victim].mac, mac, 6) == 0 &&
+                     (int32_t)(millis() - peers[victim].lastSeen) > (int32_t)limit;
+        if (stale) removePeerLocked(victim);
+        portEXIT_CRITICAL(&peersMux);
+        if (!stale) continue;
+
+        MESH_LOGI(ENOWMESH_LOG_PEER, "Pruning peer %s slot %u\n", macToStr(mac).c_str(), (unsigned)victim);
+        releaseDriverPeer(mac);
+        dropRoutesVia(mac);
+        countStat(STAT_PEERS_REMOVED);
+        resetHelloTimer();
     }
 
-    hdr.payload_len = static_cast<uint8_t>(mlen);
+    pruneRoutes();
+    pruneSeenSources();
+    refreshMasterDistance();
 
-    // --- Allocate and build full packet ---
-    size_t total = sizeof(packet_hdr_t) + hdr.payload_len;
-    
-    // Check ESP-NOW hardware limit
-    if (total > ESP_NOW_MAX_IE_DATA_LEN) {
-        Serial.printf("ERROR: Packet too large (%u bytes > %u max)\n", (unsigned)total, (unsigned)ESP_NOW_MAX_IE_DATA_LEN);
-        return ESP_ERR_INVALID_SIZE;
+    if (peerCacheInterval && now - lastPeerCacheSave >= peerCacheInterval) {
+        lastPeerCacheSave = now;
+        savePeerCache();
     }
-    
-    uint8_t *buf = (uint8_t*)malloc(total);
-    if (!buf) return ESP_ERR_NO_MEM;
+}
 
-    memcpy(buf, &hdr, sizeof(packet_hdr_t));
-    memcpy(buf + sizeof(packet_hdr_t), msg, hdr.payload_len);
+// =======================================
+// ===== ROUTING ===
+// =======================================
 
-    // --- Send ---
-    esp_err_t result;
-    if (dest_mac) {
-        result = sendToMac(dest_mac, buf, total);   // unicast
-        Serial.printf("[MESH SEND] To %s | type=%s | len=%u | msg='%s' | result=%d\n", macToStr(dest_mac).c_str(), msgTypeToStr(hdr.msg_type), (unsigned)hdr.payload_len, msg, (int)result);
-    } else {
-        forwardToPeersExcept(nullptr, buf, total);  // broadcast
-        result = ESP_OK;
-        Serial.printf("[MESH BROADCAST] type=%s | len=%u | msg='%s'\n", msgTypeToStr(hdr.msg_type), (unsigned)hdr.payload_len, msg);
-    }
+// ----- Accessors -----
+ENowMesh::RouteInfo* ENowMesh::getRouteTable() {
+    return routes;
+}
 
-    free(buf);
+int ENowMesh::findRoute(const uint8_t *dest) {
+    portENTER_CRITICAL(&routesMux);
+    int idx = routeIndex.find(dest, routes[0].dest, sizeof(RouteInfo));
+    portEXIT_CRITICAL(&routesMux);
+    return idx;
+}
 
-    // Track unicast messages that need ACKs (if MSG_TYPE_NO_ACK is not set)
-    if (dest_mac && result == ESP_OK && !(hdr.msg_type & MSG_TYPE_NO_ACK)) {
-        portENTER_CRITICAL(&pendingMux);
-        
-        // Find empty slot
-        for (size_t i = 0; i < instance->maxPendingMessages; i++) {
-            if (!pendingMessages[i].waiting) {
-                memcpy(pendingMessages[i].dest_mac, dest_mac, 6);
-                pendingMessages[i].seq = hdr.seq;
-                pendingMessages[i].sendTime = millis();
-                pendingMessages[i].retryCount = 0;
-                pendingMessages[i].payloadLen = hdr.payload_len;
-                memcpy(pendingMessages[i].payload, msg, hdr.payload_len);
-                pendingMessages[i].waiting = true;
-                break;
-            }
+size_t ENowMesh::getRouteCount() {
+    return ROUTE_TABLE_SIZE - routeIndex.freeCount;
+}
+
+ENowMesh::RouteStats ENowMesh::getRouteStats() {
+    portENTER_CRITICAL(&routesMux);
+    RouteStats copy = routeStats;
+    portEXIT_CRITICAL(&routesMux);
+    return copy;
+}
+
+void ENowMesh::resetRouteStats() {
+    portENTER_CRITICAL(&routesMux);
+    routeStats = {};
+    portEXIT_CRITICAL(&routesMux);
+}
+
+void ENowMesh::resetRouteTable() {
+    portENTER_CRITICAL(&routesMux);
+    routeIndex.reset();
+    for (size_t i = 0; i < ROUTE_TABLE_SIZE; ++i) routes[i].valid = false;
+    portEXIT_CRITICAL(&routesMux);
+}
+
+// ----- Learn Route -----
+// Keep the existing route unless the new one is shorter, comes from the same next hop
+// (refresh, hop count may change) or the existing one has gone stale.
+void ENowMesh::learnRoute(const uint8_t *dest, const uint8_t *nextHop, uint8_t hopCount) {
+    uint32_t now = millis();
+    bool changed = false;
+
+    portENTER_CRITICAL(&routesMux);
+    int idx = routeIndex.find(dest, routes[0].dest, sizeof(RouteInfo));
+    if (idx < 0) {
+        idx = routeIndex.insert(dest);
+        if (idx >= 0) {
+            memcpy(routes[idx].dest, dest, 6);
+            memcpy(routes[idx].nextHop, nextHop, 6);
+            routes[idx].hopCount = hopCount;
+            routes[idx].lastUpdated = now;
+            routes[idx].srtt = 0;
+            routes[idx].rttvar = 0;
+            routes[idx].cached = false;
+            routes[idx].valid = true;
+            changed = true;
+        }
+    } else {
+        RouteInfo &r = routes[idx];
+        bool sameNextHop = memcmp(r.nextHop, nextHop, 6) == 0;
+        bool stale = now - r.lastUpdated > routeTimeout || r.cached;
+        if (sameNextHop || hopCount < r.hopCount || stale) {
+            changed = !sameNextHop || hopCount != r.hopCount;
+            memcpy(r.nextHop, nextHop, 6);
+            r.hopCount = hopCount;
+            r.lastUpdated = now;
+            r.cached = false;
         }
-        
-        portEXIT_CRITICAL(&pendingMux);
     }
+    if (changed) routeStats.learned++;
+    portEXIT_CRITICAL(&routesMux);
 
-    return result;
+    if (changed) {
+        MESH_LOGT(ENOWMESH_LOG_ROUTE, "[ROUTE] %s via %s (%u hops)\n", macToStr(dest).c_str(), macToStr(nextHop).c_str(), (unsigned)hopCount);
+    }
 }
 
-// Send message to a MASTER node
-esp_err_t ENowMesh::sendToMaster(const char *msg, uint8_t msg_type) {
-    return sendData(msg, nullptr, msg_type | MSG_TYPE_TO_MASTER);
+// ----- Invalidate Routes Through a Lost Neighbour -----
+void ENowMesh::dropRoutesVia(const uint8_t *nextHop) {
+    portENTER_CRITICAL(&routesMux);
+    for (int i : routeIndex.used) {
+        if (memcmp(routes[i].nextHop, nextHop, 6) == 0) {
+            routeIndex.remove(i, routes[0].dest, sizeof(RouteInfo));
+            routes[i].valid = false;
+            routeStats.expired++;
+        }
+    }
+    portEXIT_CRITICAL(&routesMux);
 }
 
-// Send message to all REPEATER nodes
-esp_err_t ENowMesh::sendToRepeaters(const char *msg, uint8_t msg_type) {
-    return sendData(msg, nullptr, msg_type | MSG_TYPE_TO_REPEATER);
+// ----- Route Expiry -----
+void ENowMesh::pruneRoutes() {
+    uint32_t now = millis();
+    portENTER_CRITICAL(&routesMux);
+    for (int i : routeIndex.used) {
+        if (now - routes[i].lastUpdated > routeTimeout) {
+            routeIndex.remove(i, routes[0].dest, sizeof(RouteInfo));
+            routes[i].valid = false;
+            routeStats.expired++;
+        }
+    }
+    portEXIT_CRITICAL(&routesMux);
 }
 
-// Send message directly (no mesh forwarding)
-esp_err_t ENowMesh::sendDirect(const char *msg, const uint8_t *dest_mac, uint8_t msg_type) {
-    if (!dest_mac) {
-        Serial.println("ERROR: sendDirect requires destination MAC address");
-        return ESP_ERR_INVALID_ARG;
+// ----- Next Hop Lookup -----
+bool ENowMesh::routeNextHop(const uint8_t *dest, uint8_t *nextHop) {
+    uint32_t now = millis();
+    bool found = false;
+
+    portENTER_CRITICAL(&routesMux);
+    int idx = routeIndex.find(dest, routes[0].dest, sizeof(RouteInfo));
+    if (idx >= 0 && now - routes[idx].lastUpdated <= routeTimeout) {
+        memcpy(nextHop, routes[idx].nextHop, 6);
+        found = true;
     }
-    return sendData(msg, dest_mac, msg_type | MSG_TYPE_NO_FORWARD);
-}
+    portEXIT_CRITICAL(&routesMux);
 
+    // A route is only usable while its next hop is still a registered neighbour
+    if (found && !linkUsable(nextHop)) found = false;
 
-// =======================================
-// ===== STATIC CALLBACK IMPLEMENTATION ===
-// =======================================
+    portENTER_CRITICAL(&routesMux);
+    if (found) routeStats.hits++; else routeStats.misses++;
+    portEXIT_CRITICAL(&routesMux);
+    return found;
+}
 
-void ENowMesh::OnDataSent(const esp_now_send_info_t *info, esp_now_send_status_t status) {
-    ENowMesh *m = instance;
-    if (!m || !info) return;
-    
-    const uint8_t *mac_addr = info->des_addr;
-    if (!mac_addr) return;
-    
-    if (status == ESP_NOW_SEND_SUCCESS) {
-        Serial.printf("Sent OK to %02X:%02X:%02X:%02X:%02X:%02X\n", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+// ----- Unicast Along Best Known Path -----
+// Direct if dest is a neighbour, else via the learned next hop, else flood (never back to exclude_mac).
+// Without allowFlood, ESP_ERR_NOT_FOUND when there is no direct link or usable route.
+esp_err_t ENowMesh::sendUnicastFrame(const uint8_t *dest, const uint8_t *exclude_mac, const uint8_t *data, size_t len, bool allowFlood) {
+    if (holdForSleeper(dest, data, len)) return ESP_OK;   // A LEAF neighbour with its radio off
+    if (linkUsable(dest)) {
+        esp_err_t r = txSend(dest, data, len);
+        if (r == ESP_OK) return ESP_OK;
+        if (r == ESP_ERR_ESPNOW_NO_MEM) return r;   // Flooding would only queue more
+        MESH_LOGE(ENOWMESH_LOG_TX, "Direct send to %s failed (%d), falling back to flood.\n", macToStr(dest).c_str(), r);
     } else {
-        Serial.printf("Send FAILED to %02X:%02X:%02X:%02X:%02X:%02X - removing peer\n", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-        
-        // Remove failed peer immediately
-        int idx = m->findPeer(mac_addr);
-        if (idx >= 0) {
-            esp_now_del_peer(mac_addr);
-            m->peersStatic[idx].valid = false;
+        uint8_t nextHop[6];
+        if (routeNextHop(dest, nextHop) && !(exclude_mac && memcmp(nextHop, exclude_mac, 6) == 0)) {
+            esp_err_t r = txSend(nextHop, data, len);
+            if (r == ESP_OK) {
+                MESH_LOGT(ENOWMESH_LOG_ROUTE, "Routed to %s via %s\n", macToStr(dest).c_str(), macToStr(nextHop).c_str());
+                return ESP_OK;
+            }
+            if (r == ESP_ERR_ESPNOW_NO_MEM) return r;
+            MESH_LOGE(ENOWMESH_LOG_TX, "Send to next hop %s failed (%d), falling back to flood.\n", macToStr(nextHop).c_str(), r);
         }
     }
+
+    if (!allowFlood) return ESP_ERR_NOT_FOUND;
+
+    forwardToPeersExcept(exclude_mac, data, len);
+    countStat(STAT_FLOODED);
+    MESH_LOGT(ENOWMESH_LOG_ROUTE, "Flooded unicast for %s\n", macToStr(dest).c_str());
+    return ESP_OK;
 }
 
-void ENowMesh::OnDataRecv(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len) {
-    ENowMesh *m = instance;
-    if (!m || !info) return;
+// =======================================
+// ===== MASTER UPLINK (ANYCAST) ===
+// =======================================
+// HELLOs carry the sender's distance to its nearest MASTER and the neighbour it goes through.
+// sendToMaster frames are unicast hop by hop to the neighbour with the smallest distance, each
+// hop MAC-ACKed, instead of being flooded through the whole mesh until a MASTER consumes them.
+// Neighbours whose own uplink is this node are skipped, so two nodes never point at each other.
 
-    const uint8_t *mac_addr = info->src_addr;
-    Serial.printf("Received %d bytes from %02X:%02X:%02X:%02X:%02X:%02X\n", len, mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+// ----- Rank Uplink Candidates -----
+size_t ENowMesh::rankUplinks(const uint8_t *exclude_mac, uint8_t (*out)[6], size_t max, uint8_t *bestHops) {
+    uint8_t hops[UPLINK_CANDIDATES];
+    uint16_t etx[UPLINK_CANDIDATES];
+    size_t n = 0;
+    if (max > UPLINK_CANDIDATES) max = UPLINK_CANDIDATES;
 
-    // === BASIC VALIDATION ===
-    if (len < (int)sizeof(packet_hdr_t)) {
-        Serial.println("Packet too small. ignoring.");
-        m->touchPeer(mac_addr);
-        return;
+    portENTER_CRITICAL(&peersMux);
+    for (int i : peerIndex.used) {
+        const PeerInfo &p = peers[i];
+        if (p.poor || p.uplinkViaMe || p.masterHops == MASTER_HOPS_NONE) continue;
+        if (exclude_mac && memcmp(p.mac, exclude_mac, 6) == 0) continue;
+        // Insertion into the short sorted list: fewer hops first, then the better link
+        size_t pos = n;
+        while (pos > 0 && (p.masterHops < hops[pos - 1] || (p.masterHops == hops[pos - 1] && p.etx < etx[pos - 1]))) pos--;
+        if (pos >= max) continue;
+        size_t last = (n < max) ? n : max - 1;
+        for (size_t j = last; j > pos; --j) {
+            hops[j] = hops[j - 1];
+            etx[j] = etx[j - 1];
+            memcpy(out[j], out[j - 1], 6);
+        }
+        hops[pos] = p.masterHops;
+        etx[pos] = p.etx;
+        memcpy(out[pos], p.mac, 6);
+        if (n < max) n++;
     }
+    portEXIT_CRITICAL(&peersMux);
 
-    packet_hdr_t hdr;
-    memcpy(&hdr, incomingData, sizeof(packet_hdr_t));
+    if (bestHops) *bestHops = n ? hops[0] : MASTER_HOPS_NONE;
+    return n;
+}
 
-    // Drop packets from self
-    if (memcmp(hdr.src_mac, myMacStatic, 6) == 0) {
-        Serial.println("Packet originated from self. Dropping.");
-        return;
-    }
+// ----- Distance To The Nearest MASTER -----
+// A LEAF never relays, so it advertises no distance and is never picked as an uplink
+uint8_t ENowMesh::getMasterDistance() {
+    if (role == ROLE_MASTER) return 0;
+    if (role == ROLE_LEAF) return MASTER_HOPS_NONE;
+    uint8_t mac[1][6];
+    uint8_t best;
+    if (rankUplinks(nullptr, mac, 1, &best) == 0 || best + 1 > maxHops) return MASTER_HOPS_NONE;
+    return best + 1;
+}
 
-    // Duplicate detection (before any processing)
-    if (m->isDuplicate(hdr.src_mac, hdr.seq)) {
-        Serial.printf("DUPLICATE packet detected (src=%s seq=%u) - dropping\n", m->macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq);
-        m->touchPeer(mac_addr);  // still update peer table
-        return;
+bool ENowMesh::getUplink(uint8_t *mac) {
+    uint8_t best[1][6];
+    if (role == ROLE_MASTER || rankUplinks(nullptr, best, 1, nullptr) == 0) return false;
+    memcpy(mac, best[0], 6);
+    return true;
+}
+
+// ----- Gradient From A HELLO -----
+// A new boot epoch means the neighbour restarted with empty tables: beacon soon so it relearns us
+bool ENowMesh::notePeerHello(const uint8_t *mac, uint8_t epoch, uint16_t seq, const uint8_t *payload, size_t len) {
+    const uint8_t *end = (const uint8_t*)memchr(payload, 0, len);
+    bool hasGradient = end && (size_t)(payload + len - end - 1) >= sizeof(HelloGradient);   // Older nodes: text only
+    HelloGradient g = {};
+    if (hasGradient) memcpy(&g, end + 1, sizeof(g));
+    const uint8_t *idsAt = hasGradient ? end + 1 + sizeof(HelloGradient) : nullptr;
+    HelloIds ids = {};
+    if (idsAt && (size_t)(payload + len - idsAt) >= sizeof(HelloIds)) memcpy(&ids, idsAt, sizeof(ids));
+    const uint8_t *syncAt = (ids.flags & HELLO_SYNC) ? idsAt + sizeof(HelloIds) : nullptr;
+    HelloSync hs = {};
+    bool hasSync = syncAt && (size_t)(payload + len - syncAt) >= sizeof(HelloSync);
+    if (hasSync) memcpy(&hs, syncAt, sizeof(hs));
+    int64_t heardAt = hasSync ? esp_timer_get_time() - (int64_t)(uint32_t)(micros() - rxHeardUs) : 0;
+    int64_t prevHeardAt = -1;   // When we heard the HELLO that hs.prevEndUs is about, -1 = missed it
+
+    bool changed = false, rebooted = false;
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    if (idx >= 0) {
+        PeerInfo &p = peers[idx];
+        rebooted = p.epoch != 0 && p.epoch != epoch;
+        p.epoch = epoch;
+        p.compact = (ids.flags & HELLO_COMPACT) != 0;
+        p.slot = hasSync ? hs.slot : TDMA_SLOT_NONE;
+        p.slotsHeard = hasSync ? hs.slotsHeard : 0;
+        if (hasSync && p.helloTimed && (hs.flags & SYNC_FOLLOW_UP) && hs.prevSeq == p.helloSeq) {
+            prevHeardAt = heardAt - (int64_t)(uint32_t)((uint32_t)heardAt - p.helloHeardUs);
+        }
+        p.helloTimed = hasSync;
+        p.helloSeq = seq;
+        p.helloHeardUs = (uint32_t)heardAt;
+        if (hasGradient) {
+            bool viaMe = memcmp(g.uplink, myMac, 6) == 0;
+            changed = p.masterHops != g.masterHops || p.uplinkViaMe != viaMe;
+            p.masterHops = g.masterHops;
+            p.uplinkViaMe = viaMe;
+        }
     }
+    portEXIT_CRITICAL(&peersMux);
 
-    if (hdr.payload_len > m->maxPayload) {
-        Serial.printf("Payload_len %u exceeds MAX_PAYLOAD %u. ignoring.\n", hdr.payload_len, (unsigned)m->maxPayload);
-        m->touchPeer(mac_addr);
-        return;
+    if (changed) {
+        MESH_LOGT(ENOWMESH_LOG_ROUTE, "[UPLINK] %s is %u hops from a MASTER\n", macToStr(mac).c_str(), (unsigned)g.masterHops);
+        refreshMasterDistance();
+    }
+    if (hasSync && idx >= 0 && syncEnabled()) noteHelloSync(mac, g.masterHops, hs, heardAt, prevHeardAt);
+    if (compactHeaders) {
+        portENTER_CRITICAL(&nodeIdMux);
+        for (size_t k = 0; k < HELLO_ID_CONFLICTS; ++k) if (ids.conflicts[k]) noteIdConflictLocked(ids.conflicts[k]);
+        portEXIT_CRITICAL(&nodeIdMux);
     }
+    if (rebooted) {
+        MESH_LOGI(ENOWMESH_LOG_PEER, "Peer %s restarted\n", macToStr(mac).c_str());
+        if (compactHeaders) forgetKnownBy(nodeIdOf(mac));
+        resetHelloTimer();
+    }
+    return changed || rebooted;
+}
 
-    if ((size_t)len < sizeof(packet_hdr_t) + hdr.payload_len) {
-        Serial.println("Payload length mismatch. ignoring.");
-        m->touchPeer(mac_addr);
-        return;
+void ENowMesh::refreshMasterDistance() {
+    uint8_t d = getMasterDistance();
+    if (d == advertisedMasterHops) return;
+    MESH_LOGI(ENOWMESH_LOG_ROUTE, "[UPLINK] Distance to MASTER %u -> %u hops\n", (unsigned)advertisedMasterHops, (unsigned)d);
+    resetHelloTimer();
+}
+
+// ----- Send Along The Gradient -----
+esp_err_t ENowMesh::sendUplinkFrame(const uint8_t *exclude_mac, const uint8_t *data, size_t len) {
+    uint8_t uplinks[UPLINK_CANDIDATES][6];
+    size_t n = rankUplinks(exclude_mac, uplinks, UPLINK_CANDIDATES, nullptr);
+    esp_err_t r = ESP_ERR_NOT_FOUND;
+
+    for (size_t i = 0; i < n; ++i) {
+        r = txSend(uplinks[i], data, len);
+        if (r == ESP_OK) {
+            MESH_LOGT(ENOWMESH_LOG_ROUTE, "To MASTER via uplink %s\n", macToStr(uplinks[i]).c_str());
+            break;
+        }
+        if (r == ESP_ERR_ESPNOW_NO_MEM) break;   // Other uplinks would only queue more
+        MESH_LOGE(ENOWMESH_LOG_TX, "Send to uplink %s failed (%d), trying the next one.\n", macToStr(uplinks[i]).c_str(), r);
     }
 
-    m->touchPeer(mac_addr);
+    portENTER_CRITICAL(&routesMux);
+    if (r == ESP_OK) routeStats.uplinkSends++;
+    else if (r != ESP_ERR_ESPNOW_NO_MEM) routeStats.uplinkMisses++;
+    portEXIT_CRITICAL(&routesMux);
+    return (r == ESP_OK || r == ESP_ERR_ESPNOW_NO_MEM) ? r : ESP_ERR_NOT_FOUND;
+}
 
-    Serial.printf("[RECV] type=%s | from=%s | seq=%u | hop=%u\n", m->msgTypeToStr(hdr.msg_type), m->macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq, (unsigned)hdr.hop_count);
+// =======================================
+// ===== PEER CACHE ===
+// =======================================
+// With peerCacheInterval set, neighbours (with their MASTER gradient) and learned routes are
+// written to NVS as two blobs and restored at boot. Restored entries are marked cached: a
+// cached peer is evicted by its first failed send and a cached route gives way to any route
+// learned from traffic, so a neighbour that went away while we were down costs one frame.
+
+static constexpr const char *PEER_CACHE_NS = "enowmesh";
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// ----- Snapshots -----
+// Poor links are left out: they would be avoided after the reboot anyway
+size_t ENowMesh::snapshotPeers(CachedPeer *out) {
+    size_t n = 0;
+    portENTER_CRITICAL(&peersMux);
+    for (int i : peerIndex.used) {
+        const PeerInfo &p = peers[i];
+        if (p.poor) continue;
+        memcpy(out[n].mac, p.mac, 6);
+        out[n].masterHops = p.masterHops;
+        out[n].uplinkViaMe = p.uplinkViaMe;
+        n++;
+    }
+    portEXIT_CRITICAL(&peersMux);
+    return n;
+}
+
+size_t ENowMesh::snapshotRoutes(CachedRoute *out) {
+    uint32_t now = millis();
+    size_t n = 0;
+    portENTER_CRITICAL(&routesMux);
+    for (int i : routeIndex.used) {
+        const RouteInfo &r = routes[i];
+        if (now - r.lastUpdated > routeTimeout) continue;
+        memcpy(out[n].dest, r.dest, 6);
+        memcpy(out[n].nextHop, r.nextHop, 6);
+        out[n].hopCount = r.hopCount;
+        n++;
+    }
+    portEXIT_CRITICAL(&routesMux);
+    return n;
+}
+
+// ----- Save -----
+// Each table is snapshotted twice, once to hash it and once to write it, so only one
+// table-sized buffer is ever on the stack
+esp_err_t ENowMesh::savePeerCache() {
+    uint32_t hash = 2166136261u;
+    {
+        CachedPeer cp[PEER_TABLE_SIZE];
+        hash = fnv1a(hash, cp, snapshotPeers(cp) * sizeof(CachedPeer));
+    }
+    {
+        CachedRoute cr[ROUTE_TABLE_SIZE];
+        hash = fnv1a(hash, cr, snapshotRoutes(cr) * sizeof(CachedRoute));
+    }
+    hash = fnv1a(hash, &channel, 1);
+    if (hash == peerCacheHash) return ESP_OK;   // Unchanged since the last write
+
+    Preferences prefs;
+    if (!prefs.begin(PEER_CACHE_NS, false)) {
+        MESH_LOGE(ENOWMESH_LOG_PEER, "Peer cache: NVS namespace unavailable\n");
+        return ESP_FAIL;
+    }
+    size_t peerCount, routeCount;
+    bool ok = prefs.putUChar("ver", PEER_CACHE_VERSION) && prefs.putUChar("ch", channel);
+    {
+        CachedPeer cp[PEER_TABLE_SIZE];
+        peerCount = snapshotPeers(cp);
+        ok = ok && prefs.putBytes("peers", cp, peerCount * sizeof(CachedPeer)) == peerCount * sizeof(CachedPeer);
+    }
+    {
+        CachedRoute cr[ROUTE_TABLE_SIZE];
+        routeCount = snapshotRoutes(cr);
+        ok = ok && prefs.putBytes("routes", cr, routeCount * sizeof(CachedRoute)) == routeCount * sizeof(CachedRoute);
+    }
+    prefs.end();
+
+    if (!ok) {
+        MESH_LOGE(ENOWMESH_LOG_PEER, "Peer cache: write failed\n");
+        return ESP_FAIL;
+    }
+    peerCacheHash = hash;
+    MESH_LOGI(ENOWMESH_LOG_PEER, "Peer cache: saved %u peers, %u routes\n", (unsigned)peerCount, (unsigned)routeCount);
+    return ESP_OK;
+}
+
+void ENowMesh::clearPeerCache() {
+    Preferences prefs;
+    if (!prefs.begin(PEER_CACHE_NS, false)) return;
+    prefs.clear();
+    prefs.end();
+    peerCacheHash = 0;
+}
+
+// ----- Restore -----
+// Fills the peer and route tables only: no esp_now_add_peer() here. A restored neighbour is registered
+// with the driver on demand, by acquireDriverPeer() before the first frame sent to it, like any other
+void ENowMesh::loadPeerCache() {
+    Preferences prefs;
+    if (!prefs.begin(PEER_CACHE_NS, true)) return;   // Nothing saved yet
+    if (prefs.getUChar("ver", 0) != PEER_CACHE_VERSION || prefs.getUChar("ch", 0) != channel) {
+        prefs.end();
+        MESH_LOGI(ENOWMESH_LOG_PEER, "Peer cache: other version or channel, ignored\n");
+        return;
+    }
+
+    size_t peerCount = 0, routeCount = 0;
+    {
+        CachedPeer cp[PEER_TABLE_SIZE];
+        size_t n = prefs.getBytes("peers", cp, sizeof(cp)) / sizeof(CachedPeer);
+        for (size_t i = 0; i < n; ++i) {
+            portENTER_CRITICAL(&peersMux);
+            int idx = findPeerLocked(cp[i].mac);
+            if (idx < 0) idx = insertPeerLocked(cp[i].mac);
+            if (idx >= 0) {
+                peers[idx].masterHops = cp[i].masterHops;
+                peers[idx].uplinkViaMe = cp[i].uplinkViaMe != 0;
+                peers[idx].cached = true;
+            }
+            portEXIT_CRITICAL(&peersMux);
+            if (idx < 0) break;
+            peerCount++;
+        }
+    }
+    {
+        CachedRoute cr[ROUTE_TABLE_SIZE];
+        size_t n = prefs.getBytes("routes", cr, sizeof(cr)) / sizeof(CachedRoute);
+        uint32_t now = millis();
+        portENTER_CRITICAL(&routesMux);
+        for (size_t i = 0; i < n; ++i) {
+            if (routeIndex.find(cr[i].dest, routes[0].dest, sizeof(RouteInfo)) >= 0) continue;
+            int idx = routeIndex.insert(cr[i].dest);
+            if (idx < 0) break;
+            RouteInfo &r = routes[idx];
+            memcpy(r.dest, cr[i].dest, 6);
+            memcpy(r.nextHop, cr[i].nextHop, 6);
+            r.hopCount = cr[i].hopCount;
+            r.lastUpdated = now;
+            r.srtt = 0;
+            r.rttvar = 0;
+            r.cached = true;
+            r.valid = true;
+            routeCount++;
+        }
+        portEXIT_CRITICAL(&routesMux);
+    }
+    prefs.end();
+
+    MESH_LOGI(ENOWMESH_LOG_PEER, "Peer cache: restored %u peers, %u routes\n", (unsigned)peerCount, (unsigned)routeCount);
+    refreshMasterDistance();
+}
+
+// =======================================
+// ===== PACKET BUFFER POOL ===
+// =======================================
+
+// ----- Acquire -----
+// Claims a free bit with compare-and-swap, so it is safe from the Wi-Fi task and loop() alike
+uint8_t* ENowMesh::acquirePacketBuffer() {
+    const uint32_t all = (PACKET_POOL_SIZE == 32) ? 0xFFFFFFFFu : ((1u << PACKET_POOL_SIZE) - 1);
+    uint32_t used = packetPoolUsed.load(std::memory_order_relaxed);
+    while (true) {
+        uint32_t avail = ~used & all;
+        if (!avail) {
+            packetPoolExhausted.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        uint32_t bit = avail & (~avail + 1);  // Lowest free buffer
+        if (packetPoolUsed.compare_exchange_weak(used, used | bit, std::memory_order_acquire, std::memory_order_relaxed)) {
+            uint32_t inUse = __builtin_popcount(used | bit);
+            uint32_t hw = packetPoolHighWater.load(std::memory_order_relaxed);
+            while (inUse > hw && !packetPoolHighWater.compare_exchange_weak(hw, inUse, std::memory_order_relaxed)) {}
+            return packetPool[__builtin_ctz(bit)];
+        }
+    }
+}
+
+// ----- Release -----
+void ENowMesh::releasePacketBuffer(uint8_t *buf) {
+    if (!buf) return;
+    size_t i = (size_t)(buf - packetPool[0]) / PACKET_BUFFER_SIZE;
+    packetPoolUsed.fetch_and(~(1u << i), std::memory_order_release);
+}
+
+// ----- Stats -----
+ENowMesh::PacketPoolStats ENowMesh::getPacketPoolStats() {
+    PacketPoolStats st;
+    st.inUse = (uint8_t)__builtin_popcount(packetPoolUsed.load(std::memory_order_relaxed));
+    st.highWater = (uint8_t)packetPoolHighWater.load(std::memory_order_relaxed);
+    st.exhausted = packetPoolExhausted.load(std::memory_order_relaxed);
+    return st;
+}
+
+// =======================================
+// ===== HELLO BEACON ====
+// =======================================
+
+// With helloIntervalMin set, beacons follow a Trickle timer (RFC 6206): each interval I has
+// one beacon slot drawn from [I/2, I), skipped when helloRedundancy unchanged HELLOs were
+// heard in the interval before the slot, and I doubles up to helloInterval after every interval.
+// A new or lost peer, a role or MASTER distance change restarts it at helloIntervalMin.
+
+// ----- Trickle Timer -----
+void ENowMesh::startTrickleLocked(uint32_t now, uint32_t interval) {
+    trickleInterval = interval;
+    trickleStart = now;
+    trickleFireAt = interval / 2 + (uint32_t)random(interval - interval / 2);
+    trickleHeard = 0;
+    trickleFired = false;
+}
+
+void ENowMesh::resetHelloTimer() {
+    if (helloIntervalMin == 0) {
+        helloSoon.store(true, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t iMin = helloIntervalMin < helloInterval ? helloIntervalMin : helloInterval;
+    portENTER_CRITICAL(&helloMux);
+    if (trickleInterval != iMin) startTrickleLocked(millis(), iMin);
+    portEXIT_CRITICAL(&helloMux);
+}
+
+void ENowMesh::noteHelloHeard(bool consistent) {
+    if (!consistent || helloIntervalMin == 0) return;   // A change already reset the timer
+    portENTER_CRITICAL(&helloMux);
+    if (trickleHeard < 0xFF) trickleHeard++;
+    portEXIT_CRITICAL(&helloMux);
+}
+
+uint32_t ENowMesh::getHelloInterval() {
+    if (helloIntervalMin == 0) return helloInterval;
+    portENTER_CRITICAL(&helloMux);
+    uint32_t i = trickleInterval;
+    portEXIT_CRITICAL(&helloMux);
+    return i ? i : helloIntervalMin;
+}
+
+// ----- Send Beacon -----
+void ENowMesh::sendHelloBeacon() {
+    uint32_t now = millis();
+    
+    if (helloIntervalMin == 0) {
+        // Fixed schedule (sooner once the MASTER gradient changed)
+        bool early = helloSoon.load(std::memory_order_relaxed) && now - lastHelloTime >= HELLO_MIN_GAP_MS;
+        if (now - lastHelloTime < helloInterval && !early) {
+            return;  // Not time yet
+        }
+        helloSoon.store(false, std::memory_order_relaxed);
+    } else {
+        uint32_t iMin = helloIntervalMin < helloInterval ? helloIntervalMin : helloInterval;
+        bool fire = false, suppressed = false;
+        portENTER_CRITICAL(&helloMux);
+        if (trickleInterval == 0) startTrickleLocked(now, iMin);
+        // The slot may not leave more than helloInterval since the last beacon: random slots in
+        // consecutive intervals could otherwise be up to 1.5 x helloInterval apart
+        bool due = now - trickleStart >= trickleFireAt || now - lastHelloTime >= helloInterval;
+        if (!trickleFired && due) {
+            trickleFired = true;
+            bool overdue = now - lastHelloTime >= peerTimeout / 2;   // Neighbours must hear us before they prune
+            fire = helloRedundancy == 0 || trickleHeard < helloRedundancy || overdue || lastHelloTime == 0 || syncEnabled();
+            suppressed = !fire;
+        }
+        if (now - trickleStart >= trickleInterval) {
+            uint32_t next = trickleInterval * 2;
+            startTrickleLocked(now, next < helloInterval && next > trickleInterval ? next : helloInterval);
+        }
+        portEXIT_CRITICAL(&helloMux);
+
+        if (suppressed) {
+            countStat(STAT_HELLO_SUPPRESSED);
+            MESH_LOGT(ENOWMESH_LOG_HELLO, "[HELLO BEACON] Suppressed, neighbours already beaconed\n");
+        }
+        if (!fire) return;
+    }
+    
+    lastHelloTime = now;
+    
+    uint8_t *buf = acquirePacketBuffer();
+    if (!buf) {
+        MESH_LOGE(ENOWMESH_LOG_HELLO, "HELLO: packet pool exhausted\n");
+        return;
+    }
+
+    // --- Build header and payload in place ---
+    packet_hdr_t *hdr = (packet_hdr_t*)buf;
+    char *helloMsg = (char*)(buf + sizeof(packet_hdr_t));
+    int mlen = snprintf(helloMsg, PACKET_BUFFER_SIZE - sizeof(packet_hdr_t), "HELLO:%s", getRoleName());
+
+    // Gradient after the text's NUL, where older nodes' text-only parsing stops
+    HelloGradient g = {};
+    advertisedMasterHops = getMasterDistance();
+    g.masterHops = advertisedMasterHops;
+    if (g.masterHops != MASTER_HOPS_NONE && g.masterHops > 0) getUplink(g.uplink);
+    memcpy(helloMsg + mlen + 1, &g, sizeof(g));
+    mlen += 1 + sizeof(g);
+
+    // Compact header support and the node IDs this node found shared, so neighbours stop using them
+    if (compactHeaders || syncEnabled()) {
+        HelloIds ids = {};
+        ids.flags = (compactHeaders ? HELLO_COMPACT : 0) | (syncEnabled() ? HELLO_SYNC : 0);
+        size_t n = 0;
+        if (compactHeaders) {
+            portENTER_CRITICAL(&nodeIdMux);
+            for (int i : nodeIdIndex.used) {
+                if (!nodeIds[i].conflict || n == HELLO_ID_CONFLICTS) continue;
+                if (n == 0 || ids.conflicts[0] != nodeIds[i].id) ids.conflicts[n++] = nodeIds[i].id;
+            }
+            portEXIT_CRITICAL(&nodeIdMux);
+        }
+        memcpy(helloMsg + mlen, &ids, sizeof(ids));
+        mlen += sizeof(ids);
+    }
+
+    // Mesh time and TDMA slots, last so driverSend() can stamp the time
+    if (syncEnabled()) {
+        pickSlot();
+        mlen += buildHelloSync((uint8_t*)helloMsg + mlen);
+    }
+
+    memcpy(hdr->src_mac, myMac, 6);
+    memset(hdr->dest_mac, 0xFF, 6);  // Broadcast
+    hdr->seq = nextSeq();
+    hdr->epoch = bootEpoch;
+    hdr->hop_count = 0;
+    hdr->msg_type = MSG_TYPE_HELLO | MSG_TYPE_NO_FORWARD | MSG_TYPE_NO_ACK;  // HELLO flags
+    hdr->payload_len = static_cast<uint8_t>(mlen);
+
+    size_t total = sizeof(packet_hdr_t) + hdr->payload_len;
+
+    // --- Single 802.11 broadcast frame (also reaches neighbours we don't know yet) ---
+    esp_err_t r = txSend(hdr->dest_mac, buf, total);
+    if (r != ESP_OK) {
+        MESH_LOGE(ENOWMESH_LOG_HELLO, "[HELLO BEACON] Broadcast failed: %d\n", (int)r);
+    } else {
+        countStat(STAT_HELLO_SENT);
+        MESH_LOGT(ENOWMESH_LOG_HELLO, "[HELLO BEACON] Broadcast: %s\n", helloMsg);
+    }
+
+    releasePacketBuffer(buf);
+}
+
+// ----- Telemetry Report -----
+void ENowMesh::sendTelemetry() {
+    if (telemetryInterval == 0) return;
+
+    // Each wait is drawn from [0.75, 1.25] x telemetryInterval so nodes booted together
+    // don't flood their reports towards the MASTER in the same instant.
+    uint32_t now = millis();
+    if (telemetryDelay == 0) telemetryDelay = telemetryInterval - telemetryInterval / 4 + (uint32_t)random(telemetryInterval / 2 + 1);
+    if (now - lastTelemetryTime < telemetryDelay) return;
+    lastTelemetryTime = now;
+    telemetryDelay = 0;
+
+    uint8_t payload[1 + sizeof(TelemetryPayload)];
+    TelemetryPayload t;
+    t.version = TELEMETRY_VERSION;
+    t.role = (uint8_t)role;
+    size_t peerCount = PEER_TABLE_SIZE - peerIndex.freeCount;
+    t.peers = (uint8_t)(peerCount > 0xFF ? 0xFF : peerCount);
+    size_t routeCount = getRouteCount();
+    t.routes = (uint8_t)(routeCount > 0xFF ? 0xFF : routeCount);
+    t.uptimeMs = now;
+    for (size_t i = 0; i < STAT_COUNT; ++i) t.counters[i] = stats[i].load(std::memory_order_relaxed);
+    payload[0] = CTRL_TELEMETRY;
+    memcpy(payload + 1, &t, sizeof(t));
+
+    esp_err_t r = sendFrame(nullptr, MSG_TYPE_CONTROL | MSG_TYPE_TO_MASTER | MSG_TYPE_NO_ACK, nextSeq(), payload, sizeof(payload));
+    if (r != ESP_OK) {
+        MESH_LOGE(ENOWMESH_LOG_SYS, "Telemetry send failed: %d\n", (int)r);
+    } else {
+        MESH_LOGT(ENOWMESH_LOG_SYS, "[TELEMETRY] Sent %u bytes\n", (unsigned)sizeof(payload));
+    }
+}
+
+// =======================================
+// ===== COMMUNICATION FUNCTIONS ====
+// =======================================
+
+// ----- Send Wrapper -----
+esp_err_t ENowMesh::sendToMac(const uint8_t *mac, const uint8_t *data, size_t len) {
+    if (!mac) return ESP_ERR_INVALID_ARG;
+    return txSend(mac, data, len);
+}
+
+// ----- Forward Wrapper -----
+// One 802.11 broadcast reaches every neighbour in one frame; per-peer unicasts cost a frame
+// each but are MAC-ACKed and retried, the better deal while only a few peers need a copy.
+// With more neighbours than driver peer slots, unicasts would cycle all of them through the
+// driver on every flood, so a broadcast goes instead
+void ENowMesh::forwardToPeersExcept(const uint8_t *exclude_mac, const uint8_t *data, size_t len) {
+    // Copied under the lock, sent outside it; past DRIVER_PEER_SLOTS the frame is broadcast anyway
+    uint8_t targets[DRIVER_PEER_SLOTS][6];
+    size_t copies = 0;
+    portENTER_CRITICAL(&peersMux);
+    for (int i : peerIndex.used) {
+        if (exclude_mac && memcmp(peers[i].mac, exclude_mac, 6) == 0) continue;
+        if (copies == DRIVER_PEER_SLOTS) { copies++; break; }
+        memcpy(targets[copies++], peers[i].mac, 6);
+    }
+    portEXIT_CRITICAL(&peersMux);
+    if (copies == 0) return;
+    // More copies than the driver has peer slots, or than one TX class can queue, would be evicted or dropped
+    if ((floodBroadcastMinPeers && copies >= floodBroadcastMinPeers) || copies > DRIVER_PEER_SLOTS || copies > TX_CLASS_DEPTH) {
+        static const uint8_t broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        esp_err_t r = txSend(broadcastMac, data, len);
+        if (r != ESP_OK) {
+            MESH_LOGE(ENOWMESH_LOG_TX, "esp_now_send broadcast failed: %d\n", r);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < copies; ++i) {
+        if (sleeperAsleep(targets[i])) continue;
+        esp_err_t r = txSend(targets[i], data, len);
+        if (r != ESP_OK) {
+            MESH_LOGE(ENOWMESH_LOG_TX, "esp_now_send to %s failed: %d\n", macToStr(targets[i]).c_str(), r);
+        }
+    }
+}
+
+// ----- Send Data -----
+esp_err_t ENowMesh::sendData(const char *msg, const uint8_t *dest_mac, uint8_t msg_type) {
+    if (!msg) return ESP_ERR_INVALID_ARG;
+    return sendBytes((const uint8_t*)msg, strlen(msg), dest_mac, msg_type);  // Terminator not sent
+}
+
+// ----- Send Bytes -----
+esp_err_t ENowMesh::sendBytes(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type) {
+    if (!data) return ESP_ERR_INVALID_ARG;
+    if (len == 0) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: empty message, ignoring.\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (len > maxPayload) return startTransfer(data, len, dest_mac, msg_type);
+
+    // Messages too big to share a frame with another go out on their own
+    if (aggregateDelayMs > 0 && 2 + len <= bundleCapacity()) return aggregate(data, len, dest_mac, msg_type);
+
+    lastSeq = nextSeq(seqAcked(dest_mac, msg_type));
+    return sendFrame(dest_mac, msg_type, lastSeq, data, len);
+}
+
+// ----- Build And Send One Frame -----
+esp_err_t ENowMesh::sendFrame(const uint8_t *dest_mac, uint8_t msg_type, uint16_t seq, const uint8_t *data, size_t len,
+                              int fragSlot, const FragmentHeader *frag) {
+    // --- Validate message length before allocating ---
+    size_t mlen = len + (frag ? FRAG_OVERHEAD : 0);
+    if (mlen > maxPayload) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: message too long (%u > maxPayload %u)\n", (unsigned)mlen, (unsigned)maxPayload);
+        return ESP_ERR_INVALID_SIZE;
+    } if (mlen > 255) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: payload too large for uint8_t field (%u > 255)\n", (unsigned)mlen);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Check ESP-NOW hardware limit
+    size_t total = sizeof(packet_hdr_t) + mlen;
+    if (total > ESP_NOW_MAX_IE_DATA_LEN) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "ERROR: Packet too large (%u bytes > %u max)\n", (unsigned)total, (unsigned)ESP_NOW_MAX_IE_DATA_LEN);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t *buf = acquirePacketBuffer();
+    if (!buf) return ESP_ERR_NO_MEM;
+
+    // --- Build header and payload in place ---
+    packet_hdr_t &hdr = *(packet_hdr_t*)buf;
+    memcpy(hdr.src_mac, myMac, 6);
+
+    if (dest_mac)
+        memcpy(hdr.dest_mac, dest_mac, 6);
+    else
+        memset(hdr.dest_mac, 0xFF, 6); // broadcast
+
+    hdr.seq = seq;
+    hdr.epoch = bootEpoch;
+    hdr.hop_count = 0;
+    hdr.msg_type = msg_type & ~MSG_TYPE_RETRANSMIT;  // Use provided message type
+
+    // Set NO_ACK flag for broadcasts (if not already set)
+    if (!dest_mac && !(msg_type & MSG_TYPE_NO_ACK)) {
+        hdr.msg_type |= MSG_TYPE_NO_ACK;
+    }
+
+    hdr.payload_len = static_cast<uint8_t>(mlen);
+    uint8_t *pl = buf + sizeof(packet_hdr_t);
+    if (frag) {
+        *pl++ = CTRL_FRAGMENT;
+        memcpy(pl, frag, sizeof(FragmentHeader));
+        pl += sizeof(FragmentHeader);
+    }
+    memcpy(pl, data, len);
+
+    // --- Track unicasts that need ACKs before sending, so a fast ACK always finds its entry ---
+    int pendingSlot = -1;
+    if (dest_mac && !(hdr.msg_type & MSG_TYPE_NO_ACK)) {
+        uint32_t rto = ackTimeoutFor(dest_mac);
+        uint32_t now = millis();
+        portENTER_CRITICAL(&pendingMux);
+        int i = pendingUsed.firstFree(maxPendingMessages);
+        if (i >= 0) {
+            PendingMessage &p = pendingMessages[i];
+            memcpy(p.dest_mac, dest_mac, 6);
+            p.seq = hdr.seq;
+            p.firstSendTime = now;
+            p.sendTime = now;
+            p.rto = rto;
+            p.timeout = backoffTimeout(rto, 0);
+            p.retryCount = 0;
+            p.frameLen = static_cast<uint8_t>(total);
+            p.fragSlot = (int8_t)fragSlot;
+            p.fragIndex = frag ? frag->index : 0;
+            p.fragMsgId = frag ? frag->msgId : 0;
+            p.held = false;
+            memcpy(pendingFrames[i], buf, total);
+            setPendingStateLocked(i, PENDING_WAITING);
+            pendingSlot = i;
+        }
+        portEXIT_CRITICAL(&pendingMux);
+
+        if (pendingSlot < 0 && fragSlot >= 0) {
+            releasePacketBuffer(buf);
+            return ESP_ERR_NO_MEM;  // Fragment waits for a free slot: an untracked one could never complete its transfer
+        }
+        if (pendingSlot < 0) {
+            countStat(STAT_PENDING_FULL);
+            MESH_LOGE(ENOWMESH_LOG_ACK, "Pending table full - seq=%u to %s sent without retries.\n", (unsigned)hdr.seq, macToStr(dest_mac).c_str());
+        }
+    }
+
+    // --- Send ---
+    esp_err_t result;
+    if (dest_mac) {
+        if (hdr.msg_type & MSG_TYPE_NO_FORWARD)
+            result = sendToMac(dest_mac, buf, total);                   // 1-hop only
+        else
+            result = sendUnicastFrame(dest_mac, nullptr, buf, total);   // unicast, routed
+        MESH_LOGT(ENOWMESH_LOG_TX, "[MESH SEND] To %s | type=%s | seq=%u | len=%u | result=%d\n", macToStr(dest_mac).c_str(), msgTypeToStr(hdr.msg_type), (unsigned)hdr.seq, (unsigned)hdr.payload_len, (int)result);
+    } else if (masterUplink && (hdr.msg_type & (MSG_TYPE_TO_MASTER | MSG_TYPE_TO_REPEATER)) == MSG_TYPE_TO_MASTER &&
+               (result = sendUplinkFrame(nullptr, buf, total)) != ESP_ERR_NOT_FOUND) {
+        MESH_LOGT(ENOWMESH_LOG_TX, "[MESH TO MASTER] type=%s | seq=%u | len=%u | result=%d\n", msgTypeToStr(hdr.msg_type), (unsigned)hdr.seq, (unsigned)hdr.payload_len, (int)result);
+    } else {
+        forwardToPeersExcept(nullptr, buf, total);  // broadcast
+        countStat(STAT_FLOODED);
+        result = ESP_OK;
+        MESH_LOGT(ENOWMESH_LOG_TX, "[MESH BROADCAST] type=%s | seq=%u | len=%u\n", msgTypeToStr(hdr.msg_type), (unsigned)hdr.seq, (unsigned)hdr.payload_len);
+    }
+
+    // A frame the driver refused is reported to the caller, not retried
+    if (pendingSlot >= 0 && result != ESP_OK) {
+        portENTER_CRITICAL(&pendingMux);
+        setPendingStateLocked(pendingSlot, PENDING_FREE);
+        portEXIT_CRITICAL(&pendingMux);
+    }
+
+    releasePacketBuffer(buf);
+    return result;
+}
+
+// Send message to a MASTER node
+esp_err_t ENowMesh::sendToMaster(const char *msg, uint8_t msg_type) {
+    return sendData(msg, nullptr, msg_type | MSG_TYPE_TO_MASTER);
+}
+
+// Send message to all REPEATER nodes
+esp_err_t ENowMesh::sendToRepeaters(const char *msg, uint8_t msg_type) {
+    return sendData(msg, nullptr, msg_type | MSG_TYPE_TO_REPEATER);
+}
+
+// Send message directly (no mesh forwarding)
+esp_err_t ENowMesh::sendDirect(const char *msg, const uint8_t *dest_mac, uint8_t msg_type) {
+    if (!dest_mac) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "ERROR: sendDirect requires destination MAC address\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return sendData(msg, dest_mac, msg_type | MSG_TYPE_NO_FORWARD);
+}
+
+esp_err_t ENowMesh::sendBytesToMaster(const uint8_t *data, size_t len, uint8_t msg_type) {
+    return sendBytes(data, len, nullptr, msg_type | MSG_TYPE_TO_MASTER);
+}
+
+esp_err_t ENowMesh::sendBytesToRepeaters(const uint8_t *data, size_t len, uint8_t msg_type) {
+    return sendBytes(data, len, nullptr, msg_type | MSG_TYPE_TO_REPEATER);
+}
+
+esp_err_t ENowMesh::sendBytesDirect(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type) {
+    if (!dest_mac) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "ERROR: sendDirect requires destination MAC address\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return sendBytes(data, len, dest_mac, msg_type | MSG_TYPE_NO_FORWARD);
+}
+
+
+// =======================================
+// ===== STATIC CALLBACK IMPLEMENTATION ===
+// =======================================
+
+void ENowMesh::OnDataSent(const esp_now_send_info_t *info, esp_now_send_status_t status) {
+    if (instance) instance->handleDataSent(info, status);
+}
+
+void ENowMesh::OnDataRecv(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len) {
+    if (instance) instance->handleDataRecv(info, incomingData, len);
+}
+
+// =======================================
+// ===== INSTANCE CALLBACK HANDLERS ===
+// =======================================
+
+void ENowMesh::handleDataSent(const esp_now_send_info_t *info, esp_now_send_status_t status) {
+    if (syncEnabled()) noteDriverReport();   // Before anything else: it may time our HELLO
+
+    // Each report frees a driver slot for the next queued frame
+    portENTER_CRITICAL(&txMux);
+    if (txInFlight) txInFlight--;
+    txLastEventMs = millis();
+    portEXIT_CRITICAL(&txMux);
+    txPump();
+
+    if (!info) return;
+    
+    const uint8_t *mac_addr = info->des_addr;
+    if (!mac_addr) return;
+    bool evicted = !(mac_addr[0] & 0x01) && takeEvictedFrame(mac_addr);
+    if (!evicted) releaseDriverSend(mac_addr);
+    
+    bool ok = status == ESP_NOW_SEND_SUCCESS;
+    if (ok) {
+        MESH_LOGT(ENOWMESH_LOG_TX, "Sent OK to %02X:%02X:%02X:%02X:%02X:%02X\n", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+    } else {
+        MESH_LOGT(ENOWMESH_LOG_TX, "Send FAILED to %02X:%02X:%02X:%02X:%02X:%02X\n", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+        countStat(STAT_SEND_FAILURES);
+    }
+
+    // Deleted from the driver while it held the frame: the failure says nothing about the link
+    if (evicted && !ok) return;
+
+    // One failure is usually a collision or fade: only a run of linkFailLimit evicts the peer
+    if (!recordSendOutcome(mac_addr, ok)) return;
+    int idx = findPeer(mac_addr);
+    if (idx >= 0) {
+        MESH_LOGI(ENOWMESH_LOG_PEER, "Sends to %s failing (%u in a row, or restored from the cache) - removing peer\n", macToStr(mac_addr).c_str(), (unsigned)linkFailLimit);
+        releaseDriverPeer(mac_addr);
+        removePeer(idx);
+        countStat(STAT_PEERS_REMOVED);
+        resetHelloTimer();
+    }
+    dropRoutesVia(mac_addr);
+}
+
+void ENowMesh::handleDataRecv(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len) {
+    if (!info) return;
+
+    if (rxMode == RX_INLINE) {
+        rxHeardUs = micros();
+        processPacket(info, incomingData, len);
+        return;
+    }
+
+    // Deferred modes: park the frame and get out of the Wi-Fi task
+    if (enqueueRx(info, incomingData, len) && rxTaskHandle) {
+        xTaskNotifyGive(rxTaskHandle);
+    }
+}
+
+// =======================================
+// ===== DEFERRED RECEIVE QUEUE ===
+// =======================================
+
+// ----- Producer (driver callback) -----
+bool ENowMesh::enqueueRx(const esp_now_recv_info_t *info, const uint8_t *data, int len) {
+    if (len <= 0 || len > ESP_NOW_MAX_IE_DATA_LEN) {
+        rxDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint16_t head = rxHead.load(std::memory_order_relaxed);
+    uint16_t next = (head + 1) % RX_QUEUE_SIZE;
+    uint16_t tail = rxTail.load(std::memory_order_acquire);
+    if (next == tail) {
+        rxDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    RxSlot &slot = rxQueue[head];
+    memcpy(slot.src, info->src_addr, 6);
+    if (info->des_addr) memcpy(slot.dest, info->des_addr, 6); else memset(slot.dest, 0xFF, 6);
+    if (info->rx_ctrl) slot.rxCtrl = *info->rx_ctrl; else memset(&slot.rxCtrl, 0, sizeof(slot.rxCtrl));
+    slot.enqueuedUs = micros();
+    slot.len = (uint16_t)len;
+    memcpy(slot.data, data, len);
+
+    rxHead.store(next, std::memory_order_release);
+
+    rxEnqueued.fetch_add(1, std::memory_order_relaxed);
+    uint16_t depth = (next + RX_QUEUE_SIZE - tail) % RX_QUEUE_SIZE;
+    uint16_t hw = rxHighWater.load(std::memory_order_relaxed);
+    while (depth > hw && !rxHighWater.compare_exchange_weak(hw, depth, std::memory_order_relaxed)) {}
+    return true;
+}
+
+// ----- Consumer (poll() or RX task) -----
+size_t ENowMesh::drainRx(size_t maxPackets) {
+    size_t n = 0;
+    while (n < maxPackets) {
+        uint16_t tail = rxTail.load(std::memory_order_relaxed);
+        if (tail == rxHead.load(std::memory_order_acquire)) break;
+
+        RxSlot &slot = rxQueue[tail];
+        uint32_t latency = micros() - slot.enqueuedUs;
+        if (latency > rxMaxLatencyUs) rxMaxLatencyUs = latency;
+        rxTotalLatencyUs += latency;
+        rxProcessed++;
+
+        esp_now_recv_info_t info = {};
+        info.src_addr = slot.src;
+        info.des_addr = slot.dest;
+        info.rx_ctrl = &slot.rxCtrl;
+        rxHeardUs = slot.enqueuedUs;
+        processPacket(&info, slot.data, slot.len);
+
+        // Release the slot only after processing: the payload is used in place
+        rxTail.store((tail + 1) % RX_QUEUE_SIZE, std::memory_order_release);
+        n++;
+    }
+    return n;
+}
+
+size_t ENowMesh::poll() {
+    if (rxMode != RX_POLL) return 0;
+    return drainRx(rxBatchSize);
+}
+
+void ENowMesh::rxTaskLoop(void *arg) {
+    ENowMesh *m = (ENowMesh*)arg;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Drain in batches, yielding between them so equal-priority tasks still run
+        while (m->drainRx(m->rxBatchSize) > 0) taskYIELD();
+    }
+}
+
+// ----- Stats -----
+ENowMesh::RxQueueStats ENowMesh::getRxQueueStats() {
+    RxQueueStats st = {};
+    uint16_t head = rxHead.load(std::memory_order_acquire);
+    uint16_t tail = rxTail.load(std::memory_order_acquire);
+    st.depth = (head + RX_QUEUE_SIZE - tail) % RX_QUEUE_SIZE;
+    st.highWater = rxHighWater.load(std::memory_order_relaxed);
+    st.enqueued = rxEnqueued.load(std::memory_order_relaxed);
+    st.dropped = rxDropped.load(std::memory_order_relaxed);
+    st.processed = rxProcessed;
+    st.maxLatencyUs = rxMaxLatencyUs;
+    st.avgLatencyUs = rxProcessed ? (uint32_t)(rxTotalLatencyUs / rxProcessed) : 0;
+    return st;
+}
+
+void ENowMesh::resetRxQueueStats() {
+    // The callback's counters are atomics. The consumer's are plain: with RX_TASK a reset racing a drain may keep one sample
+    rxHighWater.store(0, std::memory_order_relaxed);
+    rxEnqueued.store(0, std::memory_order_relaxed);
+    rxDropped.store(0, std::memory_order_relaxed);
+    rxProcessed = 0;
+    rxMaxLatencyUs = 0;
+    rxTotalLatencyUs = 0;
+}
+
+// =======================================
+// ===== TRANSMIT QUEUE ===
+// =======================================
+// Every esp_now_send() goes through txSend(). While fewer than txMaxInFlight frames
+// are awaiting their send callback, a frame goes straight to the driver and its
+// result is returned as before. Beyond that, frames wait in per-class FIFOs and the
+// send callback hands out the next one, highest class first, so a burst of forwards
+// can't starve ACKs or crowd the driver into ESP_ERR_ESPNOW_NO_MEM. A full class
+// drops its oldest frame, except own messages, which are refused to the sender; a
+// full pool pushes out the oldest frame of a lower class first.
+
+void ENowMesh::resetTxQueue() {
+    portENTER_CRITICAL(&txMux);
+    for (size_t c = 0; c < TX_CLASS_COUNT; ++c) {
+        txHead[c] = txTail[c] = TX_NONE;
+        txCount[c] = 0;
+    }
+    for (size_t i = 0; i < TX_QUEUE_SIZE; ++i) txSlots[i].next = (i + 1 < TX_QUEUE_SIZE) ? (uint8_t)(i + 1) : TX_NONE;
+    txFree = 0;
+    txInFlight = 0;
+    portEXIT_CRITICAL(&txMux);
+}
+
+// ----- Priority Class From The Frame Header -----
+ENowMesh::TxClass ENowMesh::txClassOf(const uint8_t *frame, size_t len) {
+    if (len < sizeof(packet_hdr_t)) return TX_APP;
+    const packet_hdr_t *hdr = (const packet_hdr_t*)frame;
+    uint8_t kind = hdr->msg_type & MSG_TYPE_CONTROL;
+    if (kind == MSG_TYPE_ACK) return TX_ACK;
+    if (memcmp(hdr->src_mac, myMac, 6) != 0) return TX_FORWARD;
+    if (kind == MSG_TYPE_HELLO) return TX_CONTROL;
+    if (kind == MSG_TYPE_CONTROL && hdr->payload_len > 0 && len > sizeof(packet_hdr_t) &&
+        frame[sizeof(packet_hdr_t)] == CTRL_TELEMETRY) return TX_CONTROL;
+    return TX_APP;
+}
+
+// ----- Send Or Queue One Frame -----
+esp_err_t ENowMesh::txSend(const uint8_t *mac, const uint8_t *data, size_t len) {
+    if (txMaxInFlight == 0) return driverSend(mac, data, len);
+    if (!data || len == 0 || len > ESP_NOW_MAX_IE_DATA_LEN) return ESP_ERR_ESPNOW_ARG;
+
+    TxClass c = txClassOf(data, len);
+    bool direct = false;
+    bool queued = true;
+    int64_t meshUs = 0;
+    uint8_t ownSlot = activeSlot(&meshUs);
+    uint32_t slotWait = 0;
+
+    portENTER_CRITICAL(&txMux);
+    bool idle = txInFlight < txMaxInFlight;
+    for (size_t i = 0; idle && i < TX_CLASS_COUNT; ++i) if (txCount[i]) idle = false;
+    if (idle && ownSlot != TDMA_SLOT_NONE && (slotWait = slotWaitUs(meshUs, ownSlot, len, txInFlight)) != 0) idle = false;
+    if (idle) {
+        txInFlight++;
+        txSent++;
+        txLastEventMs = millis();
+        direct = true;
+    } else {
+        queued = txEnqueueLocked(c, mac, data, len);
+    }
+    portEXIT_CRITICAL(&txMux);
+
+    if (!direct) {
+        if (slotWait) armSlotTimer(slotWait);
+        if (!queued) MESH_LOGI(ENOWMESH_LOG_TX, "TX queue full - class %u frame to %s dropped.\n", (unsigned)c, macToStr(mac).c_str());
+        return queued ? ESP_OK : ESP_ERR_ESPNOW_NO_MEM;
+    }
+
+    esp_err_t r = driverSend(mac, data, len);
+    if (r != ESP_OK) {
+        portENTER_CRITICAL(&txMux);
+        if (txInFlight) txInFlight--;
+        txSent--;
+        txDriverErrors++;
+        portEXIT_CRITICAL(&txMux);
+    }
+    return r;
+}
+
+// Returns false when the new frame itself is the one dropped
+bool ENowMesh::txEnqueueLocked(TxClass c, const uint8_t *mac, const uint8_t *data, size_t len) {
+    if (txCount[c] >= TX_CLASS_DEPTH || txFree == TX_NONE) {
+        int victim = -1;
+        if (txCount[c] >= TX_CLASS_DEPTH) {
+            victim = c;
+        } else {
+            for (int v = TX_CLASS_COUNT - 1; v > c && victim < 0; --v) if (txCount[v]) victim = v;
+            if (victim < 0 && txCount[c]) victim = c;
+        }
+        if (victim < 0 || (victim == c && c == TX_APP)) {
+            txDropped[c]++;
+            return false;
+        }
+
+        uint8_t old = txHead[victim];
+        txHead[victim] = txSlots[old].next;
+        if (txHead[victim] == TX_NONE) txTail[victim] = TX_NONE;
+        txCount[victim]--;
+        txDropped[victim]++;
+        txSlots[old].next = txFree;
+        txFree = old;
+    }
+
+    uint8_t i = txFree;
+    TxSlot &slot = txSlots[i];
+    txFree = slot.next;
+    memcpy(slot.mac, mac, 6);
+    slot.len = (uint8_t)len;
+    slot.enqueuedUs = micros();
+    slot.next = TX_NONE;
+    memcpy(slot.data, data, len);
+
+    if (txTail[c] == TX_NONE) txHead[c] = i; else txSlots[txTail[c]].next = i;
+    txTail[c] = i;
+    txCount[c]++;
+    if (txCount[c] > txHighWater[c]) txHighWater[c] = txCount[c];
+    return true;
+}
+
+// ----- Hand Queued Frames To The Driver -----
+// Runs from the send callback and checkPendingMessages(); the frame is copied out so
+// esp_now_send() is never called with txMux held
+void ENowMesh::txPump() {
+    uint8_t mac[6];
+    uint8_t frame[ESP_NOW_MAX_IE_DATA_LEN];
+    for (;;) {
+        size_t len = 0;
+        int c = -1;
+        int64_t meshUs = 0;
+        uint8_t ownSlot = activeSlot(&meshUs);
+        uint32_t slotWait = 0;
+
+        portENTER_CRITICAL(&txMux);
+        if (txInFlight < txMaxInFlight) {
+            for (int k = 0; k < TX_CLASS_COUNT && c < 0; ++k) if (txCount[k]) c = k;
+        }
+        if (c >= 0 && ownSlot != TDMA_SLOT_NONE && (slotWait = slotWaitUs(meshUs, ownSlot, txSlots[txHead[c]].len, txInFlight)) != 0) c = -1;
+        if (c >= 0) {
+            uint8_t i = txHead[c];
+            TxSlot &slot = txSlots[i];
+            txHead[c] = slot.next;
+            if (txHead[c] == TX_NONE) txTail[c] = TX_NONE;
+            txCount[c]--;
+            memcpy(mac, slot.mac, 6);
+            len = slot.len;
+            memcpy(frame, slot.data, len);
+            uint32_t wait = micros() - slot.enqueuedUs;
+            if (wait > txMaxWaitUs) txMaxWaitUs = wait;
+            txTotalWaitUs += wait;
+            txQueued++;
+            slot.next = txFree;
+            txFree = i;
+            txInFlight++;
+            txSent++;
+            txLastEventMs = millis();
+        }
+        portEXIT_CRITICAL(&txMux);
+        if (c < 0) {
+            if (slotWait) armSlotTimer(slotWait);
+            return;
+        }
+
+        esp_err_t r = driverSend(mac, frame, len);
+        if (r != ESP_OK) {
+            portENTER_CRITICAL(&txMux);
+            if (txInFlight) txInFlight--;
+            txDriverErrors++;
+            portEXIT_CRITICAL(&txMux);
+            MESH_LOGE(ENOWMESH_LOG_TX, "Queued frame to %s refused by driver: %d\n", macToStr(mac).c_str(), (int)r);
+        }
+    }
+}
+
+// ----- Lost Send Callbacks -----
+// The driver reports every accepted frame once; should a report never come, the
+// in-flight count would block the queue for good
+void ENowMesh::serviceTxQueue(uint32_t now) {
+    if (txMaxInFlight == 0) return;
+    bool stalled = false;
+    portENTER_CRITICAL(&txMux);
+    if (txInFlight && now - txLastEventMs > TX_STALL_MS) {
+        txInFlight = 0;
+        txStalls++;
+        stalled = true;
+    }
+    portEXIT_CRITICAL(&txMux);
+    if (stalled) {
+        portENTER_CRITICAL(&driverPeersMux);   // Nor will their neighbours' driver peer slots be released
+        for (int i : driverPeerUsed) driverPeers[i].inDriver = 0;
+        portEXIT_CRITICAL(&driverPeersMux);
+    }
+    if (stalled && syncEnabled()) {
+        portENTER_CRITICAL(&syncMux);   // The lost reports would pair later ones with the wrong frames
+        driverReported = driverSent;
+        helloAwaiting = false;
+        portEXIT_CRITICAL(&syncMux);
+    }
+    txPump();
+}
+
+// ----- Stats -----
+ENowMesh::TxQueueStats ENowMesh::getTxQueueStats() {
+    TxQueueStats st = {};
+    portENTER_CRITICAL(&txMux);
+    st.inFlight = txInFlight;
+    for (size_t c = 0; c < TX_CLASS_COUNT; ++c) {
+        st.depth[c] = txCount[c];
+        st.highWater[c] = txHighWater[c];
+        st.dropped[c] = txDropped[c];
+    }
+    st.sent = txSent;
+    st.queued = txQueued;
+    st.driverErrors = txDriverErrors;
+    st.stalls = txStalls;
+    st.maxWaitUs = txMaxWaitUs;
+    st.avgWaitUs = txQueued ? (uint32_t)(txTotalWaitUs / txQueued) : 0;
+    portEXIT_CRITICAL(&txMux);
+    return st;
+}
+
+void ENowMesh::resetTxQueueStats() {
+    portENTER_CRITICAL(&txMux);
+    for (size_t c = 0; c < TX_CLASS_COUNT; ++c) {
+        txHighWater[c] = txCount[c];
+        txDropped[c] = 0;
+    }
+    txSent = 0;
+    txQueued = 0;
+    txDriverErrors = 0;
+    txStalls = 0;
+    txMaxWaitUs = 0;
+    txTotalWaitUs = 0;
+    portEXIT_CRITICAL(&txMux);
+}
+
+// =======================================
+// ===== COMPACT HEADERS ===
+// =======================================
+// With compactHeaders, driverSend() rewrites frames for neighbours that advertised support
+// into compact_hdr_t, and processPacket() restores packet_hdr_t before anything reads it, so
+// the rest of the mesh only sees full headers. An address vanishes where it is the link sender
+// or receiver, and shrinks to its node ID where the receiving neighbour holds that ID in its
+// own table: it sent us compact frames naming the node. Otherwise, and in every
+// retransmission, the MAC goes in full, so an ACKed message whose ID a receiver could not
+// resolve still arrives on its next attempt.
+
+// ----- Node IDs -----
+// FNV-1a over the MAC, folded to 16 bits
+uint16_t ENowMesh::nodeIdOf(const uint8_t *mac) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; ++i) h = (h ^ mac[i]) * 16777619u;
+    uint16_t id = (uint16_t)(h ^ (h >> 16));
+    if (id == 0x0000) return 0x0001;
+    if (id == 0xFFFF) return 0xFFFE;
+    return id;
+}
+
+uint16_t ENowMesh::getNodeId() {
+    return nodeIdOf(myMac);
+}
+
+void ENowMesh::resetNodeIds() {
+    portENTER_CRITICAL(&nodeIdMux);
+    nodeIdIndex.reset();
+    for (size_t i = 0; i < NODE_ID_HEARD_CONFLICTS; ++i) heardIdConflicts[i] = 0;
+    portEXIT_CRITICAL(&nodeIdMux);
+}
+
+// ----- Node ID Table -----
+// A new entry whose ID is this node's, another entry's or one a neighbour reported as shared
+// is marked conflicting, and so is the other entry: the ID is no longer used either way
+int ENowMesh::noteNodeIdLocked(const uint8_t *mac) {
+    int slot = nodeIdIndex.find(mac, nodeIds[0].mac, sizeof(NodeIdEntry));
+    if (slot < 0) {
+        if (nodeIdIndex.freeCount == 0) {
+            int lru = -1;
+            for (int i : nodeIdIndex.used) {
+                if (lru < 0 || nodeIdTick - nodeIds[i].lastUsed > nodeIdTick - nodeIds[lru].lastUsed) lru = i;
+            }
+            nodeIdIndex.remove(lru, nodeIds[0].mac, sizeof(NodeIdEntry));
+        }
+        uint16_t id = nodeIdOf(mac);
+        bool shared = id == nodeIdOf(myMac);
+        bool found = shared;
+        for (int i : nodeIdIndex.used) {
+            if (nodeIds[i].id != id) continue;
+            if (!nodeIds[i].conflict) found = true;
+            nodeIds[i].conflict = true;
+            shared = true;
+        }
+        if (found) countStat(STAT_ID_CONFLICTS);
+        bool reported = false;
+        for (size_t k = 0; k < NODE_ID_HEARD_CONFLICTS; ++k) if (heardIdConflicts[k] == id) reported = true;
+
+        slot = nodeIdIndex.insert(mac);
+        NodeIdEntry &e = nodeIds[slot];
+        memcpy(e.mac, mac, 6);
+        e.id = id;
+        memset(e.knownBy, 0, sizeof(e.knownBy));
+        e.conflict = shared || reported;
+    }
+    nodeIds[slot].lastUsed = ++nodeIdTick;
+    return slot;
+}
+
+// From a neighbour's HELLO: it knows two MACs for id
+void ENowMesh::noteIdConflictLocked(uint16_t id) {
+    for (size_t k = 0; k < NODE_ID_HEARD_CONFLICTS; ++k) if (heardIdConflicts[k] == id) return;
+    heardIdConflicts[heardIdConflictNext] = id;
+    heardIdConflictNext = (heardIdConflictNext + 1) % NODE_ID_HEARD_CONFLICTS;
+    for (int i : nodeIdIndex.used) if (nodeIds[i].id == id) nodeIds[i].conflict = true;
+}
+
+// ----- Learn From A Received Frame -----
+// Every address in the frame goes into the table; one named in a compact frame is also in the
+// link sender's table, since its encoder adds every address it writes
+void ENowMesh::noteNodeIds(const packet_hdr_t &hdr, const uint8_t *from, bool compact) {
+    uint16_t fromId = nodeIdOf(from);
+    const uint8_t *addrs[3] = {from, hdr.src_mac, hdr.dest_mac};
+    portENTER_CRITICAL(&nodeIdMux);
+    for (const uint8_t *mac : addrs) {
+        if ((mac[0] & 0x01) || memcmp(mac, myMac, 6) == 0) continue;   // Broadcast or this node
+        int slot = noteNodeIdLocked(mac);
+        if (!compact || memcmp(mac, from, 6) == 0) continue;   // The sender itself is always ADDR_LINK
+        NodeIdEntry &e = nodeIds[slot];
+        bool listed = false;
+        for (size_t k = 0; k < NODE_ID_KNOWN_BY; ++k) if (e.knownBy[k] == fromId) listed = true;
+        if (listed) continue;
+        memmove(e.knownBy + 1, e.knownBy, sizeof(e.knownBy) - sizeof(e.knownBy[0]));
+        e.knownBy[0] = fromId;
+    }
+    portEXIT_CRITICAL(&nodeIdMux);
+}
+
+void ENowMesh::forgetKnownBy(uint16_t neighbourId) {
+    portENTER_CRITICAL(&nodeIdMux);
+    for (int i : nodeIdIndex.used) {
+        for (size_t k = 0; k < NODE_ID_KNOWN_BY; ++k) if (nodeIds[i].knownBy[k] == neighbourId) nodeIds[i].knownBy[k] = 0;
+    }
+    portEXIT_CRITICAL(&nodeIdMux);
+}
+
+// ----- Encode -----
+// Never larger than the packet_hdr_t frame. Broadcast frames also reach neighbours that can't
+// decode compact headers, and hop counts above COMPACT_MAX_HOPS don't fit: both go as they are
+size_t ENowMesh::encodeCompact(const uint8_t *mac, const uint8_t *frame, size_t len, uint8_t *out) {
+    static const uint8_t broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    if ((mac[0] & 0x01) || len < sizeof(packet_hdr_t)) return 0;
+    packet_hdr_t hdr;
+    memcpy(&hdr, frame, sizeof(hdr));
+    if (hdr.hop_count > COMPACT_MAX_HOPS || sizeof(packet_hdr_t) + hdr.payload_len > len) return 0;
+
+    portENTER_CRITICAL(&peersMux);
+    int idx = findPeerLocked(mac);
+    bool capable = idx >= 0 && peers[idx].compact;
+    portEXIT_CRITICAL(&peersMux);
+    if (!capable) return 0;
+
+    uint16_t linkId = nodeIdOf(mac);
+    bool retransmit = hdr.msg_type & MSG_TYPE_RETRANSMIT;
+    const uint8_t *addrs[2] = {hdr.src_mac, hdr.dest_mac};
+    uint8_t codes[2];
+    uint8_t *p = out + sizeof(compact_hdr_t);
+
+    portENTER_CRITICAL(&nodeIdMux);
+    for (int f = 0; f < 2; ++f) {
+        const uint8_t *a = addrs[f];
+        if (memcmp(a, f == 0 ? myMac : mac, 6) == 0) {
+            codes[f] = ADDR_LINK;
+            continue;
+        }
+        if (f == 1 && memcmp(a, broadcastMac, 6) == 0) {
+            codes[f] = ADDR_BROADCAST;
+            continue;
+        }
+        codes[f] = ADDR_MAC;
+        int slot = noteNodeIdLocked(a);
+        if (!retransmit && !nodeIds[slot].conflict) {
+            for (size_t k = 0; k < NODE_ID_KNOWN_BY; ++k) if (nodeIds[slot].knownBy[k] == linkId) codes[f] = ADDR_ID;
+        }
+        if (codes[f] == ADDR_ID) {
+            memcpy(p, &nodeIds[slot].id, 2);
+            p += 2;
+        } else {
+            memcpy(p, a, 6);
+            p += 6;
+        }
+    }
+    portEXIT_CRITICAL(&nodeIdMux);
+
+    compact_hdr_t c;
+    c.flags = COMPACT_HEADER | codes[0] << 1 | codes[1] << 3 | hdr.hop_count << 5;
+    c.epoch = hdr.epoch;
+    c.seq = hdr.seq;
+    c.msg_type = hdr.msg_type;
+    memcpy(out, &c, sizeof(c));
+    memcpy(p, frame + sizeof(packet_hdr_t), hdr.payload_len);
+    return (size_t)(p - out) + hdr.payload_len;
+}
+
+// ----- Decode -----
+// from is the link sender; out receives the packet_hdr_t frame
+size_t ENowMesh::decodeCompact(const uint8_t *from, const uint8_t *frame, size_t len, uint8_t *out) {
+    if (len < sizeof(compact_hdr_t)) {
+        countStat(STAT_SIZE_DROPS);
+        return 0;
+    }
+    compact_hdr_t c;
+    memcpy(&c, frame, sizeof(c));
+    packet_hdr_t hdr;
+    uint8_t *addrs[2] = {hdr.src_mac, hdr.dest_mac};
+    uint8_t codes[2] = {(uint8_t)((c.flags >> 1) & 0x03), (uint8_t)((c.flags >> 3) & 0x03)};
+    const uint8_t *p = frame + sizeof(c);
+    const uint8_t *end = frame + len;
+
+    for (int f = 0; f < 2; ++f) {
+        if (codes[f] == ADDR_LINK) {
+            memcpy(addrs[f], f == 0 ? from : myMac, 6);
+        } else if (codes[f] == ADDR_BROADCAST && f == 1) {
+            memset(addrs[f], 0xFF, 6);
+        } else if (codes[f] == ADDR_MAC && end - p >= 6) {
+            memcpy(addrs[f], p, 6);
+            p += 6;
+        } else if (codes[f] == ADDR_ID && end - p >= 2) {
+            uint16_t id;
+            memcpy(&id, p, 2);
+            p += 2;
+            bool found = false;
+            portENTER_CRITICAL(&nodeIdMux);
+            for (int i : nodeIdIndex.used) {
+                if (nodeIds[i].id != id) continue;
+                found = !nodeIds[i].conflict;
+                if (found) {
+                    memcpy(addrs[f], nodeIds[i].mac, 6);
+                    nodeIds[i].lastUsed = ++nodeIdTick;
+                }
+                break;
+            }
+            portEXIT_CRITICAL(&nodeIdMux);
+            if (!found) {
+                countStat(STAT_ID_MISSES);
+                MESH_LOGI(ENOWMESH_LOG_RX, "Compact frame from %s names unknown node ID %04X. ignoring.\n", macToStr(from).c_str(), (unsigned)id);
+                return 0;
+            }
+        } else {
+            countStat(STAT_SIZE_DROPS);
+            return 0;
+        }
+    }
+
+    size_t payloadLen = (size_t)(end - p);
+    if (sizeof(packet_hdr_t) + payloadLen > ESP_NOW_MAX_IE_DATA_LEN) {
+        countStat(STAT_SIZE_DROPS);
+        return 0;
+    }
+    hdr.seq = c.seq;
+    hdr.epoch = c.epoch;
+    hdr.hop_count = c.flags >> 5;
+    hdr.msg_type = c.msg_type;
+    hdr.payload_len = (uint8_t)payloadLen;
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), p, payloadLen);
+    return sizeof(hdr) + payloadLen;
+}
+
+// =======================================
+// ===== PACKET PROCESSING ===
+// =======================================
+
+void ENowMesh::processPacket(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len) {
+
+    const uint8_t *mac_addr = info->src_addr;
+    int8_t rssi = info->rx_ctrl ? (int8_t)info->rx_ctrl->rssi : 0;
+    countStat(STAT_RX);
+    serviceFloods(millis());   // Traffic-driven timer for held relays, between checkPendingMessages() calls
+    MESH_LOGT(ENOWMESH_LOG_RX, "Received %d bytes from %02X:%02X:%02X:%02X:%02X:%02X\n", len, mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+
+    // Compact header: everything below reads the packet_hdr_t frame it stands for
+    uint8_t expanded[ESP_NOW_MAX_IE_DATA_LEN];
+    bool compact = len > 0 && (incomingData[0] & COMPACT_HEADER);
+    if (compact) {
+        size_t n = decodeCompact(mac_addr, incomingData, (size_t)len, expanded);
+        if (n == 0) {
+            touchPeer(mac_addr, rssi);
+            return;
+        }
+        incomingData = expanded;
+        len = (int)n;
+    }
+
+    // === BASIC VALIDATION ===
+    if (len < (int)sizeof(packet_hdr_t)) {
+        MESH_LOGI(ENOWMESH_LOG_RX, "Packet too small. ignoring.\n");
+        countStat(STAT_SIZE_DROPS);
+        touchPeer(mac_addr, rssi);
+        return;
+    }
+
+    packet_hdr_t hdr;
+    memcpy(&hdr, incomingData, sizeof(packet_hdr_t));
+
+    // Drop packets from self
+    if (memcmp(hdr.src_mac, myMac, 6) == 0) {
+        MESH_LOGT(ENOWMESH_LOG_RX, "Packet originated from self. Dropping.\n");
+        return;
+    }
+
+    // Learn the reverse path: src_mac is hop_count + 1 hops away through the immediate sender.
+    // Duplicates are learned from too, since a later copy may have taken a shorter path.
+    if (hdr.hop_count < 0xFF) learnRoute(hdr.src_mac, mac_addr, hdr.hop_count + 1);
+
+    // A fragment for us that no reassembly slot can take is dropped before duplicate detection records it:
+    // unACKed, it is retransmitted and stored once a slot frees up instead of being re-ACKed as a duplicate
+    if ((hdr.msg_type & MSG_TYPE_CONTROL) == MSG_TYPE_CONTROL && memcmp(hdr.dest_mac, myMac, 6) == 0 &&
+        !fragmentFits(hdr.src_mac, incomingData + sizeof(packet_hdr_t), hdr.payload_len)) {
+        touchPeer(mac_addr, rssi);
+        return;
+    }
+
+    // Duplicate detection (before any processing)
+    bool retransmitOnly = false;
+    SeenResult seen = checkSeen(hdr.src_mac, hdr.epoch, hdr.seq, seqAcked(hdr.dest_mac, hdr.msg_type));
+    if (seen == SEEN_STALE && memcmp(hdr.dest_mac, myMac, 6) == 0) {
+        // Not retransmitted, so a late copy: too old to tell whether it was delivered
+        touchPeer(mac_addr, rssi);
+        MESH_LOGI(ENOWMESH_LOG_RX, "Packet from %s seq=%u is behind the duplicate window - dropped\n", macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq);
+        return;
+    }
+    if (seen != SEEN_NEW) {
+        touchPeer(mac_addr, rssi);  // still update peer table
+
+        // A retransmission means our ACK was lost: answer it again without redelivering
+        if (memcmp(hdr.dest_mac, myMac, 6) == 0) {
+            countStat(STAT_DUPLICATES);
+            if ((hdr.msg_type & MSG_TYPE_CONTROL) != MSG_TYPE_ACK && !(hdr.msg_type & MSG_TYPE_NO_ACK)) queueAck(hdr.src_mac, hdr.seq);
+            MESH_LOGT(ENOWMESH_LOG_RX, "DUPLICATE packet for me (src=%s seq=%u) - re-ACKing\n", macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq);
+            return;
+        }
+
+        // Retransmissions reuse the seq, so every forwarder that carried the original sees a duplicate.
+        // Pass them on along a direct link or learned route; flooded copies stay suppressed.
+        if (!(hdr.msg_type & MSG_TYPE_RETRANSMIT)) {
+            countStat(STAT_DUPLICATES);
+            if (floodCounterK) noteFloodCopy(hdr);
+            MESH_LOGT(ENOWMESH_LOG_RX, "DUPLICATE packet detected (src=%s seq=%u) - dropping\n", macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq);
+            return;
+        }
+        retransmitOnly = true;
+    }
+
+    if (hdr.payload_len > maxPayload) {
+        MESH_LOGI(ENOWMESH_LOG_RX, "Payload_len %u exceeds MAX_PAYLOAD %u. ignoring.\n", hdr.payload_len, (unsigned)maxPayload);
+        countStat(STAT_SIZE_DROPS);
+        touchPeer(mac_addr, rssi);
+        return;
+    }
+
+    if ((size_t)len < sizeof(packet_hdr_t) + hdr.payload_len) {
+        MESH_LOGI(ENOWMESH_LOG_RX, "Payload length mismatch. ignoring.\n");
+        countStat(STAT_SIZE_DROPS);
+        touchPeer(mac_addr, rssi);
+        return;
+    }
+
+    touchPeer(mac_addr, rssi);
+    noteSleeperHeard(mac_addr);
+    if (compactHeaders) noteNodeIds(hdr, mac_addr, compact);
+
+    MESH_LOGT(ENOWMESH_LOG_RX, "[RECV] type=%s | from=%s | seq=%u | hop=%u\n", msgTypeToStr(hdr.msg_type), macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq, (unsigned)hdr.hop_count);
 
     // === HANDLE HELLO BEACONS ===
-    if (hdr.msg_type & MSG_TYPE_HELLO) {
-        Serial.printf("[HELLO RECEIVED] from %s (via %s) - peer discovered\n", 
-                     m->macToStr(hdr.src_mac).c_str(), m->macToStr(mac_addr).c_str());
+    if ((hdr.msg_type & MSG_TYPE_CONTROL) == MSG_TYPE_HELLO) {
+        MESH_LOGT(ENOWMESH_LOG_HELLO, "[HELLO RECEIVED] from %s (via %s) - peer discovered\n", 
+                     macToStr(hdr.src_mac).c_str(), macToStr(mac_addr).c_str());
         
         // Peer already added via touchPeer() above
+        noteHelloHeard(!notePeerHello(mac_addr, hdr.epoch, hdr.seq, incomingData + sizeof(packet_hdr_t), hdr.payload_len));
         // HELLO packets are not forwarded (MSG_TYPE_NO_FORWARD flag prevents it)
         // HELLO packets don't need ACK (MSG_TYPE_NO_ACK flag prevents it)
         return;  // HELLO consumed
     }
 
-    // === ROLE-BASED DELIVERY FILTER ===
-    bool isRoleFiltered = false;
-    bool shouldForward = false;
+    // === ROLE-BASED DELIVERY FILTER ===
+    bool isRoleFiltered = false;
+    bool shouldForward = false;
+
+    if (hdr.msg_type & (MSG_TYPE_TO_MASTER | MSG_TYPE_TO_REPEATER)) {
+        // Handle MSG_TYPE_TO_MASTER (anycast - first master processes and drops)
+        if (hdr.msg_type & MSG_TYPE_TO_MASTER) {
+            if (getRole() == ROLE_MASTER) {
+                MESH_LOGT(ENOWMESH_LOG_RX, "[ROLE FILTER] Packet for MASTER - I am master, processing\n");
+                // shouldForward stays false - master consumes the packet
+            } else {
+                isRoleFiltered = true;  // Don't process, just forward
+                MESH_LOGT(ENOWMESH_LOG_RX, "[ROLE FILTER] Packet for MASTER - forwarding only\n");
+            }
+        }
+        
+        // Handle MSG_TYPE_TO_REPEATER (multicast - all repeaters process and forward)
+        if (hdr.msg_type & MSG_TYPE_TO_REPEATER) {
+            if (getRole() == ROLE_REPEATER) {
+                shouldForward = true;  // Forward to reach other repeaters
+                isRoleFiltered = false;  // Explicitly allow processing
+                MESH_LOGT(ENOWMESH_LOG_RX, "[ROLE FILTER] Packet for REPEATER - I am repeater, processing and forwarding\n");
+            } else {
+                isRoleFiltered = true;  // Don't process, just forward
+                MESH_LOGT(ENOWMESH_LOG_RX, "[ROLE FILTER] Packet for REPEATER - forwarding only\n");
+            }
+        }
+    }
+
+    // === PACKET FOR THIS NODE ===
+    // Only process if:
+    // 1. Addressed to me specifically (unicast), OR
+    // 2. Broadcast AND (not role-filtered OR I match the role filter)
+    bool isUnicastForMe = (memcmp(hdr.dest_mac, myMac, 6) == 0);
+    bool isBroadcast = true;
+    for (int i = 0; i < 6; i++) {
+        if (hdr.dest_mac[i] != 0xFF) {
+            isBroadcast = false;
+            break;
+        }
+    }
+
+    // Plain broadcasts are for everyone: process and pass on
+    if (isBroadcast && !(hdr.msg_type & (MSG_TYPE_TO_MASTER | MSG_TYPE_TO_REPEATER))) shouldForward = true;
+    
+    if (isUnicastForMe || (isBroadcast && !isRoleFiltered)) {
+        MESH_LOGT(ENOWMESH_LOG_RX, "[%s] Packet for me (seq=%u) from immediate=%s original_src=%s hop_count=%u payload_len=%u\n", getRoleName(), (unsigned)hdr.seq, macToStr(mac_addr).c_str(), macToStr(hdr.src_mac).c_str(), (unsigned)hdr.hop_count, (unsigned)hdr.payload_len);
+
+        if (hdr.payload_len > 0) {
+            const uint8_t *pl = incomingData + sizeof(packet_hdr_t);
+
+            // Check for ACK packet using MSG_TYPE_ACK flag
+            if ((hdr.msg_type & MSG_TYPE_CONTROL) == MSG_TYPE_ACK) {
+                handleAck(hdr.src_mac, pl, hdr.payload_len);
+                return;  // ACK consumed
+            }
+
+            RxInfo rx;
+            rx.src_mac = hdr.src_mac;
+            rx.dest_mac = hdr.dest_mac;
+            rx.from_mac = mac_addr;
+            rx.seq = hdr.seq;
+            rx.hop_count = hdr.hop_count;
+            rx.msg_type = hdr.msg_type;
+            rx.rssi = rssi;
+
+            // Mesh-internal control frames (telemetry, fragments) never reach the message callback directly
+            if ((hdr.msg_type & MSG_TYPE_CONTROL) == MSG_TYPE_CONTROL) {
+                handleControl(rx, pl, hdr.payload_len);
+            } else {
+                deliverPayload(rx, pl, hdr.payload_len, nullptr);
+            }
+        }
+
+        // ACK back to original sender (only if MSG_TYPE_NO_ACK is not set), possibly delayed to coalesce
+        if (!(hdr.msg_type & MSG_TYPE_NO_ACK)) {
+            queueAck(hdr.src_mac, hdr.seq);
+        }
+        
+        if (!shouldForward) return;  // Packet consumed - don't forward it
+    }
+
+    // === FORWARDING LOGIC ===    
+    // Check if packet should not be forwarded
+    if (hdr.msg_type & MSG_TYPE_NO_FORWARD) {
+        MESH_LOGT(ENOWMESH_LOG_FWD, "Packet has NO_FORWARD flag - not forwarding.\n");
+        return;
+    }
+
+    // Check hop limit
+    if (hdr.hop_count >= maxHops) {
+        MESH_LOGT(ENOWMESH_LOG_FWD, "Max hops reached. Dropping packet.\n");
+        countStat(STAT_HOP_LIMIT);
+        return;
+    }
+
+    // If this node is a LEAF, do not forward the packet. Without FORWARDING the rest is compiled out
+    if (!FORWARDING || getRole() == ENowMesh::ROLE_LEAF) {
+        MESH_LOGT(ENOWMESH_LOG_FWD, "Role is LEAF – not forwarding packet.\n");
+        return;
+    }
+
+    // Hop count management with proper struct casting
+    size_t fwdLen = sizeof(packet_hdr_t) + hdr.payload_len;
+    uint8_t *fwdBuf = acquirePacketBuffer();
+    if (!fwdBuf) {
+        MESH_LOGE(ENOWMESH_LOG_FWD, "Packet pool exhausted - not forwarding.\n");
+        return;
+    }
+
+    memcpy(fwdBuf, incomingData, fwdLen);
+    packet_hdr_t *fwd_hdr = (packet_hdr_t*)fwdBuf;
+    fwd_hdr->hop_count = hdr.hop_count + 1;
+
+    if (isBroadcast && masterUplink && (hdr.msg_type & (MSG_TYPE_TO_MASTER | MSG_TYPE_TO_REPEATER)) == MSG_TYPE_TO_MASTER) {
+        // Anycast to a MASTER: one unicast down the gradient, never back to the sender
+        esp_err_t r = sendUplinkFrame(mac_addr, fwdBuf, fwdLen);
+        if (r != ESP_ERR_NOT_FOUND) {
+            if (r == ESP_OK) countStat(STAT_FORWARDED);
+            MESH_LOGT(ENOWMESH_LOG_FWD, "Relayed to-MASTER packet (src %s) hop->%u result=%d\n", macToStr(hdr.src_mac).c_str(), fwd_hdr->hop_count, (int)r);
+            releasePacketBuffer(fwdBuf);
+            return;
+        }
+    }
+
+    if (isBroadcast) {
+        // Probabilistic flooding skips some relays, except of frames straight from their source
+        if (floodForwardPct < 100 && hdr.hop_count > 0 && (long)random(100) >= floodForwardPct) {
+            countStat(STAT_FLOOD_SUPPRESSED);
+            MESH_LOGT(ENOWMESH_LOG_FWD, "Broadcast (src %s seq %u) not relayed (floodForwardPct)\n", macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq);
+            releasePacketBuffer(fwdBuf);
+            return;
+        }
+        if (floodCounterK && holdFlood(hdr, mac_addr, fwdBuf, fwdLen)) {
+            releasePacketBuffer(fwdBuf);
+            return;
+        }
+        forwardToPeersExcept(mac_addr, fwdBuf, fwdLen);
+        countStat(STAT_FORWARDED);
+        countStat(STAT_FLOODED);
+        MESH_LOGT(ENOWMESH_LOG_FWD, "Flooded broadcast packet (src %s) hop->%u\n", macToStr(hdr.src_mac).c_str(), fwd_hdr->hop_count);
+    } else {
+        // Direct if neighbour, else learned next hop, else flood (never back to the sender)
+        if (sendUnicastFrame(hdr.dest_mac, mac_addr, fwdBuf, fwdLen, !retransmitOnly) == ESP_OK) {
+            countStat(STAT_FORWARDED);
+            MESH_LOGT(ENOWMESH_LOG_FWD, "Forwarded unicast (src %s dest %s) hop->%u\n",
+                         macToStr(hdr.src_mac).c_str(), macToStr(hdr.dest_mac).c_str(),
+                         fwd_hdr->hop_count);
+        } else {
+            MESH_LOGT(ENOWMESH_LOG_FWD, "No route for retransmission (src %s dest %s) - dropping\n",
+                         macToStr(hdr.src_mac).c_str(), macToStr(hdr.dest_mac).c_str());
+        }
+    }
+
+    releasePacketBuffer(fwdBuf);
+}
+
+// ----- Hand A Payload To The Application -----
+// text: NUL-terminated copy of payload if the caller has one, else a pool buffer is used
+void ENowMesh::deliverPayload(const RxInfo &rx, const uint8_t *payload, size_t len, char *text) {
+    MESH_LOGT(ENOWMESH_LOG_RX, "Payload: %u bytes\n", (unsigned)len);
+    countStat(STAT_DELIVERED);
+
+    // Zero-copy view straight into the received frame
+    if (receiveCallback) receiveCallback(rx, payload, len);
+
+    // Text callback gets a NUL-terminated copy in a pool buffer
+    if (!userCallback) return;
+    if (text) {
+        userCallback(rx.src_mac, text, len);
+        return;
+    }
+    char *tmp = (char*)acquirePacketBuffer();
+    if (tmp) {
+        memcpy(tmp, payload, len);
+        tmp[len] = '\0';
+        userCallback(rx.src_mac, tmp, len);
+        releasePacketBuffer((uint8_t*)tmp);
+    } else {
+        MESH_LOGE(ENOWMESH_LOG_RX, "Packet pool exhausted - payload not delivered.\n");
+    }
+}
+
+// ----- Control Frame Dispatch -----
+void ENowMesh::handleControl(const RxInfo &rx, const uint8_t *payload, size_t len) {
+    switch (payload[0]) {
+        case CTRL_FRAGMENT:
+            handleFragment(rx, payload + 1, len - 1);
+            break;
+        case CTRL_BUNDLE:
+            handleBundle(rx, payload + 1, len - 1);
+            break;
+        case CTRL_POLL:
+            handlePoll(rx, payload + 1, len - 1);
+            break;
+        case CTRL_HELD:
+            handleHeld(payload + 1, len - 1);
+            break;
+        case CTRL_TELEMETRY: {
+            TelemetryPayload t = {};
+            if (len < 1 + offsetof(TelemetryPayload, counters)) {
+                MESH_LOGI(ENOWMESH_LOG_RX, "Short telemetry from %s (%u bytes). ignoring.\n", macToStr(rx.src_mac).c_str(), (unsigned)len);
+                break;
+            }
+            memcpy(&t, payload + 1, len - 1 < sizeof(t) ? len - 1 : sizeof(t));  // Payload is unaligned
+            MESH_LOGT(ENOWMESH_LOG_RX, "[TELEMETRY] from %s: rx=%u fwd=%u dup=%u\n", macToStr(rx.src_mac).c_str(),
+                         (unsigned)t.counters[STAT_RX], (unsigned)t.counters[STAT_FORWARDED], (unsigned)t.counters[STAT_DUPLICATES]);
+            if (telemetryCallback) {
+                TelemetryReport report;
+                report.role = (NodeRole)t.role;
+                report.peers = t.peers;
+                report.routes = t.routes;
+                report.uptimeMs = t.uptimeMs;
+                memcpy(&report.stats, t.counters, sizeof(report.stats));
+                telemetryCallback(rx.src_mac, report);
+            }
+            break;
+        }
+        default:
+            MESH_LOGI(ENOWMESH_LOG_RX, "Unknown control frame %u from %s. ignoring.\n", (unsigned)payload[0], macToStr(rx.src_mac).c_str());
+            break;
+    }
+}
+
+// =======================================
+// ===== BROADCAST FLOODING ===
+// =======================================
+// With floodCounterK set, a relay of a broadcast is not sent at once: the frame is
+// held for a random 0..floodBackoffMs while copies sent by other relays are counted
+// (noteFloodCopy() from the duplicate path). Once floodCounterK copies have been
+// heard, the neighbourhood is assumed covered and the relay is cancelled. Holds are
+// released from the receive path and checkPendingMessages().
+
+// ----- Hold A Relay -----
+bool ENowMesh::holdFlood(const packet_hdr_t &hdr, const uint8_t *from, const uint8_t *frame, size_t len) {
+    if (!FORWARDING) return false;
+    uint32_t now = millis();
+    uint32_t backoff = (uint32_t)random(floodBackoffMs + 1);
+    bool held = false;
+
+    portENTER_CRITICAL(&floodMux);
+    for (size_t i = 0; i < FLOOD_HOLD_SIZE; ++i) {
+        FloodHold &h = floodHolds[i];
+        if (h.valid) continue;
+        memcpy(h.src_mac, hdr.src_mac, 6);
+        memcpy(h.exclude, from, 6);
+        h.seq = hdr.seq;
+        h.epoch = hdr.epoch;
+        h.heard = 1;
+        h.len = (uint8_t)len;
+        h.dueTime = now + backoff;
+        memcpy(h.frame, frame, len);
+        h.valid = true;
+        floodHeld.fetch_add(1, std::memory_order_relaxed);
+        held = true;
+        break;
+    }
+    portEXIT_CRITICAL(&floodMux);
+
+    if (held) MESH_LOGT(ENOWMESH_LOG_FWD, "Holding broadcast (src %s seq %u) for %u ms\n", macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq, (unsigned)backoff);
+    return held;
+}
+
+// ----- Count An Overheard Copy -----
+void ENowMesh::noteFloodCopy(const packet_hdr_t &hdr) {
+    if (!FORWARDING || floodHeld.load(std::memory_order_relaxed) == 0) return;
+    if (seqAcked(hdr.dest_mac, hdr.msg_type)) return;   // Held relays are broadcasts, numbered apart
+    bool cancelled = false;
+
+    portENTER_CRITICAL(&floodMux);
+    for (size_t i = 0; i < FLOOD_HOLD_SIZE; ++i) {
+        FloodHold &h = floodHolds[i];
+        if (!h.valid || h.seq != hdr.seq || h.epoch != hdr.epoch || memcmp(h.src_mac, hdr.src_mac, 6) != 0) continue;
+        if (++h.heard >= floodCounterK) {
+            h.valid = false;
+            floodHeld.fetch_sub(1, std::memory_order_relaxed);
+            cancelled = true;
+        }
+        break;
+    }
+    portEXIT_CRITICAL(&floodMux);
+
+    if (cancelled) {
+        countStat(STAT_FLOOD_SUPPRESSED);
+        MESH_LOGT(ENOWMESH_LOG_FWD, "Broadcast (src %s seq %u) heard %u times - relay cancelled\n", macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq, (unsigned)floodCounterK);
+    }
+}
+
+// ----- Send Relays Whose Backoff Ended -----
+void ENowMesh::serviceFloods(uint32_t now) {
+    if (!FORWARDING || floodHeld.load(std::memory_order_relaxed) == 0) return;
+    uint8_t *buf = nullptr;
+    for (size_t i = 0; i < FLOOD_HOLD_SIZE; ++i) {
+        if (!buf && (buf = acquirePacketBuffer()) == nullptr) return;  // Pool exhausted: retry on the next call
+        size_t len = 0;
+        uint8_t exclude[6];
+
+        portENTER_CRITICAL(&floodMux);
+        FloodHold &h = floodHolds[i];
+        if (h.valid && (int32_t)(now - h.dueTime) >= 0) {
+            memcpy(buf, h.frame, h.len);
+            len = h.len;
+            memcpy(exclude, h.exclude, 6);
+            h.valid = false;
+            floodHeld.fetch_sub(1, std::memory_order_relaxed);
+        }
+        portEXIT_CRITICAL(&floodMux);
+
+        if (len == 0) continue;
+        forwardToPeersExcept(exclude, buf, len);
+        countStat(STAT_FORWARDED);
+        countStat(STAT_FLOODED);
+    }
+    if (buf) releasePacketBuffer(buf);
+}
+
+// =======================================
+// ===== SLEEPY LEAF MAILBOXES ===
+// =======================================
+// A LEAF with sleepIntervalMs set broadcasts CTRL_POLL each time it wakes. Every MASTER
+// or REPEATER in range registers it as a sleeper, sends it what it holds, and from the end
+// of the advertised awake window keeps unicasts due to it in a shared mailbox instead of
+// sending them into a dead radio. A frame waits up to two sleep intervals. Its source
+// gets CTRL_HELD and stretches its retry timer, so it doesn't retransmit while the LEAF
+// sleeps. The LEAF ACKs the frame itself once it has been delivered. Any frame heard from
+// a sleeper also counts as a wake, so a LEAF that sends on waking needs no separate poll.
+
+// ----- Wake Up (LEAF) -----
+// One 802.11 broadcast, like a HELLO: after deep sleep the peer table may be empty
+void ENowMesh::pollMailbox(uint16_t awakeMs) {
+    if (sleepIntervalMs == 0 || role != ROLE_LEAF) return;
+
+    uint8_t *buf = acquirePacketBuffer();
+    if (!buf) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "Mailbox poll: packet pool exhausted\n");
+        return;
+    }
+    MailboxPoll poll = {sleepIntervalMs, awakeMs};
+    uint8_t *pl = buf + sizeof(packet_hdr_t);
+    pl[0] = CTRL_POLL;
+    memcpy(pl + 1, &poll, sizeof(poll));
+
+    packet_hdr_t *hdr = (packet_hdr_t*)buf;
+    memcpy(hdr->src_mac, myMac, 6);
+    memset(hdr->dest_mac, 0xFF, 6);
+    hdr->seq = nextSeq();
+    hdr->epoch = bootEpoch;
+    hdr->hop_count = 0;
+    hdr->msg_type = MSG_TYPE_CONTROL | MSG_TYPE_NO_FORWARD | MSG_TYPE_NO_ACK;
+    hdr->payload_len = 1 + sizeof(poll);
+
+    esp_err_t r = txSend(hdr->dest_mac, buf, sizeof(packet_hdr_t) + hdr->payload_len);
+    if (r != ESP_OK) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "Mailbox poll failed: %d\n", (int)r);
+    } else {
+        MESH_LOGT(ENOWMESH_LOG_TX, "[MAILBOX] Poll sent, awake for %u ms\n", (unsigned)awakeMs);
+    }
+    releasePacketBuffer(buf);
+}
+
+// ----- Sleeper Lookup -----
+int ENowMesh::findSleeperLocked(const uint8_t *mac) {
+    for (int i : sleeperUsed) {
+        if (memcmp(sleepers[i].mac, mac, 6) == 0) return i;
+    }
+    return -1;
+}
+
+bool ENowMesh::sleeperAsleep(const uint8_t *mac) {
+    if (!FORWARDING || sleeperCount.load(std::memory_order_relaxed) == 0) return false;
+    uint32_t now = millis();
+    portENTER_CRITICAL(&mailboxMux);
+    int s = findSleeperLocked(mac);
+    bool asleep = s >= 0 && (int32_t)(now - sleepers[s].awakeUntil) >= 0;
+    portEXIT_CRITICAL(&mailboxMux);
+    return asleep;
+}
+
+uint32_t ENowMesh::sleeperGrace(const uint8_t *mac) {
+    if (!FORWARDING || sleeperCount.load(std::memory_order_relaxed) == 0) return 0;
+    portENTER_CRITICAL(&mailboxMux);
+    int s = findSleeperLocked(mac);
+    uint32_t grace = s >= 0 ? sleepers[s].sleepMs : 0;
+    portEXIT_CRITICAL(&mailboxMux);
+    return grace;
+}
+
+// ----- Register A Sleeper -----
+void ENowMesh::handlePoll(const RxInfo &rx, const uint8_t *payload, size_t len) {
+    if (!FORWARDING || role == ROLE_LEAF || mailboxPerLeaf == 0) return;
+    if (len < sizeof(MailboxPoll) || rx.hop_count != 0) {
+        MESH_LOGI(ENOWMESH_LOG_RX, "Bad mailbox poll from %s. ignoring.\n", macToStr(rx.src_mac).c_str());
+        return;
+    }
+    MailboxPoll poll;
+    memcpy(&poll, payload, sizeof(poll));   // Payload is unaligned
+    uint32_t now = millis();
+
+    bool added = false;
+    portENTER_CRITICAL(&mailboxMux);
+    int s = findSleeperLocked(rx.src_mac);
+    if (s < 0 && poll.sleepMs && (s = sleeperUsed.firstFree(MAILBOX_LEAVES)) >= 0) {
+        memcpy(sleepers[s].mac, rx.src_mac, 6);
+        sleeperUsed.set(s);
+        sleeperCount.fetch_add(1, std::memory_order_relaxed);
+        added = true;
+    }
+    if (s >= 0) {
+        sleepers[s].sleepMs = poll.sleepMs;
+        sleepers[s].awakeMs = poll.awakeMs;
+        sleepers[s].lastHeard = now;
+        sleepers[s].awakeUntil = now + poll.awakeMs;
+    }
+    portEXIT_CRITICAL(&mailboxMux);
+
+    if (s < 0) {
+        if (poll.sleepMs) MESH_LOGE(ENOWMESH_LOG_PEER, "Sleeper table full - no mailbox for %s\n", macToStr(rx.src_mac).c_str());
+        return;
+    }
+    if (added) MESH_LOGI(ENOWMESH_LOG_PEER, "Sleeper %s registered (sleeps %u ms)\n", macToStr(rx.src_mac).c_str(), (unsigned)poll.sleepMs);
+    flushMailbox(rx.src_mac);
+}
+
+void ENowMesh::noteSleeperHeard(const uint8_t *mac) {
+    if (!FORWARDING || sleeperCount.load(std::memory_order_relaxed) == 0) return;
+    uint32_t now = millis();
+    portENTER_CRITICAL(&mailboxMux);
+    int s = findSleeperLocked(mac);
+    if (s >= 0) {
+        sleepers[s].lastHeard = now;
+        sleepers[s].awakeUntil = now + sleepers[s].awakeMs;
+    }
+    portEXIT_CRITICAL(&mailboxMux);
+    if (s >= 0) flushMailbox(mac);
+}
+
+// ----- Hold A Frame -----
+// From sendUnicastFrame(), for a frame whose next hop is dest itself
+bool ENowMesh::holdForSleeper(const uint8_t *dest, const uint8_t *frame, size_t len) {
+    if (!FORWARDING || mailboxPerLeaf == 0 || sleeperCount.load(std::memory_order_relaxed) == 0) return false;
+    if (len < sizeof(packet_hdr_t) || len > ESP_NOW_MAX_IE_DATA_LEN) return false;
+    packet_hdr_t hdr;
+    memcpy(&hdr, frame, sizeof(hdr));
+    uint32_t now = millis();
+    uint32_t holdMs = 0;
+    bool held = false, again = false;
+
+    portENTER_CRITICAL(&mailboxMux);
+    int s = findSleeperLocked(dest);
+    if (s < 0 || (int32_t)(now - sleepers[s].awakeUntil) < 0) {
+        portEXIT_CRITICAL(&mailboxMux);
+        return false;   // Not a sleeper, or listening right now
+    }
+    holdMs = 2 * sleepers[s].sleepMs + sleepers[s].awakeMs;
+    size_t count = 0;
+    for (int i : mailboxUsed) {
+        MailboxFrame &m = mailbox[i];
+        if (memcmp(m.leaf, dest, 6) != 0) continue;
+        const packet_hdr_t *h = (const packet_hdr_t*)m.frame;
+        if (h->seq == hdr.seq && h->epoch == hdr.epoch && !((h->msg_type ^ hdr.msg_type) & MSG_TYPE_NO_ACK) &&
+            memcmp(h->src_mac, hdr.src_mac, 6) == 0) again = true;
+        count++;
+    }
+    int slot = (again || count >= mailboxPerLeaf) ? -1 : mailboxUsed.firstFree(MAILBOX_SIZE);
+    if (slot >= 0) {
+        MailboxFrame &m = mailbox[slot];
+        memcpy(m.leaf, dest, 6);
+        m.len = (uint8_t)len;
+        m.heldAt = now;
+        m.expires = now + holdMs;
+        memcpy(m.frame, frame, len);
+        mailboxUsed.set(slot);
+        held = true;
+    }
+    portEXIT_CRITICAL(&mailboxMux);
+
+    if (!held && !again) {
+        countStat(STAT_MAILBOX_DROPPED);
+        MESH_LOGI(ENOWMESH_LOG_FWD, "Mailbox for %s full - dropping seq=%u\n", macToStr(dest).c_str(), (unsigned)hdr.seq);
+        return true;
+    }
+    if (held) {
+        countStat(STAT_MAILBOX_HELD);
+        MESH_LOGT(ENOWMESH_LOG_FWD, "[MAILBOX] Holding seq=%u from %s for sleeping %s\n", (unsigned)hdr.seq, macToStr(hdr.src_mac).c_str(), macToStr(dest).c_str());
+    }
+
+    // Tell the source (again, for a retransmission) so it waits instead of retrying
+    bool acked = (hdr.msg_type & MSG_TYPE_CONTROL) != MSG_TYPE_ACK && !(hdr.msg_type & MSG_TYPE_NO_ACK);
+    if (!acked) return true;
+    if (memcmp(hdr.src_mac, myMac, 6) == 0) {
+        extendPending(dest, hdr.seq, holdMs);
+        return true;
+    }
+    uint8_t payload[1 + sizeof(MailboxHeld)];
+    MailboxHeld note;
+    memcpy(note.dest, dest, 6);
+    note.seq = hdr.seq;
+    note.holdMs = holdMs;
+    payload[0] = CTRL_HELD;
+    memcpy(payload + 1, &note, sizeof(note));
+    esp_err_t r = sendFrame(hdr.src_mac, MSG_TYPE_CONTROL | MSG_TYPE_NO_ACK, nextSeq(), payload, sizeof(payload));
+    if (r != ESP_OK) MESH_LOGE(ENOWMESH_LOG_FWD, "Mailbox notice to %s failed: %d\n", macToStr(hdr.src_mac).c_str(), (int)r);
+    return true;
+}
+
+// ----- Deliver Held Frames -----
+// A frame leaves the mailbox only once the transmit queue took it; a full queue is retried
+// by serviceMailboxes() while the LEAF is still awake
+void ENowMesh::flushMailbox(const uint8_t *mac) {
+    uint8_t *buf = nullptr;
+    for (;;) {
+        if (!buf && (buf = acquirePacketBuffer()) == nullptr) return;
+        int slot = -1;
+        size_t len = 0;
+        uint32_t heldAt = 0;
+        portENTER_CRITICAL(&mailboxMux);
+        for (int i : mailboxUsed) {
+            if (memcmp(mailbox[i].leaf, mac, 6) != 0) continue;
+            if (slot < 0 || (int32_t)(mailbox[i].heldAt - mailbox[slot].heldAt) < 0) slot = i;
+        }
+        if (slot >= 0) {
+            len = mailbox[slot].len;
+            heldAt = mailbox[slot].heldAt;
+            memcpy(buf, mailbox[slot].frame, len);
+        }
+        portEXIT_CRITICAL(&mailboxMux);
+        if (slot < 0) break;
+
+        esp_err_t r = txSend(mac, buf, len);
+        if (r == ESP_ERR_ESPNOW_NO_MEM) break;
+        portENTER_CRITICAL(&mailboxMux);
+        if (mailboxUsed.test(slot) && mailbox[slot].heldAt == heldAt && memcmp(mailbox[slot].leaf, mac, 6) == 0) mailboxUsed.clear(slot);
+        portEXIT_CRITICAL(&mailboxMux);
+        if (r != ESP_OK) {
+            countStat(STAT_MAILBOX_DROPPED);
+            MESH_LOGE(ENOWMESH_LOG_FWD, "Mailbox send to %s failed: %d\n", macToStr(mac).c_str(), (int)r);
+        } else {
+            MESH_LOGT(ENOWMESH_LOG_FWD, "[MAILBOX] Delivered held frame to %s\n", macToStr(mac).c_str());
+        }
+    }
+    releasePacketBuffer(buf);
+}
+
+// ----- Expiry -----
+// A sleeper silent for three sleep intervals (plus peerTimeout) has gone: its registration and frames are dropped
+void ENowMesh::serviceMailboxes(uint32_t now) {
+    if (!FORWARDING || sleeperCount.load(std::memory_order_relaxed) == 0) return;
+    uint8_t awake[MAILBOX_LEAVES][6];
+    size_t nAwake = 0;
+    unsigned dropped = 0;
+
+    portENTER_CRITICAL(&mailboxMux);
+    for (int s : sleeperUsed) {
+        Sleeper &z = sleepers[s];
+        if (now - z.lastHeard > 3 * z.sleepMs + peerTimeout) {
+            sleeperUsed.clear(s);
+            sleeperCount.fetch_sub(1, std::memory_order_relaxed);
+            continue;
+        }
+        if ((int32_t)(now - z.awakeUntil) < 0) memcpy(awake[nAwake++], z.mac, 6);
+    }
+    for (int i : mailboxUsed) {
+        MailboxFrame &m = mailbox[i];
+        if ((int32_t)(now - m.expires) >= 0 || findSleeperLocked(m.leaf) < 0) {
+            mailboxUsed.clear(i);
+            dropped++;
+        }
+    }
+    portEXIT_CRITICAL(&mailboxMux);
+
+    for (unsigned k = 0; k < dropped; ++k) countStat(STAT_MAILBOX_DROPPED);
+    if (dropped) MESH_LOGI(ENOWMESH_LOG_FWD, "Mailbox: %u held frame(s) expired\n", dropped);
+    for (size_t k = 0; k < nAwake; ++k) flushMailbox(awake[k]);
+}
+
+// ----- Held Notice (Source) -----
+void ENowMesh::handleHeld(const uint8_t *payload, size_t len) {
+    if (len < sizeof(MailboxHeld)) return;
+    MailboxHeld note;
+    memcpy(&note, payload, sizeof(note));   // Payload is unaligned
+    extendPending(note.dest, note.seq, note.holdMs);
+}
+
+// The next retry waits for the hold to run out; the LEAF's ACK normally ends it long before
+void ENowMesh::extendPending(const uint8_t *dest, uint16_t seq, uint32_t holdMs) {
+    uint32_t now = millis();
+    bool found = false;
+    portENTER_CRITICAL(&pendingMux);
+    for (int i : pendingWaiting) {
+        PendingMessage &p = pendingMessages[i];
+        if (p.seq != seq || memcmp(p.dest_mac, dest, 6) != 0) continue;
+        p.held = true;
+        p.sendTime = now;
+        p.timeout = holdMs + p.rto;
+        found = true;
+        break;
+    }
+    portEXIT_CRITICAL(&pendingMux);
+    if (found) MESH_LOGT(ENOWMESH_LOG_ACK, "[MAILBOX] seq=%u to %s held for up to %u ms\n", (unsigned)seq, macToStr(dest).c_str(), (unsigned)holdMs);
+}
+
+// =======================================
+// ===== TIME SYNC AND SLOTTED TX ===
+// =======================================
+// Mesh time runs down the MASTER gradient. A MASTER's mesh time is its own esp_timer clock;
+// every other node follows its uplink's, from the HelloSync at the end of each HELLO.
+// Timestamps are two-step, as in PTP: the send report for a HELLO comes as the frame ends on
+// air, the moment its receivers' callbacks run, so the sender notes its mesh time then and
+// sends it in the next HELLO as prevEndUs. The receiver pairs it with when it heard the
+// previous HELLO and fits offset and drift over its last SYNC_SAMPLES pairs. That leaves
+// only the two callbacks' latencies, where a stamp written at the driver would also carry
+// the wait for a clear channel. Such a stamp (meshTimeUs, advanced by the airtime) still
+// goes out: it sets the clock on the first HELLO and steps it when off by SYNC_STEP_US.
+//
+// With tdmaSlots set, each node picks a slot that no neighbour and no neighbour's neighbour
+// advertises, and txPump() hands frames to the driver only inside it, waking on slotTimer.
+// Until a node is synced and has a slot it sends as before.
+
+// ----- Clock -----
+uint32_t ENowMesh::airtimeUs(size_t len) {
+    return 192 + (uint32_t)(len + 43) * 8;   // Long preamble, then MAC header, vendor IE and FCS at 1 Mbps
+}
+
+int64_t ENowMesh::meshTimeAtLocked(int64_t localUs) {
+    if (role == ROLE_MASTER || !syncValid) return localUs;
+    int64_t d = localUs - syncRefLocal;
+    return syncRefMesh + d + d * syncDriftPpb / 1000000000;
+}
+
+uint64_t ENowMesh::getMeshTimeUs() {
+    int64_t local = esp_timer_get_time();
+    portENTER_CRITICAL(&syncMux);
+    int64_t mesh = meshTimeAtLocked(local);
+    portEXIT_CRITICAL(&syncMux);
+    return (uint64_t)mesh;
+}
+
+bool ENowMesh::isTimeSynced() {
+    return syncEnabled() && (role == ROLE_MASTER || synced);
+}
+
+ENowMesh::SyncStatus ENowMesh::getSyncStatus() {
+    SyncStatus st = {};
+    bool master = role == ROLE_MASTER;
+    portENTER_CRITICAL(&syncMux);
+    st.synced = syncEnabled() && (master || synced);
+    st.hops = master ? 0 : (synced ? syncHops : MASTER_HOPS_NONE);
+    st.driftPpb = master ? 0 : syncDriftPpb;
+    st.lastOffsetUs = syncLastOffsetUs;
+    st.samples = syncSamplesTaken;
+    st.steps = syncSteps;
+    st.outliers = syncOutliers;
+    st.slot = tdmaSlot;
+    st.slotChanges = tdmaSlotChanges;
+    portEXIT_CRITICAL(&syncMux);
+    return st;
+}
+
+// ----- HELLO Block -----
+// Slots of the neighbours heard, and those heard from two of them: a neighbour's
+// neighbour reads its own slot there and knows it collides two hops away
+size_t ENowMesh::buildHelloSync(uint8_t *out) {
+    HelloSync hs = {};
+    hs.flags = isTimeSynced() ? SYNC_SYNCED : 0;
+    hs.slot = tdmaSlots ? tdmaSlot : TDMA_SLOT_NONE;
+    portENTER_CRITICAL(&peersMux);
+    for (int i : peerIndex.used) {
+        if (peers[i].slot >= TDMA_MAX_SLOTS) continue;
+        uint32_t bit = 1u << peers[i].slot;
+        if (hs.slotsHeard & bit) hs.slotsShared |= bit;
+        hs.slotsHeard |= bit;
+    }
+    portEXIT_CRITICAL(&peersMux);
+    if (hs.slot < TDMA_MAX_SLOTS) hs.slotsHeard |= 1u << hs.slot;
+    memcpy(out, &hs, sizeof(hs));
+    return sizeof(hs);
+}
+
+bool ENowMesh::hasHelloSync(const uint8_t *frame, size_t len) {
+    if (len < sizeof(packet_hdr_t) + sizeof(HelloGradient) + sizeof(HelloIds) + sizeof(HelloSync)) return false;
+    const packet_hdr_t *hdr = (const packet_hdr_t*)frame;
+    if ((hdr->msg_type & MSG_TYPE_CONTROL) != MSG_TYPE_HELLO || memcmp(hdr->src_mac, myMac, 6) != 0) return false;
+    const uint8_t *payload = frame + sizeof(packet_hdr_t);
+    const uint8_t *end = (const uint8_t*)memchr(payload, 0, len - sizeof(packet_hdr_t));
+    if (!end) return false;
+    const uint8_t *flags = end + 1 + sizeof(HelloGradient);
+    return (size_t)(frame + len - flags) >= sizeof(HelloIds) + sizeof(HelloSync) && (*flags & HELLO_SYNC);
+}
+
+void ENowMesh::stampHelloSync(uint8_t *frame, size_t len) {
+    HelloSync hs;
+    memcpy(&hs, frame + len - sizeof(hs), sizeof(hs));
+    portENTER_CRITICAL(&syncMux);
+    if (helloEndValid) {
+        hs.flags |= SYNC_FOLLOW_UP;
+        hs.prevSeq = helloEndSeq;
+        hs.prevEndUs = (uint64_t)helloEndMeshUs;
+    }
+    portEXIT_CRITICAL(&syncMux);
+    hs.meshTimeUs = getMeshTimeUs() + airtimeUs(len);
+    memcpy(frame + len - sizeof(hs), &hs, sizeof(hs));
+}
+
+// ----- Send Reports -----
+void ENowMesh::noteDriverSend(bool hello, uint16_t seq) {
+    portENTER_CRITICAL(&syncMux);
+    driverSent++;
+    if (hello) {
+        helloAwaiting = true;
+        helloSendIdx = driverSent;
+        helloSendSeq = seq;
+    }
+    portEXIT_CRITICAL(&syncMux);
+}
+
+void ENowMesh::noteDriverReport() {
+    int64_t local = esp_timer_get_time();
+    portENTER_CRITICAL(&syncMux);
+    driverReported++;
+    if (helloAwaiting && driverReported == helloSendIdx) {
+        helloAwaiting = false;
+        helloEndValid = role == ROLE_MASTER || synced;
+        helloEndSeq = helloSendSeq;
+        helloEndMeshUs = meshTimeAtLocked(local);
+    }
+    portEXIT_CRITICAL(&syncMux);
+}
+
+// ----- Stamp From A Neighbour -----
+void ENowMesh::noteHelloSync(const uint8_t *mac, uint8_t masterHops, const HelloSync &hs, int64_t heardAt, int64_t prevHeardAt) {
+    // Slots: of two neighbours in one slot the lower MAC keeps it; a slot shared two hops away
+    // is given up by either side at random, each only once per helloInterval
+    if (tdmaSlots && tdmaSlot != TDMA_SLOT_NONE) {
+        bool clash = hs.slot == tdmaSlot && memcmp(mac, myMac, 6) < 0;
+        bool shared = (hs.slotsShared >> tdmaSlot) & 1;
+        if ((clash || (shared && millis() - tdmaPickedAt > helloInterval && random(2))) && !tdmaRepick) {
+            tdmaRepick = true;
+            MESH_LOGI(ENOWMESH_LOG_TX, "[TDMA] Slot %u also used %s %s - picking another\n", (unsigned)tdmaSlot,
+                      clash ? "by" : "next to", macToStr(mac).c_str());
+            resetHelloTimer();
+        }
+    }
+
+    uint8_t uplink[6];
+    if (role == ROLE_MASTER || !(hs.flags & SYNC_SYNCED) || !getUplink(uplink) || memcmp(uplink, mac, 6) != 0) return;
+
+    int64_t stamp = (int64_t)hs.meshTimeUs;
+    int64_t prevEnd = (int64_t)hs.prevEndUs;
+    bool paired = prevHeardAt >= 0, stepped = false, fitted = false;
+    int64_t offset;
+
+    portENTER_CRITICAL(&syncMux);
+    offset = paired ? prevEnd - meshTimeAtLocked(prevHeardAt) : stamp - meshTimeAtLocked(heardAt);
+    // A stamp behind our clock may just have waited for the channel, by any amount: only a pair,
+    // timed at the send report, sets the clock back
+    if (!syncValid || offset > (int64_t)SYNC_STEP_US || (paired && offset < -(int64_t)SYNC_STEP_US)) {
+        syncValid = true;
+        syncRefLocal = paired ? prevHeardAt : heardAt;
+        syncRefMesh = paired ? prevEnd : stamp;
+        syncSampleCount = 0;
+        syncSampleNext = 0;
+        syncSteps++;
+        stepped = true;
+    }
+    if (paired) {
+        syncSamples[syncSampleNext] = {prevHeardAt, prevEnd};
+        syncSampleNext = (syncSampleNext + 1) % SYNC_SAMPLES;
+        if (syncSampleCount < SYNC_SAMPLES) syncSampleCount++;
+
+        fitted = fitSyncLocked();
+        syncSamplesTaken++;
+    }
+    syncLastOffsetUs = (int32_t)(offset > INT32_MAX ? INT32_MAX : offset < INT32_MIN ? INT32_MIN : offset);
+    syncHops = masterHops + 1;
+    syncLastHeard = millis();
+    // Synced, and a source for our own neighbours, only with a drift fit: the slope of a clock
+    // that is still converging would be learnt by every node below it
+    bool first = fitted && !synced;
+    if (fitted) synced = true;
+    portEXIT_CRITICAL(&syncMux);
+
+    if (first || stepped) {
+        MESH_LOGI(ENOWMESH_LOG_HELLO, "[SYNC] Clock %s by %s, %u hops from a MASTER (off by %lld us)\n",
+                  first ? "synced" : "set", macToStr(mac).c_str(), (unsigned)(masterHops + 1), (long long)offset);
+        if (first) resetHelloTimer();   // Nodes below wait for our HELLOs to sync
+    } else {
+        MESH_LOGT(ENOWMESH_LOG_HELLO, "[SYNC] Timestamp from %s off by %lld us, drift %ld ppb\n", macToStr(mac).c_str(),
+                  (long long)offset, (long)syncDriftPpb);
+    }
+}
+
+// ----- Clock Fit -----
+// Least squares over (local, mesh - local), x relative to the newest pair: the slope is the drift
+// once the pairs span SYNC_DRIFT_SPAN_MS, the line at x = 0 the offset. A pair whose send report or
+// reception was handled late sits off the line alone, so pairs further off the first fit than
+// SYNC_OUTLIER_US and three times the median are left out of a second one
+bool ENowMesh::fitSyncLocked() {
+    size_t n = syncSampleCount;
+    int64_t last = syncSamples[(syncSampleNext + SYNC_SAMPLES - 1) % SYNC_SAMPLES].localUs;
+    bool keep[SYNC_SAMPLES];
+    for (size_t k = 0; k < n; ++k) keep[k] = true;
+
+    int64_t drift = syncDriftPpb, mx = 0, my = 0;
+    bool fitted = false;
+    for (int pass = 0; pass < 2; ++pass) {
+        int64_t sx = 0, sy = 0, first = last;
+        size_t m = 0;
+        for (size_t k = 0; k < n; ++k) {
+            if (!keep[k]) continue;
+            sx += syncSamples[k].localUs - last;
+            sy += syncSamples[k].meshUs - syncSamples[k].localUs;
+            if (syncSamples[k].localUs < first) first = syncSamples[k].localUs;
+            m++;
+        }
+        mx = sx / (int64_t)m;
+        my = sy / (int64_t)m;
+        fitted = last - first >= (int64_t)SYNC_DRIFT_SPAN_MS * 1000;
+        if (fitted) {
+            int64_t sxx = 0, sxy = 0;
+            for (size_t k = 0; k < n; ++k) {
+                if (!keep[k]) continue;
+                int64_t dx = syncSamples[k].localUs - last - mx;
+                sxx += dx * dx;
+                sxy += dx * (syncSamples[k].meshUs - syncSamples[k].localUs - my);
+            }
+            drift = sxy / (sxx / 1000000000);   // sxx >= SYNC_DRIFT_SPAN_MS^2 / 2; sxy x 1e9 would overflow
+            if (drift > SYNC_DRIFT_MAX_PPB) drift = SYNC_DRIFT_MAX_PPB;
+            if (drift < -SYNC_DRIFT_MAX_PPB) drift = -SYNC_DRIFT_MAX_PPB;
+        }
+        if (pass == 1 || n < 3) break;
+
+        int64_t res[SYNC_SAMPLES], sorted[SYNC_SAMPLES];
+        for (size_t k = 0; k < n; ++k) {
+            int64_t dx = syncSamples[k].localUs - last - mx;
+            res[k] = syncSamples[k].meshUs - syncSamples[k].localUs - my - dx * drift / 1000000000;
+            if (res[k] < 0) res[k] = -res[k];
+            size_t j = k;
+            for (; j > 0 && sorted[j - 1] > res[k]; --j) sorted[j] = sorted[j - 1];
+            sorted[j] = res[k];
+        }
+        int64_t limit = 3 * sorted[n / 2];
+        if (limit < (int64_t)SYNC_OUTLIER_US) limit = SYNC_OUTLIER_US;
+        size_t dropped = 0;
+        for (size_t k = 0; k < n; ++k) {
+            if (res[k] > limit) {
+                keep[k] = false;
+                dropped++;
+            }
+        }
+        if (dropped == 0) break;
+        syncOutliers += dropped;
+    }
+
+    if (fitted) syncDriftPpb = (int32_t)drift;
+    syncRefLocal = last;
+    syncRefMesh = last + my - mx * syncDriftPpb / 1000000000;
+    return fitted;
+}
+
+// An uplink that stops beaconing leaves the clock free-running on its drift estimate
+void ENowMesh::serviceSync(uint32_t now) {
+    if (!synced) return;
+    portENTER_CRITICAL(&syncMux);
+    bool lost = synced && now - syncLastHeard > peerTimeout;
+    if (lost) {
+        synced = false;
+        syncHops = MASTER_HOPS_NONE;
+    }
+    portEXIT_CRITICAL(&syncMux);
+    if (lost) MESH_LOGI(ENOWMESH_LOG_HELLO, "[SYNC] No stamp from an uplink for %u ms - clock free-running\n", (unsigned)peerTimeout);
+}
+
+// ----- Slot Choice -----
+// A random slot that neither a neighbour nor any node it hears advertises; with none left,
+// any other slot than the current one
+void ENowMesh::pickSlot() {
+    if (!tdmaSlots || !isTimeSynced()) return;
+    uint8_t n = slotCount();
+    if (tdmaSlot < n && !tdmaRepick) return;
+
+    uint32_t busy = 0;
+    portENTER_CRITICAL(&peersMux);
+    for (int i : peerIndex.used) {
+        if (peers[i].slot < TDMA_MAX_SLOTS) busy |= 1u << peers[i].slot;
+        busy |= peers[i].slotsHeard;
+    }
+    portEXIT_CRITICAL(&peersMux);
+
+    uint8_t options[TDMA_MAX_SLOTS];
+    size_t k = 0;
+    for (uint8_t i = 0; i < n; ++i) if (!((busy >> i) & 1)) options[k++] = i;
+    if (k == 0) for (uint8_t i = 0; i < n; ++i) if (i != tdmaSlot) options[k++] = i;
+    uint8_t slot = k ? options[random((long)k)] : 0;
+
+    portENTER_CRITICAL(&syncMux);
+    uint8_t old = tdmaSlot;
+    tdmaSlot = slot;
+    tdmaRepick = false;
+    tdmaPickedAt = millis();
+    if (old != TDMA_SLOT_NONE) tdmaSlotChanges++;
+    portEXIT_CRITICAL(&syncMux);
+    MESH_LOGI(ENOWMESH_LOG_TX, "[TDMA] Slot %u of %u (%u free)\n", (unsigned)slot, (unsigned)n, (unsigned)k);
+}
+
+// ----- Slot Gate -----
+uint8_t ENowMesh::activeSlot(int64_t *meshUs) {
+    if (!tdmaSlots || !slotTimer || txMaxInFlight == 0 || tdmaSlotMs * 1000u <= 2 * TDMA_GUARD_US) return TDMA_SLOT_NONE;
+    int64_t local = esp_timer_get_time();
+    portENTER_CRITICAL(&syncMux);
+    bool on = (role == ROLE_MASTER || synced) && tdmaSlot < slotCount();
+    uint8_t slot = tdmaSlot;
+    *meshUs = meshTimeAtLocked(local);
+    portEXIT_CRITICAL(&syncMux);
+    return on ? slot : TDMA_SLOT_NONE;
+}
+
+// The frame, and those already with the driver, must end on air before the slot's guard time
+uint32_t ENowMesh::slotWaitUs(int64_t meshUs, uint8_t slot, size_t len, uint8_t inFlight) {
+    uint64_t slotUs = (uint64_t)tdmaSlotMs * 1000;
+    uint64_t frameUs = slotUs * slotCount();
+    uint64_t pos = (uint64_t)meshUs % frameUs;
+    uint64_t open = slot * slotUs + TDMA_GUARD_US;
+    uint64_t close = (slot + 1) * slotUs - TDMA_GUARD_US;
+    uint64_t need = (uint64_t)airtimeUs(len) * (inFlight + 1);
+    if (need > close - open) need = close - open;   // Slot too short for the burst: one frame at its start
+    if (pos >= open && pos + need <= close) return 0;
+    uint64_t wait = (open + frameUs - pos) % frameUs;
+    return (uint32_t)(wait ? wait : frameUs);
+}
+
+void ENowMesh::armSlotTimer(uint32_t waitUs) {
+    if (!slotTimer) return;
+    esp_timer_stop(slotTimer);   // ESP_ERR_INVALID_STATE when not running
+    esp_timer_start_once(slotTimer, waitUs);
+}
+
+void ENowMesh::slotTimerCb(void *arg) {
+    static_cast<ENowMesh*>(arg)->txPump();
+}
+
+// =======================================
+// ===== FRAGMENTATION ===
+// =======================================
+// Payloads over maxPayload are split into up to FRAG_MAX_FRAGMENTS CTRL_FRAGMENT frames.
+// Each fragment is an ordinary frame with its own seq, so ACKs, retransmission and
+// duplicate detection work per fragment: only lost fragments are resent. The sender
+// keeps at most fragWindow fragments of a transfer unACKed; each ACK clocks out the
+// next one straight from handleAck() instead of waiting for checkPendingMessages(),
+// which only reports the whole message once through the send callback. Receivers
+// reassemble into FRAG_RX_SLOTS static buffers; a slot idle for fragTimeout may be
+// taken over by a new message.
+
+static inline uint64_t fragMask(uint8_t count) {
+    return count >= 64 ? ~0ull : (1ull << count) - 1;
+}
+
+// ----- Start Sending A Large Message -----
+esp_err_t ENowMesh::startTransfer(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type) {
+    if (FRAG_TX_SLOTS == 0) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: message too long (%u > maxPayload, built with ENOWMESH_FRAG_SLOTS=0)\n", (unsigned)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (len > FRAG_MAX_MESSAGE_SIZE) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: message too long (%u > FRAG_MAX_MESSAGE_SIZE %u)\n", (unsigned)len, (unsigned)FRAG_MAX_MESSAGE_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t frameMax = maxPayload;
+    if (frameMax > 255) frameMax = 255;
+    if (frameMax > ESP_NOW_MAX_IE_DATA_LEN - sizeof(packet_hdr_t)) frameMax = ESP_NOW_MAX_IE_DATA_LEN - sizeof(packet_hdr_t);
+    size_t chunkMax = frameMax > FRAG_OVERHEAD ? frameMax - FRAG_OVERHEAD : 0;
+    size_t count = chunkMax ? (len + chunkMax - 1) / chunkMax : 0;
+    if (count == 0 || count > FRAG_MAX_FRAGMENTS) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: %u bytes need more than %u fragments at maxPayload %u\n",
+                     (unsigned)len, (unsigned)FRAG_MAX_FRAGMENTS, (unsigned)maxPayload);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Never wait: with RX_INLINE this can run in the Wi-Fi task (a send from the message callback),
+    // which must not spin on a lock held by a task it preempted. The holder is done in a moment
+    if (fragTxBusy.exchange(true, std::memory_order_acquire)) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: fragmented sends being serviced, try again\n");
+        return ESP_ERR_NO_MEM;
+    }
+
+    int slot = -1;
+    for (size_t i = 0; i < FRAG_TX_SLOTS; i++) {
+        if (fragTx[i].state == FRAG_FREE) { slot = (int)i; break; }
+    }
+    if (slot < 0) {
+        fragTxBusy.store(false, std::memory_order_release);
+        MESH_LOGE(ENOWMESH_LOG_TX, "sendBytes: all %u fragmented sends busy\n", (unsigned)FRAG_TX_SLOTS);
+        return ESP_ERR_NO_MEM;
+    }
+
+    FragTx &t = fragTx[slot];
+    if (dest_mac) memcpy(t.dest_mac, dest_mac, 6);
+    else memset(t.dest_mac, 0xFF, 6);
+    t.unicast = dest_mac != nullptr;
+    t.acked = dest_mac && !(msg_type & MSG_TYPE_NO_ACK);
+    t.msg_type = (msg_type & ~MSG_TYPE_RETRANSMIT) | MSG_TYPE_CONTROL;
+    t.msgId = fragMsgCounter++;
+    t.totalLen = (uint16_t)len;
+    t.count = (uint8_t)count;
+    t.nextIndex = 0;
+    t.inFlight = 0;
+    t.attempts = 0;
+    t.startTime = millis();
+    t.done = 0;
+    memcpy(t.data, data, len);
+    t.state = FRAG_SENDING;
+
+    MESH_LOGT(ENOWMESH_LOG_TX, "[FRAG] msg %u: %u bytes in %u fragments to %s\n", (unsigned)t.msgId, (unsigned)len,
+                 (unsigned)count, dest_mac ? macToStr(dest_mac).c_str() : "broadcast");
+
+    // The first fragment must go out now so getLastSeq() names the transfer
+    esp_err_t r = pumpTransfer(slot);
+    if (t.nextIndex == 0) {
+        t.state = FRAG_FREE;
+        if (r == ESP_OK) r = ESP_ERR_NO_MEM;
+    } else {
+        lastSeq = t.firstSeq;
+        r = ESP_OK;
+    }
+    fragTxBusy.store(false, std::memory_order_release);
+    return r;
+}
+
+// ----- Send The Next Fragments Of One Transfer -----
+esp_err_t ENowMesh::pumpTransfer(int slot) {
+    if (FRAG_TX_SLOTS == 0) return ESP_ERR_INVALID_STATE;
+    FragTx &t = fragTx[slot];
+    size_t chunk = (t.totalLen + t.count - 1) / t.count;
+    size_t sentNow = 0;
+
+    // ACKed transfers are limited by fragments in flight, fire-and-forget ones by fragments per call
+    while (t.state == FRAG_SENDING && t.nextIndex < t.count && (t.acked ? t.inFlight : sentNow) < fragWindow) {
+        FragmentHeader fh;
+        fh.msgId = t.msgId;
+        fh.totalLen = t.totalLen;
+        fh.index = t.nextIndex;
+        fh.count = t.count;
+        size_t off = (size_t)t.nextIndex * chunk;
+        size_t n = t.totalLen - off < chunk ? t.totalLen - off : chunk;
+
+        uint16_t seq = nextSeq(seqAcked(t.unicast ? t.dest_mac : nullptr, t.msg_type));
+        esp_err_t r = sendFrame(t.unicast ? t.dest_mac : nullptr, t.msg_type, seq, t.data + off, n, t.acked ? slot : -1, &fh);
+        if (r == ESP_ERR_NO_MEM || r == ESP_ERR_ESPNOW_NO_MEM) return r;  // Pending table, pool or driver queue full: next pump
+        if (r != ESP_OK) {
+            MESH_LOGI(ENOWMESH_LOG_TX, "[FRAG] msg %u fragment %u/%u not sent: %d\n", (unsigned)t.msgId, (unsigned)fh.index + 1, (unsigned)t.count, (int)r);
+            endTransfer(slot, false);
+            return r;
+        }
+
+        if (t.nextIndex == 0) t.firstSeq = seq;
+        t.nextIndex++;
+        sentNow++;
+        if (t.acked) t.inFlight++;
+        else t.done |= 1ull << fh.index;
+    }
+
+    // Fire-and-forget transfers are finished once every fragment is out
+    if (t.state == FRAG_SENDING && !t.acked && t.nextIndex == t.count) t.state = FRAG_FREE;
+    return ESP_OK;
+}
+
+// ----- Advance Outgoing Transfers -----
+// Called from checkPendingMessages() and from handleAck(). fragTxBusy keeps the two contexts
+// out of fragTx at the same time; whoever finds it taken leaves the work to the holder.
+void ENowMesh::serviceTransfers() {
+    if (fragTxBusy.exchange(true, std::memory_order_acquire)) return;
+
+    // The lock is dropped between slots, so each one's state is checked again under it
+    for (int i : pendingUsed) {
+        int slot = -1;
+        uint16_t msgId = 0;
+        uint8_t index = 0;
+        uint8_t attempts = 0;
+        bool delivered = false;
 
-    if (hdr.msg_type & (MSG_TYPE_TO_MASTER | MSG_TYPE_TO_REPEATER)) {
-        // Handle MSG_TYPE_TO_MASTER (anycast - first master processes and drops)
-        if (hdr.msg_type & MSG_TYPE_TO_MASTER) {
-            if (m->getRole() == ROLE_MASTER) {
-                Serial.println("[ROLE FILTER] Packet for MASTER - I am master, processing");
-                // shouldForward stays false - master consumes the packet
-            } else {
-                isRoleFiltered = true;  // Don't process, just forward
-                Serial.println("[ROLE FILTER] Packet for MASTER - forwarding only");
-            }
-        }
-        
-        // Handle MSG_TYPE_TO_REPEATER (multicast - all repeaters process and forward)
-        if (hdr.msg_type & MSG_TYPE_TO_REPEATER) {
-            if (m->getRole() == ROLE_REPEATER) {
-                shouldForward = true;  // Forward to reach other repeaters
-                isRoleFiltered = false;  // Explicitly allow processing
-                Serial.println("[ROLE FILTER] Packet for REPEATER - I am repeater, processing and forwarding");
-            } else {
-                isRoleFiltered = true;  // Don't process, just forward
-                Serial.println("[ROLE FILTER] Packet for REPEATER - forwarding only");
-            }
+        portENTER_CRITICAL(&pendingMux);
+        PendingMessage &p = pendingMessages[i];
+        if (p.fragSlot >= 0 && (p.state == PENDING_DELIVERED || p.state == PENDING_FAILED)) {
+            slot = p.fragSlot;
+            msgId = p.fragMsgId;
+            index = p.fragIndex;
+            attempts = p.retryCount + 1;
+            delivered = p.state == PENDING_DELIVERED;
+            setPendingStateLocked(i, PENDING_FREE);
         }
+        portEXIT_CRITICAL(&pendingMux);
+
+        if (slot >= 0) finishFragment(slot, msgId, index, delivered, attempts);
     }
 
-    // === PACKET FOR THIS NODE ===
-    // Only process if:
-    // 1. Addressed to me specifically (unicast), OR
-    // 2. Broadcast AND (not role-filtered OR I match the role filter)
-    bool isUnicastForMe = (memcmp(hdr.dest_mac, myMacStatic, 6) == 0);
-    bool isBroadcast = true;
-    for (int i = 0; i < 6; i++) {
-        if (hdr.dest_mac[i] != 0xFF) {
-            isBroadcast = false;
-            break;
-        }
+    for (size_t i = 0; i < FRAG_TX_SLOTS; i++) {
+        if (fragTx[i].state == FRAG_SENDING) pumpTransfer((int)i);
     }
-    
-    if (isUnicastForMe || (isBroadcast && !isRoleFiltered)) {
-        Serial.printf("[%s] Packet for me (seq=%u) from immediate=%s original_src=%s hop_count=%u payload_len=%u\n", m->getRoleName(), (unsigned)hdr.seq, m->macToStr(mac_addr).c_str(), m->macToStr(hdr.src_mac).c_str(), (unsigned)hdr.hop_count, (unsigned)hdr.payload_len);
 
-        if (hdr.payload_len > 0) {
-            const uint8_t *pl = incomingData + sizeof(packet_hdr_t);
+    fragTxBusy.store(false, std::memory_order_release);
+}
 
-            // Check for ACK packet using MSG_TYPE_ACK flag
-            if (hdr.msg_type & MSG_TYPE_ACK) {
-                // Extract acknowledged sequence number from payload
-                char tmp[16];
-                size_t copyLen = (hdr.payload_len < 15) ? hdr.payload_len : 15;
-                memcpy(tmp, pl, copyLen);
-                tmp[copyLen] = '\0';
-                uint16_t ack_seq = (uint16_t)atoi(tmp);
-                
-                Serial.printf("[ACK RECEIVED] from %s acknowledging seq=%u\n", m->macToStr(hdr.src_mac).c_str(), (unsigned)ack_seq);
-                
-                // Clear from pending messages
-                portENTER_CRITICAL(&pendingMux);
-                for (size_t i = 0; i < instance->maxPendingMessages; i++) {
-                    if (pendingMessages[i].waiting && pendingMessages[i].seq == ack_seq && memcmp(pendingMessages[i].dest_mac, hdr.src_mac, 6) == 0) {
-                        pendingMessages[i].waiting = false;
-                        Serial.printf("[MSG CONFIRMED] seq=%u delivered successfully\n", ack_seq);
-                        break;
-                    }
-                }
-                portEXIT_CRITICAL(&pendingMux);
-                
-                return;  // ACK consumed
-            }
+// ----- Fragment Delivered Or Given Up -----
+void ENowMesh::finishFragment(int slot, uint16_t msgId, uint8_t index, bool delivered, uint8_t attempts) {
+    if (slot < 0 || slot >= (int)FRAG_TX_SLOTS) return;
+    FragTx &t = fragTx[slot];
+    if (t.state != FRAG_SENDING || t.msgId != msgId) return;  // Transfer already ended
 
-            // Print payload and call user callback
-            char *tmp = (char*)malloc(hdr.payload_len + 1);
-            if (tmp) {
-                memcpy(tmp, pl, hdr.payload_len);
-                tmp[hdr.payload_len] = '\0';
-                Serial.printf("Payload: %s\n", tmp);
+    if (t.inFlight) t.inFlight--;
+    t.attempts += attempts;
+    if (!delivered) {
+        MESH_LOGI(ENOWMESH_LOG_TX, "[FRAG] msg %u fragment %u/%u to %s failed\n", (unsigned)msgId, (unsigned)index + 1,
+                     (unsigned)t.count, macToStr(t.dest_mac).c_str());
+        endTransfer(slot, false);
+        return;
+    }
 
-                // Call user callback if set
-                if (m->userCallback) {
-                    m->userCallback(hdr.src_mac, tmp, hdr.payload_len);
-                }
-                
-                free(tmp);
-            }
-        }
+    t.done |= 1ull << index;
+    if (t.done == fragMask(t.count)) endTransfer(slot, true);
+}
 
-        // Send ACK back to original sender (only if MSG_TYPE_NO_ACK is not set)
-        if (!(hdr.msg_type & MSG_TYPE_NO_ACK)) {
-            char ackPayload[8];
-            snprintf(ackPayload, sizeof(ackPayload), "%u", hdr.seq);
-            m->sendData(ackPayload, hdr.src_mac, MSG_TYPE_ACK | MSG_TYPE_NO_ACK);
-            Serial.printf("ACK sent to %s for seq=%u\n", m->macToStr(hdr.src_mac).c_str(), (unsigned)hdr.seq);
+// ----- End A Transfer -----
+void ENowMesh::endTransfer(int slot, bool delivered) {
+    if (FRAG_TX_SLOTS == 0) return;
+    FragTx &t = fragTx[slot];
+
+    // A failed message is not completed: stop retrying its other fragments
+    if (!delivered) {
+        portENTER_CRITICAL(&pendingMux);
+        for (int i : pendingUsed) {
+            PendingMessage &p = pendingMessages[i];
+            if (p.fragSlot == slot && p.fragMsgId == t.msgId) setPendingStateLocked(i, PENDING_FREE);
         }
-        
-        if (!shouldForward) return;  // Packet consumed - don't forward it
+        portEXIT_CRITICAL(&pendingMux);
     }
 
-    // === FORWARDING LOGIC ===    
-    // Check if packet should not be forwarded
-    if (hdr.msg_type & MSG_TYPE_NO_FORWARD) {
-        Serial.println("Packet has NO_FORWARD flag - not forwarding.");
+    // Nothing to report for fire-and-forget sends, or when sendBytes() itself returns the error
+    if (!t.acked || t.nextIndex == 0) {
+        t.state = FRAG_FREE;
         return;
     }
+    t.delivered = delivered;
+    t.rttMs = delivered ? millis() - t.startTime : 0;
+    t.state = FRAG_DONE;
+}
 
-    // Check hop limit
-    if (hdr.hop_count >= m->maxHops) {
-        Serial.println("Max hops reached. Dropping packet.");
+// ----- Report Ended Transfers (from checkPendingMessages) -----
+void ENowMesh::reportTransfers() {
+    if (fragTxBusy.exchange(true, std::memory_order_acquire)) return;  // Picked up on the next call
+
+    for (size_t i = 0; i < FRAG_TX_SLOTS; i++) {
+        FragTx &t = fragTx[i];
+        if (t.state != FRAG_DONE) continue;
+
+        SendResult result;
+        memcpy(result.dest_mac, t.dest_mac, 6);
+        result.seq = t.firstSeq;
+        result.delivered = t.delivered;
+        result.attempts = t.attempts > 0xFF ? 0xFF : (uint8_t)t.attempts;
+        result.rttMs = t.rttMs;
+        t.state = FRAG_FREE;
+
+        MESH_LOGT(ENOWMESH_LOG_TX, "[FRAG] msg %u (%u bytes) to %s %s after %u transmissions, %u ms\n", (unsigned)t.msgId, (unsigned)t.totalLen,
+                     macToStr(t.dest_mac).c_str(), result.delivered ? "delivered" : "FAILED", (unsigned)t.attempts, (unsigned)result.rttMs);
+        if (sendCallback) sendCallback(result);
+    }
+
+    fragTxBusy.store(false, std::memory_order_release);
+}
+
+// ----- Reassembly Slot Check (before duplicate detection) -----
+// True unless payload is a fragment of a new message and every slot is busy with a live one
+bool ENowMesh::fragmentFits(const uint8_t *src_mac, const uint8_t *payload, size_t len) {
+    FragmentHeader fh;
+    if (len < FRAG_OVERHEAD || payload[0] != CTRL_FRAGMENT) return true;
+    memcpy(&fh, payload + 1, sizeof(fh));
+
+    uint32_t now = millis();
+    for (size_t i = 0; i < FRAG_RX_SLOTS; i++) {
+        const FragRx &r = fragRx[i];
+        if (!r.active || now - r.lastTime >= fragTimeout) return true;
+        if (r.msgId == fh.msgId && memcmp(r.src_mac, src_mac, 6) == 0) return true;
+    }
+    MESH_LOGI(ENOWMESH_LOG_RX, "Reassembly slots full - fragment of msg %u from %s not ACKed\n", (unsigned)fh.msgId, macToStr(src_mac).c_str());
+    return false;
+}
+
+// ----- Store A Received Fragment -----
+void ENowMesh::handleFragment(const RxInfo &rx, const uint8_t *payload, size_t len) {
+    FragmentHeader fh;
+    if (len < sizeof(fh)) {
+        countStat(STAT_SIZE_DROPS);
         return;
     }
+    memcpy(&fh, payload, sizeof(fh));  // Payload is unaligned
+    const uint8_t *data = payload + sizeof(fh);
+    size_t n = len - sizeof(fh);
 
-    // Hop count management with proper struct casting
-    size_t fwdLen = sizeof(packet_hdr_t) + hdr.payload_len;
-    uint8_t *fwdBuf = (uint8_t*)malloc(fwdLen);
-    
-    // Memory safety check
-    if (!fwdBuf) {
-        Serial.println("Memory allocation failed!");
+    // Every fragment must sit exactly where its index puts it
+    size_t chunk = fh.count ? (fh.totalLen + fh.count - 1) / fh.count : 0;
+    size_t off = (size_t)fh.index * chunk;
+    if (fh.count == 0 || fh.count > FRAG_MAX_FRAGMENTS || fh.index >= fh.count || fh.totalLen == 0 ||
+        fh.totalLen > FRAG_MAX_MESSAGE_SIZE || off >= fh.totalLen ||
+        n != (fh.index == fh.count - 1 ? fh.totalLen - off : chunk)) {
+        MESH_LOGI(ENOWMESH_LOG_RX, "Malformed fragment from %s. ignoring.\n", macToStr(rx.src_mac).c_str());
+        countStat(STAT_SIZE_DROPS);
         return;
     }
 
-    memcpy(fwdBuf, incomingData, fwdLen);
-    packet_hdr_t *fwd_hdr = (packet_hdr_t*)fwdBuf;
-    fwd_hdr->hop_count = hdr.hop_count + 1;
+    uint32_t now = millis();
+    int slot = -1;
+    int spare = -1;
+    for (size_t i = 0; i < FRAG_RX_SLOTS; i++) {
+        FragRx &r = fragRx[i];
+        if (r.active && r.msgId == fh.msgId && memcmp(r.src_mac, rx.src_mac, 6) == 0) { slot = (int)i; break; }
+        if (spare < 0 && (!r.active || now - r.lastTime >= fragTimeout)) spare = (int)i;
+    }
 
-    // If this node is a LEAF, do not forward the packet.
-    if (m->getRole() == ENowMesh::ROLE_LEAF) {
-        Serial.println("Role is LEAF – not forwarding packet.");
-        free(fwdBuf);
+    if (slot < 0) {
+        if (spare < 0) {
+            MESH_LOGI(ENOWMESH_LOG_RX, "Reassembly slots full - broadcast fragment of msg %u from %s lost\n", (unsigned)fh.msgId, macToStr(rx.src_mac).c_str());
+            return;
+        }
+        slot = spare;
+        FragRx &r = fragRx[slot];
+        if (r.active) {
+            MESH_LOGI(ENOWMESH_LOG_RX, "Reassembly of msg %u from %s timed out (%u/%u fragments)\n", (unsigned)r.msgId,
+                         macToStr(r.src_mac).c_str(), (unsigned)r.received, (unsigned)r.count);
+        }
+        memcpy(r.src_mac, rx.src_mac, 6);
+        r.msgId = fh.msgId;
+        r.totalLen = fh.totalLen;
+        r.count = fh.count;
+        r.received = 0;
+        r.have = 0;
+        r.active = true;
+    }
+
+    FragRx &r = fragRx[slot];
+    if (r.totalLen != fh.totalLen || r.count != fh.count) {
+        MESH_LOGI(ENOWMESH_LOG_RX, "Fragment of msg %u from %s does not match its message. ignoring.\n", (unsigned)fh.msgId, macToStr(rx.src_mac).c_str());
+        countStat(STAT_SIZE_DROPS);
         return;
     }
 
-    if (isBroadcast) {
-        // Always flood broadcasts
-        m->forwardToPeersExcept(mac_addr, fwdBuf, fwdLen);
-        Serial.printf("Flooded broadcast packet (src %s) hop->%u\n", m->macToStr(hdr.src_mac).c_str(), fwd_hdr->hop_count);
+    if (!(r.have & (1ull << fh.index))) {
+        memcpy(r.data + off, data, n);
+        r.have |= 1ull << fh.index;
+        r.received++;
+    }
+    r.lastTime = now;
+    MESH_LOGT(ENOWMESH_LOG_RX, "[FRAG] msg %u from %s: fragment %u/%u (%u held)\n", (unsigned)fh.msgId,
+                 macToStr(rx.src_mac).c_str(), (unsigned)fh.index + 1, (unsigned)fh.count, (unsigned)r.received);
+
+    if (r.received == r.count) {
+        RxInfo whole = rx;
+        whole.msg_type = rx.msg_type & ~(MSG_TYPE_CONTROL | MSG_TYPE_RETRANSMIT);
+        r.data[r.totalLen] = '\0';
+        deliverPayload(whole, r.data, r.totalLen, (char*)r.data);
+        r.active = false;
+    }
+}
+
+// =======================================
+// ===== AGGREGATION ===
+// =======================================
+// With aggregateDelayMs set, small messages are not sent right away but appended to a
+// CTRL_BUNDLE frame per final destination and msg_type: [CTRL_BUNDLE] then one
+// [len][bytes] record per message. Keying on the final destination rather than the
+// next hop lets relays forward bundles untouched, and the whole bundle travels as one
+// ordinary frame: one seq, one ACK, one retransmission and one SendResult. A bundle is
+// sent when the next message would not fit, when it reaches aggregateFlushBytes, or
+// from checkPendingMessages() once its oldest record is aggregateDelayMs old.
+
+// ----- Bundle Size -----
+// Bytes one bundle may carry, kind byte included
+size_t ENowMesh::bundleCapacity() const {
+    size_t cap = ESP_NOW_MAX_IE_DATA_LEN - sizeof(packet_hdr_t);
+    if (cap > 255) cap = 255;
+    return maxPayload < cap ? maxPayload : cap;
+}
+
+// ----- Queue A Small Message -----
+// Callers make sure it fits: 2 + len <= bundleCapacity()
+esp_err_t ENowMesh::aggregate(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type) {
+    size_t cap = bundleCapacity();
+    static const uint8_t broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    const uint8_t *key = dest_mac ? dest_mac : broadcastMac;
+    msg_type &= ~MSG_TYPE_RETRANSMIT;
+    uint32_t now = millis();
+
+    // Bundles pushed out by this message are copied and sent once the lock is released
+    AggBundle out[2];
+    size_t outCount = 0;
+
+    portENTER_CRITICAL(&aggMux);
+    int slot = -1;
+    int freeSlot = -1;
+    int oldest = -1;
+    for (size_t i = 0; i < AGG_QUEUE_SIZE; ++i) {
+        AggBundle &b = aggQueue[i];
+        if (!b.valid) {
+            if (freeSlot < 0) freeSlot = (int)i;
+            continue;
+        }
+        if (b.msg_type == msg_type && memcmp(b.dest_mac, key, 6) == 0) slot = (int)i;
+        if (oldest < 0 || (int32_t)(b.firstTime - aggQueue[oldest].firstTime) < 0) oldest = (int)i;
+    }
+
+    if (slot >= 0 && aggQueue[slot].len + 1 + len > cap) {
+        out[outCount++] = aggQueue[slot];   // Full: send it, start a new one in its place
+        aggQueue[slot].valid = false;
+        freeSlot = slot;
+        slot = -1;
+    }
+    if (slot < 0) {
+        if (freeSlot < 0) {
+            out[outCount++] = aggQueue[oldest];   // Every slot busy: send the oldest early
+            freeSlot = oldest;
+        }
+        slot = freeSlot;
+        AggBundle &b = aggQueue[slot];
+        memcpy(b.dest_mac, key, 6);
+        b.msg_type = msg_type;
+        b.seq = nextSeq(seqAcked(key, msg_type));
+        b.firstTime = now;
+        b.count = 0;
+        b.data[0] = CTRL_BUNDLE;
+        b.len = 1;
+        b.valid = true;
+    }
+
+    AggBundle &b = aggQueue[slot];
+    b.data[b.len] = (uint8_t)len;
+    memcpy(b.data + b.len + 1, data, len);
+    b.len += (uint8_t)(1 + len);
+    b.count++;
+    lastSeq = b.seq;
+    if (aggregateFlushBytes && b.len - 1 >= aggregateFlushBytes) {
+        out[outCount++] = b;
+        b.valid = false;
+    }
+    portEXIT_CRITICAL(&aggMux);
+
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < outCount; ++i) {
+        esp_err_t r = sendBundle(out[i]);
+        if (r != ESP_OK) result = r;
+    }
+    return result;
+}
+
+// ----- Send Bundles -----
+// A bundle holding a single message goes out as that plain message, under the bundle's seq
+esp_err_t ENowMesh::sendBundle(const AggBundle &b) {
+    bool broadcast = b.dest_mac[0] == 0xFF && memcmp(b.dest_mac, b.dest_mac + 1, 5) == 0;
+    const uint8_t *dest = broadcast ? nullptr : b.dest_mac;
+    esp_err_t r;
+    if (b.count == 1)
+        r = sendFrame(dest, b.msg_type, b.seq, b.data + 2, b.len - 2);
+    else
+        r = sendFrame(dest, b.msg_type | MSG_TYPE_CONTROL, b.seq, b.data, b.len);
+
+    if (r != ESP_OK) {
+        MESH_LOGE(ENOWMESH_LOG_TX, "Bundle seq=%u of %u message(s) not sent: %d\n", (unsigned)b.seq, (unsigned)b.count, (int)r);
     } else {
-        // Try direct send to destination if it's a known peer
-        int peerIndex = m->findPeer(hdr.dest_mac);
-        if (peerIndex >= 0) {
-            esp_err_t r = esp_now_send(ENowMesh::peersStatic[peerIndex].mac, fwdBuf, fwdLen);
-            if (r == ESP_OK) {
-                Serial.printf("Forwarded directly to %s (src %s dest %s) hop->%u\n", 
-                             m->macToStr(ENowMesh::peersStatic[peerIndex].mac).c_str(), 
-                             m->macToStr(hdr.src_mac).c_str(), m->macToStr(hdr.dest_mac).c_str(), 
-                             fwd_hdr->hop_count);
-                free(fwdBuf);
-                return;  // Success - don't also flood
-            }
-            // Only flood if direct send failed
-            Serial.printf("Direct send to %s failed (%d), falling back to flood.\n", m->macToStr(hdr.dest_mac).c_str(), r);
+        MESH_LOGT(ENOWMESH_LOG_TX, "[BUNDLE] seq=%u | %u message(s) | %u bytes\n", (unsigned)b.seq, (unsigned)b.count, (unsigned)b.len);
+    }
+    return r;
+}
+
+// The seq was taken when the bundle opened; a bundle is also sent once half the duplicate
+// window has passed since, or receivers would take it for a replay of an old frame
+void ENowMesh::flushBundles(uint32_t now, bool all) {
+    for (size_t i = 0; i < AGG_QUEUE_SIZE; ++i) {
+        AggBundle out;
+        bool send = false;
+        portENTER_CRITICAL(&aggMux);
+        AggBundle &b = aggQueue[i];
+        uint16_t seqNow = (seqAcked(b.dest_mac, b.msg_type) ? ackedSeqCounter : seqCounter).load(std::memory_order_relaxed);
+        if (b.valid && (all || now - b.firstTime >= aggregateDelayMs || (uint16_t)(seqNow - b.seq) >= ACK_BITMAP_BITS / 2)) {
+            out = b;
+            b.valid = false;
+            send = true;
         }
-        
-        // Destination unknown or direct send failed – flood to peers
-        m->forwardToPeersExcept(mac_addr, fwdBuf, fwdLen);
-        Serial.printf("Flooded packet (src %s dest %s) hop->%u\n", 
-                     m->macToStr(hdr.src_mac).c_str(), m->macToStr(hdr.dest_mac).c_str(), 
-                     fwd_hdr->hop_count);
+        portEXIT_CRITICAL(&aggMux);
+        if (send) sendBundle(out);
+    }
+}
+
+void ENowMesh::flushAggregated() {
+    flushBundles(millis(), true);
+}
+
+// ----- Unpack A Received Bundle -----
+// Every record is delivered as its own message with the bundle's header info
+void ENowMesh::handleBundle(const RxInfo &rx, const uint8_t *payload, size_t len) {
+    RxInfo one = rx;
+    one.msg_type = rx.msg_type & ~(MSG_TYPE_CONTROL | MSG_TYPE_RETRANSMIT);
+    size_t off = 0;
+    while (off < len) {
+        size_t n = payload[off];
+        if (n == 0 || off + 1 + n > len) {
+            MESH_LOGI(ENOWMESH_LOG_RX, "Malformed bundle from %s at byte %u. ignoring rest.\n", macToStr(rx.src_mac).c_str(), (unsigned)off);
+            countStat(STAT_SIZE_DROPS);
+            return;
+        }
+        deliverPayload(one, payload + off + 1, n, nullptr);
+        off += 1 + n;
     }
+}
+
+// =======================================
+// ===== DUPLICATE DETECTION ===
+// =======================================
+// Every node numbers the frames it originates with a 16-bit counter, so duplicate
+// detection only needs, per source, the highest seq seen plus a bitmap of the
+// ACK_BITMAP_BITS before it (IPsec-style anti-replay window). Only ACKed unicasts are
+// retransmitted, so they are numbered by a counter of their own: HELLOs, broadcasts and
+// ACKs sent meanwhile can't push a retry out of the window. ACKed unicasts that do leave
+// it (32 newer ones from the same source) are kept exactly in lateSeen for
+// dupDetectWindowMs; any other frame further behind is stale and dropped. A new boot
+// epoch resets the source.
+
+// ----- Sequence Numbers -----
+uint16_t ENowMesh::nextSeq(bool acked) {
+    return (acked ? ackedSeqCounter : seqCounter).fetch_add(1, std::memory_order_relaxed);
+}
+
+// Receivers classify frames the same way, from the header
+bool ENowMesh::seqAcked(const uint8_t *dest_mac, uint8_t msg_type) {
+    return dest_mac && !(dest_mac[0] & 0x01) && !(msg_type & MSG_TYPE_NO_ACK);
+}
 
-    free(fwdBuf);
+void ENowMesh::resetSeenSources() {
+    portENTER_CRITICAL(&seenMux);
+    seenIndex.reset();
+    for (size_t i = 0; i < LATE_SEEN_SIZE; ++i) lateSeen[i].valid = false;
+    portEXIT_CRITICAL(&seenMux);
 }
 
-// ----- Duplicate Detection -----
-bool ENowMesh::isDuplicate(const uint8_t *src_mac, uint16_t seq) {
+// ----- Forget Silent Sources -----
+void ENowMesh::pruneSeenSources() {
     uint32_t now = millis();
-    
-    // Check if we've seen this packet recently
-    for (size_t i = 0; i < instance->dupDetectBufferSize; ++i) {
-        if (!seenPacketsStatic[i].valid) continue;
-        
-        // Remove old entries
-        if (now - seenPacketsStatic[i].timestamp > instance->dupDetectWindowMs) {
-            seenPacketsStatic[i].valid = false;
-            continue;
+    portENTER_CRITICAL(&seenMux);
+    for (int i : seenIndex.used) {
+        if (now - seenLastSeen[i] > dupDetectWindowMs) seenIndex.remove(i, seenMacs[0], 6);
+    }
+    portEXIT_CRITICAL(&seenMux);
+}
+
+// ----- Duplicate Check -----
+ENowMesh::SeenResult ENowMesh::checkSeen(const uint8_t *src_mac, uint8_t epoch, uint16_t seq, bool acked) {
+    uint32_t now = millis();
+    SeenResult seen = SEEN_NEW;
+
+    portENTER_CRITICAL(&seenMux);
+    int idx = seenIndex.find(src_mac, seenMacs[0], 6);
+    if (idx < 0) {
+        idx = seenIndex.insert(src_mac);
+        if (idx < 0) {
+            // Table full: reuse the least recently heard source
+            size_t oldest = 0;
+            for (size_t i = 1; i < DUP_SOURCE_TABLE_SIZE; ++i) {
+                if (now - seenLastSeen[i] > now - seenLastSeen[oldest]) oldest = i;
+            }
+            seenIndex.remove(oldest, seenMacs[0], 6);
+            idx = seenIndex.insert(src_mac);
         }
-        
-        // Check for duplicate
-        if (memcmp(seenPacketsStatic[i].src_mac, src_mac, 6) == 0 && seenPacketsStatic[i].seq == seq) {
-            return true;  // Duplicate found!
+        memcpy(seenMacs[idx], src_mac, 6);
+        seenSources[idx].epoch = epoch + 1;  // Forces the reset below
+    }
+
+    SeenSource &src = seenSources[idx];
+    if (src.epoch != epoch || now - seenLastSeen[idx] > dupDetectWindowMs) {
+        // New source, rebooted source, or silent long enough that nothing of its old traffic is in flight
+        src.epoch = epoch;
+        src.started = 0;
+    }
+    uint8_t sp = acked ? 1 : 0;
+    uint16_t &high = src.highSeq[sp];
+    uint32_t &window = src.window[sp];
+    if (!(src.started & (1u << sp))) {
+        src.started |= 1u << sp;
+        high = seq;
+        window = 0;
+    } else {
+        int16_t ahead = (int16_t)(seq - high);
+        if (ahead > 0) {
+            if (acked) {
+                // Seen ACKed unicasts about to leave the window: bit q of gone = high - q, which moves to bit ahead - 1 + q
+                uint64_t gone = ((uint64_t)window << 1) | 1u;
+                if (ahead <= (int16_t)ACK_BITMAP_BITS) gone = gone >> (ACK_BITMAP_BITS + 1 - ahead) << (ACK_BITMAP_BITS + 1 - ahead);
+                while (gone) {
+                    int q = __builtin_ctzll(gone);
+                    gone &= gone - 1;
+                    addLateSeenLocked(src_mac, epoch, (uint16_t)(high - q), now);
+                }
+            }
+            // Slide forward; the old highSeq becomes bit (ahead - 1)
+            if (ahead < (int16_t)ACK_BITMAP_BITS) window = (window << ahead) | (1u << (ahead - 1));
+            else if (ahead == (int16_t)ACK_BITMAP_BITS) window = 1u << (ahead - 1);
+            else window = 0;
+            high = seq;
+        } else if (ahead == 0) {
+            seen = SEEN_DUPLICATE;
+        } else {
+            uint16_t behind = (uint16_t)(-ahead);
+            if (behind > ACK_BITMAP_BITS) {
+                // A retransmission behind the window is told apart exactly; other frames can't be
+                if (!acked) seen = SEEN_STALE;
+                else if (checkLateSeenLocked(src_mac, epoch, seq, now)) seen = SEEN_DUPLICATE;
+            } else {
+                uint32_t bit = 1u << (behind - 1);
+                if (window & bit) seen = SEEN_DUPLICATE;
+                window |= bit;
+            }
         }
     }
-    
-    // Not a duplicate - record it with critical section protection
-    portENTER_CRITICAL(&seenPacketsMux);
-    
-    uint16_t writeIndex = seenPacketsIndex;
-    seenPacketsIndex = (seenPacketsIndex + 1) % instance->dupDetectBufferSize;
-    
-    portEXIT_CRITICAL(&seenPacketsMux);
-    
-    // Write to reserved slot (outside critical section for speed)
-    seenPacketsStatic[writeIndex].valid = true;
-    memcpy(seenPacketsStatic[writeIndex].src_mac, src_mac, 6);
-    seenPacketsStatic[writeIndex].seq = seq;
-    seenPacketsStatic[writeIndex].timestamp = now;
-    
+    seenLastSeen[idx] = now;
+    portEXIT_CRITICAL(&seenMux);
+
+    return seen;
+}
+
+// ----- ACKed Unicasts Behind The Window -----
+bool ENowMesh::checkLateSeenLocked(const uint8_t *src_mac, uint8_t epoch, uint16_t seq, uint32_t now) {
+    for (size_t i = 0; i < LATE_SEEN_SIZE; ++i) {
+        LateSeen &l = lateSeen[i];
+        if (l.valid && l.seq == seq && l.epoch == epoch && memcmp(l.mac, src_mac, 6) == 0 &&
+            now - l.time <= dupDetectWindowMs) return true;
+    }
+    addLateSeenLocked(src_mac, epoch, seq, now);
     return false;
 }
 
+void ENowMesh::addLateSeenLocked(const uint8_t *src_mac, uint8_t epoch, uint16_t seq, uint32_t now) {
+    // A free or expired entry, else the oldest
+    size_t slot = 0;
+    for (size_t i = 0; i < LATE_SEEN_SIZE; ++i) {
+        LateSeen &l = lateSeen[i];
+        if (!l.valid || now - l.time > dupDetectWindowMs) { slot = i; break; }
+        if (now - l.time > now - lateSeen[slot].time) slot = i;
+    }
+    LateSeen &l = lateSeen[slot];
+    memcpy(l.mac, src_mac, 6);
+    l.epoch = epoch;
+    l.seq = seq;
+    l.time = now;
+    l.valid = true;
+}
+
+// =======================================
+// ===== ACKNOWLEDGEMENTS ===
+// =======================================
+// An ACK payload is a list of ack_entry_t: each entry acknowledges seq and, through its
+// bitmap, up to ACK_BITMAP_BITS earlier sequence numbers from the same sender. With
+// ackDelayMs > 0 a receiver collects sequence numbers per sender and answers a burst
+// of unicasts with a single ACK frame.
+
+// ----- Queue ACK -----
+void ENowMesh::queueAck(const uint8_t *dest, uint16_t seq) {
+    uint16_t seqs[ACK_COALESCE_MAX];
+    size_t count = 0;
+
+    if (ackDelayMs > 0) {
+        portENTER_CRITICAL(&ackMux);
+        PendingAck *slot = nullptr;
+        PendingAck *freeSlot = nullptr;
+        for (size_t i = 0; i < ACK_QUEUE_SIZE; ++i) {
+            if (!ackQueue[i].valid) {
+                if (!freeSlot) freeSlot = &ackQueue[i];
+            } else if (memcmp(ackQueue[i].dest_mac, dest, 6) == 0) {
+                slot = &ackQueue[i];
+                break;
+            }
+        }
+        if (!slot && freeSlot) {
+            slot = freeSlot;
+            memcpy(slot->dest_mac, dest, 6);
+            slot->firstTime = millis();
+            slot->count = 0;
+            slot->valid = true;
+        }
+        if (slot) {
+            slot->seqs[slot->count++] = seq;
+            if (slot->count == ACK_COALESCE_MAX) {
+                // Full: send now rather than drop sequence numbers
+                count = slot->count;
+                memcpy(seqs, slot->seqs, count * sizeof(uint16_t));
+                slot->valid = false;
+            }
+            portEXIT_CRITICAL(&ackMux);
+            if (count) sendAck(dest, seqs, count);
+            return;
+        }
+        portEXIT_CRITICAL(&ackMux);
+        // Every slot is holding ACKs for another sender: fall through and ACK immediately
+    }
+
+    seqs[0] = seq;
+    sendAck(dest, seqs, 1);
+}
+
+// ----- Flush Delayed ACKs -----
+void ENowMesh::flushAcks(uint32_t now) {
+    for (size_t i = 0; i < ACK_QUEUE_SIZE; ++i) {
+        uint8_t dest[6];
+        uint16_t seqs[ACK_COALESCE_MAX];
+        size_t count = 0;
+
+        portENTER_CRITICAL(&ackMux);
+        if (ackQueue[i].valid && now - ackQueue[i].firstTime >= ackDelayMs) {
+            memcpy(dest, ackQueue[i].dest_mac, 6);
+            count = ackQueue[i].count;
+            memcpy(seqs, ackQueue[i].seqs, count * sizeof(uint16_t));
+            ackQueue[i].valid = false;
+        }
+        portEXIT_CRITICAL(&ackMux);
+
+        if (count) sendAck(dest, seqs, count);
+    }
+}
+
+// ----- Send ACK -----
+void ENowMesh::sendAck(const uint8_t *dest, uint16_t *seqs, size_t count) {
+    // Receivers drop payloads above their maxPayload, so split long ACKs across frames
+    size_t maxEntries = maxPayload / sizeof(ack_entry_t);
+    if (maxEntries == 0) maxEntries = 1;
+
+    while (count > 0) {
+        uint8_t *buf = acquirePacketBuffer();
+        if (!buf) {
+            MESH_LOGE(ENOWMESH_LOG_ACK, "Packet pool exhausted - ACK to %s not sent.\n", macToStr(dest).c_str());
+            return;
+        }
+
+        uint8_t *pl = buf + sizeof(packet_hdr_t);
+        size_t entries = 0;
+        while (count > 0 && entries < maxEntries) {
+            // The most recent seq is the base; anything up to ACK_BITMAP_BITS below it rides in the bitmap
+            ack_entry_t e;
+            e.seq = seqs[--count];
+            e.bitmap = 0;
+            size_t kept = 0;
+            for (size_t i = 0; i < count; ++i) {
+                uint16_t d = (uint16_t)(e.seq - seqs[i]);
+                if (d <= ACK_BITMAP_BITS) {
+                    if (d) e.bitmap |= 1u << (d - 1);
+                } else {
+                    seqs[kept++] = seqs[i];
+                }
+            }
+            count = kept;
+            memcpy(pl + entries * sizeof(ack_entry_t), &e, sizeof(e));
+            entries++;
+        }
+
+        packet_hdr_t *hdr = (packet_hdr_t*)buf;
+        memcpy(hdr->src_mac, myMac, 6);
+        memcpy(hdr->dest_mac, dest, 6);
+        hdr->seq = nextSeq();
+        hdr->epoch = bootEpoch;
+        hdr->hop_count = 0;
+        hdr->msg_type = MSG_TYPE_ACK | MSG_TYPE_NO_ACK;
+        hdr->payload_len = static_cast<uint8_t>(entries * sizeof(ack_entry_t));
+
+        esp_err_t r = sendUnicastFrame(dest, nullptr, buf, sizeof(packet_hdr_t) + hdr->payload_len);
+        if (r != ESP_OK) {
+            MESH_LOGE(ENOWMESH_LOG_ACK, "ACK to %s failed: %d\n", macToStr(dest).c_str(), (int)r);
+        } else {
+            MESH_LOGT(ENOWMESH_LOG_ACK, "ACK sent to %s (%u entries)\n", macToStr(dest).c_str(), (unsigned)entries);
+        }
+
+        releasePacketBuffer(buf);
+    }
+}
+
+// ----- Handle Received ACK -----
+void ENowMesh::handleAck(const uint8_t *src, const uint8_t *payload, size_t len) {
+    size_t entries = len / sizeof(ack_entry_t);
+    if (entries == 0 || len % sizeof(ack_entry_t) != 0) {
+        MESH_LOGI(ENOWMESH_LOG_ACK, "Malformed ACK from %s (%u bytes). ignoring.\n", macToStr(src).c_str(), (unsigned)len);
+        return;
+    }
+
+    ack_entry_t acks[ESP_NOW_MAX_IE_DATA_LEN / sizeof(ack_entry_t)];
+    memcpy(acks, payload, len);  // Payload is unaligned
+
+    // One pass over the pending table marks every message the ACK covers
+    uint32_t now = millis();
+    unsigned confirmed = 0;
+    bool fragmentAcked = false;
+    bool haveSample = false;
+    uint32_t sample = 0;
+    portENTER_CRITICAL(&pendingMux);
+    for (int i : pendingWaiting) {
+        PendingMessage &p = pendingMessages[i];
+        if (memcmp(p.dest_mac, src, 6) != 0) continue;
+        for (size_t e = 0; e < entries; ++e) {
+            uint16_t d = (uint16_t)(acks[e].seq - p.seq);
+            if (d == 0 || (d <= ACK_BITMAP_BITS && (acks[e].bitmap >> (d - 1)) & 1u)) {
+                setPendingStateLocked(i, PENDING_DELIVERED);
+                p.rttMs = now - p.firstSendTime;
+                // Karn: a retransmitted message's ACK can't be matched to one transmission, so it gives no sample.
+                // Of a coalesced batch, the oldest message waited longest; the timeout has to cover it.
+                if (p.retryCount == 0 && !p.held && (!haveSample || now - p.sendTime > sample)) {
+                    sample = now - p.sendTime;
+                    haveSample = true;
+                }
+                confirmed++;
+                if (p.fragSlot >= 0) fragmentAcked = true;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&pendingMux);
+
+    if (haveSample) updateRtt(src, sample);
+
+    MESH_LOGT(ENOWMESH_LOG_ACK, "[ACK RECEIVED] from %s: %u entries, %u messages confirmed\n", macToStr(src).c_str(), (unsigned)entries, confirmed);
+
+    // ACK-clocked fragments: refill the window now rather than on the next checkPendingMessages()
+    if (fragmentAcked) serviceTransfers();
+}
+
+// =======================================
+// ===== RETRANSMISSION ===
+// =======================================
+// Each unACKed unicast keeps its original frame and is resent unchanged except for
+// MSG_TYPE_RETRANSMIT, so the receiver dedups it and the ACK for any copy clears it.
+// Timeouts follow RFC 6298: per destination SRTT and RTTVAR (kept on the route),
+// RTO = SRTT + 4 x RTTVAR, doubled for every retry and jittered so that senders
+// which lost frames in the same collision don't retry in lockstep.
+
+// ----- RTT Estimator -----
+void ENowMesh::updateRtt(const uint8_t *dest, uint32_t sampleMs) {
+    if (sampleMs == 0) sampleMs = 1;           // srtt 0 means "no sample"
+    if (sampleMs > 0xFFFF) sampleMs = 0xFFFF;
+
+    portENTER_CRITICAL(&routesMux);
+    int idx = routeIndex.find(dest, routes[0].dest, sizeof(RouteInfo));
+    if (idx >= 0) {
+        RouteInfo &r = routes[idx];
+        if (r.srtt == 0) {
+            r.srtt = (uint16_t)sampleMs;
+            r.rttvar = (uint16_t)(sampleMs / 2);
+        } else {
+            uint32_t err = r.srtt > sampleMs ? r.srtt - sampleMs : sampleMs - r.srtt;
+            r.rttvar = (uint16_t)((3u * r.rttvar + err) / 4);
+            r.srtt = (uint16_t)((7u * r.srtt + sampleMs) / 8);
+            if (r.srtt == 0) r.srtt = 1;
+        }
+    }
+    portEXIT_CRITICAL(&routesMux);
+}
+
+uint32_t ENowMesh::ackTimeoutFor(const uint8_t *dest) {
+    uint32_t rto = ackTimeout;
+
+    portENTER_CRITICAL(&routesMux);
+    int idx = routeIndex.find(dest, routes[0].dest, sizeof(RouteInfo));
+    if (idx >= 0 && routes[idx].srtt) rto = routes[idx].srtt + 4u * routes[idx].rttvar;
+    portEXIT_CRITICAL(&routesMux);
+
+    if (rto < ackTimeoutMin) rto = ackTimeoutMin;
+    if (rto > ackTimeoutMax) rto = ackTimeoutMax;
+    return rto;
+}
+
+uint32_t ENowMesh::backoffTimeout(uint32_t rto, uint8_t retry) {
+    uint32_t t = rto;
+    for (uint8_t i = 0; i < retry && t < ackTimeoutMax; ++i) t <<= 1;
+    if (t > ackTimeoutMax) t = ackTimeoutMax;
+    return t + (uint32_t)random(t / 4 + 1);  // Up to 25% jitter
+}
+
+// ----- Pending Slot State -----
+// Every state change goes through here so the occupancy bitmaps stay in step
+void ENowMesh::setPendingStateLocked(size_t slot, PendingState state) {
+    pendingMessages[slot].state = state;
+    if (state == PENDING_FREE) pendingUsed.clear(slot);
+    else pendingUsed.set(slot);
+    if (state == PENDING_WAITING) pendingWaiting.set(slot);
+    else pendingWaiting.clear(slot);
+}
+
 // ----- Check Pending Messages for ACKs and Retries -----
 void ENowMesh::checkPendingMessages() {
     uint32_t now = millis();
-    
-    portENTER_CRITICAL(&pendingMux);
-    
-    for (size_t i = 0; i < instance->maxPendingMessages; i++) {
-        if (!pendingMessages[i].waiting) continue;
-        
-        if (now - pendingMessages[i].sendTime > instance->ackTimeout) {
-            if (pendingMessages[i].retryCount < instance->maxRetries) {
-                // Retry
-                pendingMessages[i].retryCount++;
-                pendingMessages[i].sendTime = now;
-                
-                portEXIT_CRITICAL(&pendingMux);
-                
-                Serial.printf("[RETRY] seq=%u to %s (attempt %u/%u)\n", 
-                             pendingMessages[i].seq, macToStr(pendingMessages[i].dest_mac).c_str(), 
-                             pendingMessages[i].retryCount, instance->maxRetries);
-                
-                sendData((char*)pendingMessages[i].payload, pendingMessages[i].dest_mac);
-                
-                portENTER_CRITICAL(&pendingMux);
+
+    flushAcks(now);
+    serviceTxQueue(now);
+    serviceFloods(now);
+    serviceMailboxes(now);
+    serviceSync(now);
+    if (aggregateDelayMs > 0) flushBundles(now, false);
+
+    // The lock is dropped around each send and callback, so each slot's state is checked again under it
+    for (int i : pendingUsed) {
+        SendResult result;
+        bool report = false;
+        uint8_t *buf = nullptr;
+        size_t len = 0;
+        uint8_t dest[6];
+        uint16_t seq = 0;
+        uint8_t attempt = 0;
+
+        portENTER_CRITICAL(&pendingMux);
+        PendingMessage &p = pendingMessages[i];
+        if (p.state == PENDING_DELIVERED && p.fragSlot < 0) {
+            report = true;
+            result.delivered = true;
+            result.rttMs = p.rttMs;
+        } else if (p.state == PENDING_WAITING && now - p.sendTime >= p.timeout) {
+            if (p.retryCount >= maxRetries && p.fragSlot >= 0) {
+                countStat(STAT_FAILED_MESSAGES);
+                setPendingStateLocked(i, PENDING_FAILED);  // Settled by serviceTransfers() below
+            } else if (p.retryCount >= maxRetries) {
+                countStat(STAT_FAILED_MESSAGES);
+                report = true;
+                result.delivered = false;
+                result.rttMs = 0;
+            } else if ((buf = acquirePacketBuffer()) != nullptr) {
+                // Resend the stored frame as-is (same seq); pool exhaustion just delays the retry
+                countStat(STAT_RETRIES);
+                p.retryCount++;
+                p.sendTime = now;
+                p.timeout = backoffTimeout(p.rto, p.retryCount);
+                ((packet_hdr_t*)pendingFrames[i])->msg_type |= MSG_TYPE_RETRANSMIT;
+                memcpy(buf, pendingFrames[i], p.frameLen);
+                len = p.frameLen;
+                memcpy(dest, p.dest_mac, 6);
+                seq = p.seq;
+                attempt = p.retryCount;
+            }
+        }
+        if (report) {
+            memcpy(result.dest_mac, p.dest_mac, 6);
+            result.seq = p.seq;
+            result.attempts = p.retryCount + 1;
+            setPendingStateLocked(i, PENDING_FREE);
+        }
+        portEXIT_CRITICAL(&pendingMux);
+
+        if (buf) {
+            MESH_LOGI(ENOWMESH_LOG_ACK, "[RETRY] seq=%u to %s (attempt %u/%u)\n",
+                         (unsigned)seq, macToStr(dest).c_str(), (unsigned)attempt, (unsigned)maxRetries);
+            // Same path as the first send: a sendDirect() frame never leaves the neighbour
+            esp_err_t r = (((packet_hdr_t*)buf)->msg_type & MSG_TYPE_NO_FORWARD) ? sendToMac(dest, buf, len)
+                                                                                 : sendUnicastFrame(dest, nullptr, buf, len);
+            if (r != ESP_OK) {
+                MESH_LOGE(ENOWMESH_LOG_ACK, "Retry of seq=%u to %s failed: %d\n", (unsigned)seq, macToStr(dest).c_str(), (int)r);
+            }
+            releasePacketBuffer(buf);
+        }
+
+        if (report) {
+            if (result.delivered) {
+                MESH_LOGT(ENOWMESH_LOG_ACK, "[MSG CONFIRMED] seq=%u to %s after %u attempt(s), %u ms\n",
+                             (unsigned)result.seq, macToStr(result.dest_mac).c_str(), (unsigned)result.attempts, (unsigned)result.rttMs);
             } else {
-                // Failed permanently
-                Serial.printf("[MSG FAILED] seq=%u to %s after %u retries\n", 
-                             pendingMessages[i].seq, macToStr(pendingMessages[i].dest_mac).c_str(), 
-                             instance->maxRetries);
-                pendingMessages[i].waiting = false;
+                MESH_LOGI(ENOWMESH_LOG_ACK, "[MSG FAILED] seq=%u to %s after %u retries\n",
+                             (unsigned)result.seq, macToStr(result.dest_mac).c_str(), (unsigned)maxRetries);
             }
+            if (sendCallback) sendCallback(result);
         }
     }
-    
-    portEXIT_CRITICAL(&pendingMux);
-}
\ No newline at end of file
+
+    // Fragments are reported once per message, when the whole transfer ends
+    serviceTransfers();
+    reportTransfers();
+}
@@ -2,9 +2,89 @@
 #define ENOWMESH_H
 
 #include <Arduino.h>
+#include <atomic>
 #include <WiFi.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
+#include <esp_timer.h>
+
+// =======================================
+// ===== BUILD CONFIGURATION ===
+// =======================================
+// Table sizes and optional code are fixed at compile time. Pick a preset with a build flag, e.g.
+//   -DENOWMESH_PRESET=ENOWMESH_PRESET_LEAF                       (battery sensor: no forwarding, small tables)
+// and override single values on top of it:
+//   -DENOWMESH_PRESET=ENOWMESH_PRESET_SMALL -DENOWMESH_PEER_TABLE_SIZE=48
+// In the Arduino IDE, edit the defaults below. Sizes are explained in COMPILE-TIME CONSTANTS
+#define ENOWMESH_PRESET_FULL   0   // MASTER/REPEATER in meshes of up to ~64 nodes, 4KB messages (~47KB RAM)
+#define ENOWMESH_PRESET_SMALL  1   // Any role in meshes of up to ~16 nodes, 512B messages (default, ~11KB RAM)
+#define ENOWMESH_PRESET_LEAF   2   // LEAF only: never forwards, few neighbours, no large messages, logs errors only (~6KB RAM)
+
+#ifndef ENOWMESH_PRESET
+#define ENOWMESH_PRESET ENOWMESH_PRESET_SMALL
+#endif
+
+// Value for the selected preset
+#define ENOWMESH_PICK(full, small, leaf) \
+    (ENOWMESH_PRESET == ENOWMESH_PRESET_LEAF ? (leaf) : ENOWMESH_PRESET == ENOWMESH_PRESET_SMALL ? (small) : (full))
+
+#ifndef ENOWMESH_FORWARDING
+#define ENOWMESH_FORWARDING ENOWMESH_PICK(1, 1, 0)     // 0 = relay code compiled out, the node is always a LEAF
+#endif
+
+#ifndef ENOWMESH_PEER_TABLE_SIZE
+#define ENOWMESH_PEER_TABLE_SIZE ENOWMESH_PICK(128, 16, 8)
+#endif
+#ifndef ENOWMESH_ROUTE_TABLE_SIZE
+#define ENOWMESH_ROUTE_TABLE_SIZE ENOWMESH_PICK(64, 16, 8)
+#endif
+#ifndef ENOWMESH_DUP_SOURCE_TABLE_SIZE
+#define ENOWMESH_DUP_SOURCE_TABLE_SIZE ENOWMESH_PICK(64, 16, 8)
+#endif
+#ifndef ENOWMESH_LATE_SEEN_SIZE
+#define ENOWMESH_LATE_SEEN_SIZE ENOWMESH_PICK(16, 8, 4)
+#endif
+#ifndef ENOWMESH_NODE_ID_TABLE_SIZE
+#define ENOWMESH_NODE_ID_TABLE_SIZE ENOWMESH_PICK(64, 16, 4)
+#endif
+#ifndef ENOWMESH_PACKET_POOL_SIZE
+#define ENOWMESH_PACKET_POOL_SIZE ENOWMESH_PICK(8, 4, 3)
+#endif
+#ifndef ENOWMESH_RX_QUEUE_SIZE
+#define ENOWMESH_RX_QUEUE_SIZE ENOWMESH_PICK(16, 4, 3)
+#endif
+#ifndef ENOWMESH_TX_QUEUE_SIZE
+#define ENOWMESH_TX_QUEUE_SIZE ENOWMESH_PICK(24, 6, 4)
+#endif
+#ifndef ENOWMESH_MAX_PENDING_MESSAGES
+#define ENOWMESH_MAX_PENDING_MESSAGES ENOWMESH_PICK(32, 8, 4)
+#endif
+#ifndef ENOWMESH_FRAG_MAX_MESSAGE_SIZE
+#define ENOWMESH_FRAG_MAX_MESSAGE_SIZE ENOWMESH_PICK(4096, 512, 512)
+#endif
+#ifndef ENOWMESH_FRAG_SLOTS
+#define ENOWMESH_FRAG_SLOTS ENOWMESH_PICK(1, 1, 0)       // Send slots and reassembly slots, each; 0 = no large messages
+#endif
+#ifndef ENOWMESH_FLOOD_HOLD_SIZE
+#define ENOWMESH_FLOOD_HOLD_SIZE ENOWMESH_PICK(8, 1, 0)
+#endif
+#ifndef ENOWMESH_AGG_QUEUE_SIZE
+#define ENOWMESH_AGG_QUEUE_SIZE ENOWMESH_PICK(4, 1, 1)
+#endif
+#ifndef ENOWMESH_ACK_QUEUE_SIZE
+#define ENOWMESH_ACK_QUEUE_SIZE ENOWMESH_PICK(8, 2, 0)
+#endif
+#ifndef ENOWMESH_MAILBOX_SIZE
+#define ENOWMESH_MAILBOX_SIZE ENOWMESH_PICK(4, 2, 1)
+#endif
+#ifndef ENOWMESH_MAILBOX_LEAVES
+#define ENOWMESH_MAILBOX_LEAVES ENOWMESH_PICK(4, 2, 1)
+#endif
+
+// Hash index buckets for a table of n slots: the next power of two at or above 2n
+constexpr size_t enowmeshIndexSize(size_t n, size_t b = 1) {
+    return b >= 2 * n ? b : enowmeshIndexSize(n, b * 2);
+}
 
 class ENowMesh {
     public:
@@ -18,6 +98,15 @@ class ENowMesh {
         static constexpr uint8_t MSG_TYPE_NO_ACK     = 0x10;  // Don't send ACK for this
         static constexpr uint8_t MSG_TYPE_TO_MASTER  = 0x20;  // Route to MASTER node
         static constexpr uint8_t MSG_TYPE_TO_REPEATER = 0x40; // Route to REPEATER node
+        static constexpr uint8_t MSG_TYPE_RETRANSMIT = 0x80;  // Retry of an unACKed unicast (same seq), set internally
+        static constexpr uint8_t MSG_TYPE_CONTROL    = MSG_TYPE_HELLO | MSG_TYPE_ACK;  // Mesh-internal frame, payload[0] = CTRL_* kind
+
+        // Control frame kinds (first payload byte of MSG_TYPE_CONTROL frames)
+        static constexpr uint8_t CTRL_TELEMETRY      = 0x01;  // Node statistics, sent to MASTER
+        static constexpr uint8_t CTRL_FRAGMENT       = 0x02;  // Part of a message larger than maxPayload
+        static constexpr uint8_t CTRL_BUNDLE         = 0x03;  // Several small messages: [len][bytes] records
+        static constexpr uint8_t CTRL_POLL           = 0x04;  // Sleepy LEAF woke up: MailboxPoll, broadcast to neighbours
+        static constexpr uint8_t CTRL_HELD           = 0x05;  // To a sender: its frame waits in a mailbox (MailboxHeld)
 
         // ========================================
         // CONFIGURABLE MESH PARAMETERS
@@ -32,62 +121,297 @@ class ENowMesh {
         // Recommended: Small mesh (3-5 nodes): 3-4 hops, Medium mesh (5-15 nodes): 5-6 hops, Large mesh (15+ nodes): 7-10 hops, each hop adds ~50-200ms latency
         
         uint16_t maxPeers = 128;  
-        // Maximum active peers to track (compile-time fixed, see PEER_TABLE_SIZE)
+        // Maximum active peers to track (at most PEER_TABLE_SIZE). Not limited by the ESP-NOW driver's ~20 peers:
+        // neighbours are registered with the driver only while they are being sent to (see DRIVER_PEER_SLOTS)
         // Recommended: Set to expected node count + 20% buffer
         
+        uint32_t routeTimeout = 60000UL;  // 60 seconds
+        // How long a learned route (destination -> next hop) stays usable without being refreshed (milliseconds)
+        // Recommended: Same as peerTimeout; shorter for mobile nodes. Expired routes fall back to flooding
+
         // --- Payload Configuration ---
         uint16_t maxPayload = 200;  
         // Maximum payload size in bytes (excluding header)
-        // Recommended: Short messages: 100 bytes, General use: 200 bytes, Maximum: 234 bytes (250 - 17 byte header), ESP-NOW limit is 250 bytes total; header uses ~17 bytes
+        // Recommended: Short messages: 100 bytes, General use: 200 bytes, Maximum: 232 bytes (250 - 18 byte header), ESP-NOW limit is 250 bytes total; header uses 18 bytes
+
+        bool compactHeaders = false;
+        // Send frames with a 5-17 byte compact header instead of the 18 byte packet_hdr_t: source and destination
+        // shrink to 16-bit node IDs, or vanish where they are the link addresses. Used towards neighbours whose HELLO
+        // advertised it; others (older versions, or this off) keep getting packet_hdr_t
+        // Recommended: true on every node of a mesh of small messages; NODE_ID_TABLE_SIZE should cover the mesh
         
         // --- Timing Parameters ---
         uint32_t peerTimeout = 60000UL;  // 60 seconds
         // How long before inactive peer is removed (milliseconds)
         // Recommended: Fast-moving nodes: 30000 (30s), Stationary nodes: 60000-120000 (1-2 min), Low-power nodes: 300000 (5 min)
         
+        uint8_t linkFailLimit = 8;
+        // Consecutive sends to a neighbour the driver reports as failed (no MAC ACK) before it is evicted, 0 = never
+        // Recommended: 5-10. Lossy links are already avoided as next hops below LINK_POOR_PCT delivery; 1 restores
+        // eviction on the first failure, which churns peers and floods on marginal links
+
         uint32_t ackTimeout = 2000;  // 2 seconds
-        // How long to wait for ACK before retry (milliseconds)
+        // How long to wait for ACK before the first retry while no round trip to the destination has been measured (milliseconds)
+        // Once ACKs arrive, each destination uses its own SRTT + 4 x RTTVAR instead
         // Recommended: Low latency mesh: 1000-1500ms, General use: 2000-3000ms, High-hop count: 3000-5000ms, Formula: (maxHops × 500ms) + 500ms buffer
+
+        uint32_t ackTimeoutMin = 200;
+        uint32_t ackTimeoutMax = 16000;
+        // Bounds for the adaptive timeout and its exponential backoff (doubles per retry, plus up to 25% jitter)
+        // Recommended: Min above the loop() period that calls checkPendingMessages() plus the receiver's ackDelayMs, Max about 8 x ackTimeout
         
         uint8_t maxRetries = 3;  
         // Number of retry attempts for failed unicast messages
         // Recommended: Reliable delivery needed: 3-5, Best-effort: 1-2, Critical messages: 5-7
+
+        uint16_t ackDelayMs = 0;
+        // How long a receiver may hold an ACK to coalesce it with later ACKs to the same sender (milliseconds)
+        // Recommended: 0 (ACK immediately) for sparse traffic, 50-200ms when senders burst unicasts to one node,
+        // always well below ackTimeout. Delayed ACKs are flushed from checkPendingMessages()
         
         // --- Duplicate Detection ---
         uint8_t dupDetectBufferSize = 64;  
-        // Number of recent packets to remember for duplicate detection
-        // Recommended: Light traffic (<5 msg/sec): 32, Medium traffic (5-20 msg/sec): 64, Heavy traffic (>20 msg/sec): 128, Formula: (expected_packets_per_sec × dupDetectWindowMs / 1000) × 1.5, Must not exceed DUP_DETECT_BUFFER_SIZE constant
+        // Deprecated and ignored: duplicates are now tracked with a per-source sequence window (see DUP_SOURCE_TABLE_SIZE)
         
         uint32_t dupDetectWindowMs = 10000;  // 10 seconds
-        // Time window for duplicate detection (milliseconds)
-        // Recommended: Small mesh (3 hops): 5000ms (5s), Medium mesh (6 hops): 10000ms (10s), Large mesh (10 hops): 15000ms (15s), Formula: (maxHops × 1000ms) + 3000ms safety buffer, Packets older than this are forgotten, MUST be longer than worst-case propagation time!
+        // How long a silent source's sequence window is remembered (milliseconds)
+        // Recommended: Small mesh (3 hops): 5000ms (5s), Medium mesh (6 hops): 10000ms (10s), Large mesh (10 hops): 15000ms (15s), Formula: (maxHops × 1000ms) + 3000ms safety buffer, MUST be longer than worst-case propagation time!
         
-        uint8_t maxPendingMessages = 16;  
-        // Maximum simultaneous pending messages awaiting ACK
+        uint8_t maxPendingMessages = MAX_PENDING_MESSAGES < 16 ? MAX_PENDING_MESSAGES : 16;
+        // Maximum simultaneous pending messages awaiting ACK (16, or MAX_PENDING_MESSAGES if smaller)
         // Recommended: Low message rate: 8, General use: 16, High throughput: 32, Must not exceed MAX_PENDING_MESSAGES constant
 
+        // --- Receive Processing ---
+        enum RxMode {
+            RX_INLINE,  // Process packets inside the ESP-NOW receive callback (Wi-Fi task)
+            RX_POLL,    // Callback only queues; call poll() from loop() to process
+            RX_TASK     // Callback only queues; a dedicated FreeRTOS task processes
+        };
+
+        RxMode rxMode = RX_INLINE;
+        // Where received packets are validated, delivered and forwarded. Set before registerCallbacks()
+        // Recommended: RX_INLINE for fast callbacks, RX_POLL when the message callback is slow (it then runs in loop()),
+        // RX_TASK for bursty repeaters that must keep forwarding while loop() is busy
+
+        uint8_t rxBatchSize = 8;
+        // Maximum packets processed per poll() call / task wakeup before yielding
+        // Recommended: 4-16. Larger drains bursts faster but holds loop() longer
+
+        uint8_t rxTaskPriority = 5;
+        uint16_t rxTaskStackSize = 4096;
+        // RX_TASK only. Stack must fit your message callback plus ~2KB for mesh processing
+
+        uint8_t txMaxInFlight = 2;
+        // Frames handed to the ESP-NOW driver before waiting for its send callback; further frames wait in the
+        // priority queue (ACKs, then HELLO/telemetry, then own data, then forwarded frames), 0 = no queue
+        // Recommended: 1-4, below the driver's own queue depth, or bursts are refused with ESP_ERR_ESPNOW_NO_MEM
+
+        // --- Fragmentation ---
+        uint8_t fragWindow = 1;
+        // Fragments of one large unicast awaiting ACK at a time; each ACK releases the next one, lost fragments are
+        // retransmitted individually. For broadcasts: fragments sent per checkPendingMessages() call
+        // Recommended: 1 for multi-hop paths (pipelined fragments collide with their own forwards at hidden nodes),
+        // 2-4 for single-hop transfers. Keep below maxPendingMessages
+
+        uint32_t fragTimeout = 30000;
+        // A partly received message is discarded after this long without a new fragment (milliseconds)
+        // Recommended: above ackTimeoutMax, so a fragment still being retried is not given up early
+
+        // --- Aggregation ---
+        uint16_t aggregateDelayMs = 0;  // Disabled
+        // Small messages sent to the same destination with the same type are held up to this long and packed into
+        // one frame (one header, one ACK, one retransmission unit), flushed from checkPendingMessages()
+        // Recommended: 0 for latency-sensitive traffic; 200-1000ms for nodes sending several short readings per second
+
+        uint8_t aggregateFlushBytes = 0;
+        // Send a bundle as soon as it holds this many bytes, 0 = only once the next message would not fit in maxPayload
+        // Recommended: 0 for fewest frames; ~100 to bound how much one lost bundle takes with it
+
+        // --- Broadcast Flooding ---
+        uint8_t floodBroadcastMinPeers = 0;  // Disabled
+        // Flooded frames (broadcasts, sendToMaster/sendToRepeaters, unicasts without a route) go out as one 802.11
+        // broadcast once at least this many peers would get a copy, else as one unicast per peer, 0 = per peer up to
+        // TX_CLASS_DEPTH copies
+        // Recommended: 0, or 3 together with floodCounterK. Unicast copies are MAC-ACKed and retried; a broadcast
+        // is one frame in total but is not, and neighbours relaying the same broadcast at once collide
+
+        uint8_t floodCounterK = 0;  // Disabled
+        // Counter-based suppression: a node holds each broadcast it would relay for a random 0..floodBackoffMs and
+        // cancels the relay once it has heard the same frame this many times (its own first copy included), 0 = off
+        // Recommended: 0 for sparse meshes (chains, under 4 neighbours per node); 3 for dense ones
+
+        uint16_t floodBackoffMs = 50;
+        // Longest random hold before relaying when floodCounterK is set (milliseconds). Held relays are sent from
+        // the receive path and checkPendingMessages(), so call it at least this often
+
+        uint8_t floodForwardPct = 100;
+        // Probabilistic flooding: relay each broadcast with this probability (%). Frames heard straight from
+        // their source are always relayed, so a broadcast can't die out at the first hop
+        // Recommended: 100. Below that, messages die out in meshes with few redundant paths; prefer floodCounterK
+
+        // --- Anycast Routing ---
+        bool masterUplink = true;
+        // Send and relay sendToMaster() frames hop by hop towards the nearest MASTER, along the distance gradient
+        // advertised in HELLO beacons, instead of flooding them; they are flooded while no uplink is known
+        // Recommended: true. All nodes should run a version that advertises the gradient, or it stays incomplete
+
+        // --- Peer Cache ---
+        uint32_t peerCacheInterval = 0;  // Disabled
+        // Snapshot neighbours, their MASTER gradient and learned routes to NVS (Preferences) this often (milliseconds)
+        // and restore them in initEspNow(), so a rebooted node can send before it hears a HELLO. 0 = no cache
+        // Recommended: 300000-900000ms; a snapshot is only written when it changed, sparing flash wear
+
+        // --- Sleepy LEAF Mailboxes ---
+        uint32_t sleepIntervalMs = 0;  // Always listening
+        // LEAF that turns its radio off between wakes: how long it sleeps (milliseconds). With this set, pollMailbox()
+        // on each wake registers the node with its MASTER/REPEATER neighbours, which hold unicasts for it meanwhile.
+        // 0 = pollMailbox() does nothing
+        // Recommended: the sketch's sleep period. Held frames wait up to 2x this, so keep it well below a minute
+
+        uint8_t mailboxPerLeaf = 4;
+        // MASTER/REPEATER: frames held at once for one sleeping LEAF neighbour (MAILBOX_SIZE are shared by all);
+        // further ones are dropped and their senders retry later. 0 = hold nothing
+        // Recommended: 2-4 x the messages a LEAF receives per sleep interval
+
+        // --- Time Sync And Slotted Transmission ---
+        bool timeSync = false;
+        // Follow the MASTER's clock: HELLOs carry the sender's mesh time, and each node takes its uplink's, corrected for
+        // clock drift (getMeshTimeUs()). HELLOs are then never suppressed (helloRedundancy), so time keeps flowing
+        // Recommended: true on every node when readings need a common timestamp; accuracy follows helloInterval
+
+        uint8_t tdmaSlots = 0;  // Disabled
+        // Slotted transmission: mesh time is cut into frames of tdmaSlots slots of tdmaSlotMs. Each node picks a slot that
+        // no neighbour and no neighbour's neighbour uses (advertised in HELLOs) and hands queued frames to the driver only
+        // inside it. Turns timeSync on and needs txMaxInFlight > 0; a node sends freely until it is synced and has a slot.
+        // 0 = off, at most TDMA_MAX_SLOTS
+        // Recommended: 0 unless neighbours' floods collide; 12-16 for meshes with up to ~6 neighbours per node
+
+        uint16_t tdmaSlotMs = 10;
+        // Slot length (milliseconds). A full 250-byte frame takes ~2.5ms on air at the 1 Mbps default rate
+        // Recommended: 10-20ms. Each hop waits up to tdmaSlots x tdmaSlotMs for its slot: keep ackTimeout above twice
+        // that per hop
+
+        // --- Telemetry ---
+        uint32_t telemetryInterval = 0;  // Disabled
+        // How often sendTelemetry() sends this node's MeshStats to a MASTER (milliseconds), 0 = never
+        // Recommended: 60000-300000ms for fleet monitoring; each report is one ~120 byte frame (100-byte report, kind byte, 18-byte header)
+
         // --- Hello Beacon Parameters ---
         uint32_t helloInterval = 15000;  // 15 seconds
-        // How often to send HELLO beacons (milliseconds)
+        // How often to send HELLO beacons (milliseconds); with helloIntervalMin set, the longest Trickle interval
         // Recommended: MASTER/REPEATER: 15000-30000ms, LEAF: 60000-120000ms (power saving)
 
+        uint32_t helloIntervalMin = 1000;
+        // Trickle scheduling: after a new peer, a pruned peer, a role or MASTER distance change the beacon interval
+        // restarts here and doubles each quiet interval up to helloInterval (milliseconds), 0 = fixed helloInterval
+        // Recommended: 1000ms; keep it well above the loop period that calls sendHelloBeacon()
+
+        uint8_t helloRedundancy = 2;
+        // Trickle suppression: skip this interval's beacon if this many unchanged HELLOs were heard in it, 0 = never.
+        // A node still beacons at least every peerTimeout / 2, so neighbours don't prune it
+        // Recommended: 2-3; 0 for sparse meshes where every beacon matters
+
         // ========================================
         // COMPILE-TIME CONSTANTS
         // ========================================
-        // These define static array sizes and cannot be changed at runtime
-        // Modify these if you need different limits, then recompile
+        // These define static array sizes and cannot be changed at runtime.
+        // Set them with the ENOWMESH_* build flags or a preset (see BUILD CONFIGURATION); figures are for the default SMALL
+
+        static constexpr bool FORWARDING = ENOWMESH_FORWARDING;
+        // Relay code compiled in. Without it the node is always a LEAF: setRole() ignores MASTER and REPEATER
+
+        static constexpr size_t PEER_TABLE_SIZE = ENOWMESH_PEER_TABLE_SIZE;
+        // Static peer table size - increases RAM usage (40 bytes per peer)
+        // 16 peers = ~640B RAM
+        
+        static constexpr size_t DRIVER_PEER_SLOTS = ESP_NOW_MAX_TOTAL_PEER_NUM - 1;
+        // Neighbours registered with the ESP-NOW driver at once (the broadcast peer takes the last driver slot).
+        // A neighbour is registered right before a send to it; when all slots are taken the least recently used
+        // one is deleted. Lower it if the application registers ESP-NOW peers of its own
+
+        static constexpr size_t PEER_INDEX_SIZE = enowmeshIndexSize(PEER_TABLE_SIZE);
+        // Hash index buckets for O(1) peer lookup by MAC (2 bytes each), 2x PEER_TABLE_SIZE
+        
+        static constexpr size_t ROUTE_TABLE_SIZE = ENOWMESH_ROUTE_TABLE_SIZE;
+        // Learned multi-hop routes (24 bytes per route)
+        // 16 routes = ~400B RAM
+
+        static constexpr size_t ROUTE_INDEX_SIZE = enowmeshIndexSize(ROUTE_TABLE_SIZE);
+        // Hash index buckets for route lookup by destination MAC
         
-        static constexpr size_t PEER_TABLE_SIZE = 128;
-        // Static peer table size - increases RAM usage (16 bytes per peer)
-        // 128 peers = ~2KB RAM
+        static constexpr size_t DUP_SOURCE_TABLE_SIZE = ENOWMESH_DUP_SOURCE_TABLE_SIZE;
+        // Sources tracked for duplicate detection, each with a sliding window over its last 33 sequence numbers of each space (26 bytes per source)
+        // 16 sources = ~420B RAM. Set to the number of nodes in the mesh; the least recently heard source is evicted when full
+
+        static constexpr size_t DUP_SOURCE_INDEX_SIZE = enowmeshIndexSize(DUP_SOURCE_TABLE_SIZE);
+        // Hash index buckets for source lookup by MAC
+
+        static constexpr size_t LATE_SEEN_SIZE = ENOWMESH_LATE_SEEN_SIZE;
+        // ACKed unicasts remembered exactly once they fall behind their source's window (16 bytes each), so a retransmission
+        // sent after its source's next 32 ACKed unicasts is still delivered once. The oldest is forgotten when full
         
-        static constexpr size_t DUP_DETECT_BUFFER_SIZE = 128;
-        // Maximum duplicate detection buffer (11 bytes per entry)
-        // 128 entries = ~1.4KB RAM
+        static constexpr size_t NODE_ID_TABLE_SIZE = ENOWMESH_NODE_ID_TABLE_SIZE;
+        // compactHeaders: nodes whose 16-bit ID this node resolves (20 bytes each), 16 nodes = ~320B RAM.
+        // Set to the number of nodes in the mesh; the least recently used entry is replaced when full
+
+        static constexpr size_t NODE_ID_INDEX_SIZE = enowmeshIndexSize(NODE_ID_TABLE_SIZE);
+        // Hash index buckets for node ID entry lookup by MAC
+
+        static constexpr size_t PACKET_POOL_SIZE = ENOWMESH_PACKET_POOL_SIZE;
+        // Packet buffers shared by the send, forward and deliver paths (no heap use per packet)
+        // Each buffer holds a full ESP-NOW frame plus a NUL terminator: 4 buffers = ~1KB RAM
+        // Max 32; raise if getPacketPoolStats().exhausted is non-zero
+
+        static constexpr size_t RX_QUEUE_SIZE = ENOWMESH_RX_QUEUE_SIZE;
+        // Receive ring for RX_POLL/RX_TASK (~280 bytes per slot, one slot is kept empty)
+        // 4 slots = ~1.1KB RAM. Size from getRxQueueStats().highWater under peak traffic
+
+        static constexpr size_t TX_QUEUE_SIZE = ENOWMESH_TX_QUEUE_SIZE;
+        // Frames waiting for the driver, shared by all priority classes (~260 bytes each): 6 slots = ~1.6KB RAM
+        // A flood queues one frame per peer up to TX_CLASS_DEPTH peers, more get one broadcast; size from
+        // getTxQueueStats().highWater under peak traffic
+
+        static constexpr size_t TX_CLASS_DEPTH = TX_QUEUE_SIZE * 2 / 3;
+        // Most slots one priority class may hold, so a burst of data or forwards can't lock out ACKs and HELLOs
+
+        static constexpr size_t MAX_PENDING_MESSAGES = ENOWMESH_MAX_PENDING_MESSAGES;
+        // Maximum pending message slots, each keeps the full frame for retransmission (~290 bytes per message)
+        // 8 messages = ~2.3KB RAM
+
+        static constexpr size_t FRAG_MAX_MESSAGE_SIZE = ENOWMESH_FRAG_MAX_MESSAGE_SIZE;
+        // Largest payload sendBytes()/sendData() accept; anything over maxPayload is split into fragments
+        // Each send and reassembly slot holds one message of this size: 1 slot each x 512B = ~1KB RAM
         
-        static constexpr size_t MAX_PENDING_MESSAGES = 32;
-        // Maximum pending message slots (215 bytes per message)
-        // 32 messages = ~6.9KB RAM
+        static constexpr size_t FRAG_MAX_FRAGMENTS = 64;
+        // Fragments per message (received fragments are tracked in a 64-bit mask), so maxPayload must be at least
+        // FRAG_MAX_MESSAGE_SIZE / 64 + 7 bytes of fragment header to send the largest message
+
+        static constexpr size_t FRAG_TX_SLOTS = ENOWMESH_FRAG_SLOTS;
+        // Large messages being sent at once (FRAG_MAX_MESSAGE_SIZE each); sendBytes() returns ESP_ERR_NO_MEM while
+        // all are busy or, for a moment, while another task services them. 0 = messages over maxPayload are refused
+
+        static constexpr size_t FRAG_RX_SLOTS = ENOWMESH_FRAG_SLOTS;
+        // Large messages being reassembled at once (FRAG_MAX_MESSAGE_SIZE each); unicast fragments of further messages
+        // are not ACKed, so their senders retry until a slot frees up (with 0 slots, until they give up)
+
+        static constexpr size_t AGG_QUEUE_SIZE = ENOWMESH_AGG_QUEUE_SIZE;
+        // Destinations with a bundle being filled at once (~250 bytes each); a message for a further destination
+        // sends the oldest bundle early
+
+        static constexpr size_t FLOOD_HOLD_SIZE = FORWARDING ? ENOWMESH_FLOOD_HOLD_SIZE : 0;
+        // Broadcast relays held for suppression at once (~270 bytes each); further ones are relayed immediately
+
+        static constexpr size_t ACK_QUEUE_SIZE = ENOWMESH_ACK_QUEUE_SIZE;
+        // Senders that can have delayed ACKs outstanding at once (48 bytes each); extra senders are ACKed immediately
+
+        static constexpr size_t ACK_COALESCE_MAX = 16;
+        // Sequence numbers held per sender before its ACK is sent early
+
+        static constexpr size_t MAILBOX_SIZE = ENOWMESH_MAILBOX_SIZE;
+        // Frames held for sleeping LEAF neighbours, shared by all of them (~270 bytes each): 2 frames = ~540B RAM
+
+        static constexpr size_t MAILBOX_LEAVES = ENOWMESH_MAILBOX_LEAVES;
+        // Sleeping LEAF neighbours registered at once (20 bytes each); further ones get no mailbox
 
         // ========================================
         // NODE ROLE DEFINITION
@@ -115,9 +439,15 @@ class ENowMesh {
         void setChannel();
 
         // Loop functions (call regularly)
+        size_t poll();                  // RX_POLL: process queued packets (returns how many)
         void prunePeers();              // Remove inactive peers
         void checkPendingMessages();     // Handle retries and timeouts
         void sendHelloBeacon();         // Send periodic HELLO beacon
+        void sendTelemetry();           // Send periodic stats report to MASTER (telemetryInterval)
+        void flushAggregated();         // Send all held bundles now, e.g. before deep sleep (aggregateDelayMs)
+        void pollMailbox(uint16_t awakeMs = 250);   // Sleepy LEAF, right after waking: fetch held messages (sleepIntervalMs)
+        esp_err_t savePeerCache();      // Write the peer cache now, e.g. before a restart or deep sleep (peerCacheInterval)
+        void clearPeerCache();          // Erase the cached peers and routes from NVS
 
         // Communication
         esp_err_t sendData(const char *msg, const uint8_t *dest_mac = nullptr, uint8_t msg_type = MSG_TYPE_DATA);
@@ -129,6 +459,13 @@ class ENowMesh {
         esp_err_t sendToRepeaters(const char *msg, uint8_t msg_type = MSG_TYPE_DATA);                       // Msg will be received by all repeaters
         esp_err_t sendDirect(const char *msg, const uint8_t *dest_mac, uint8_t msg_type = MSG_TYPE_DATA);   // Direct send - no mesh forwarding (1-hop only)
 
+        // Binary variants: payload is sent as-is (may contain 0x00), len must be 1..FRAG_MAX_MESSAGE_SIZE
+        // Payloads over maxPayload are fragmented and reassembled transparently
+        esp_err_t sendBytes(const uint8_t *data, size_t len, const uint8_t *dest_mac = nullptr, uint8_t msg_type = MSG_TYPE_DATA);
+        esp_err_t sendBytesToMaster(const uint8_t *data, size_t len, uint8_t msg_type = MSG_TYPE_DATA);
+        esp_err_t sendBytesToRepeaters(const uint8_t *data, size_t len, uint8_t msg_type = MSG_TYPE_DATA);
+        esp_err_t sendBytesDirect(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type = MSG_TYPE_DATA);
+
 
         // ========================================
         // PACKET STRUCTURE
@@ -136,28 +473,265 @@ class ENowMesh {
         typedef struct __attribute__((packed)) {
             uint8_t src_mac[6];      // Original sender MAC
             uint8_t dest_mac[6];     // Destination MAC (0xFF... for broadcast)
-            uint16_t seq;            // Sequence number for duplicate detection
+            uint16_t seq;            // Per-sender counter, +1 for every frame it originates
+            uint8_t epoch;           // Sender's boot epoch, random per boot (a change resets duplicate detection)
             uint8_t hop_count;       // Current hop count (incremented at each hop)
             uint8_t msg_type;        // Message type flags (NEW!)
             uint8_t payload_len;     // Payload length in bytes
         } packet_hdr_t;
-        // Total header size: 17 bytes
+        // Total header size: 18 bytes
+
+        // Compact header (compactHeaders), rewritten from and back to packet_hdr_t at the driver. Bit 0 of the
+        // first byte is its version bit: in packet_hdr_t it is the group bit of src_mac, clear in every node MAC.
+        // The fixed part is followed by the source and destination fields, 0, 2 or 6 bytes each by their ADDR_*
+        // code, then the payload; payload_len is what remains of the frame
+        typedef struct __attribute__((packed)) {
+            uint8_t flags;           // COMPACT_HEADER | src code << 1 | dest code << 3 | hop_count << 5
+            uint8_t epoch;
+            uint16_t seq;
+            uint8_t msg_type;
+        } compact_hdr_t;
+        // Total header size: 5 bytes + address fields
+        static constexpr uint8_t COMPACT_HEADER    = 0x01;
+        static constexpr uint8_t COMPACT_MAX_HOPS  = 7;     // Frames further from their source keep packet_hdr_t
+        static constexpr uint8_t ADDR_MAC          = 0;     // 6-byte MAC
+        static constexpr uint8_t ADDR_ID           = 1;     // 16-bit node ID, resolved by the receiver
+        static constexpr uint8_t ADDR_LINK         = 2;     // None: the link sender (src) or link receiver (dest)
+        static constexpr uint8_t ADDR_BROADCAST    = 3;     // None: FF:FF:FF:FF:FF:FF (dest only)
+
+        // Node IDs are derived from the MAC; 0x0000 and 0xFFFF are never used
+        static uint16_t nodeIdOf(const uint8_t *mac);
+        uint16_t getNodeId();
+
+        // ACK payload: one or more entries, each acknowledging seq plus up to 32 earlier sequence numbers
+        static constexpr uint8_t ACK_BITMAP_BITS = 32;
+        typedef struct __attribute__((packed)) {
+            uint16_t seq;            // Acknowledged sequence number
+            uint32_t bitmap;         // Bit i set = (seq - 1 - i) is acknowledged too
+        } ack_entry_t;
+        // Entry size: 6 bytes
 
         // ========================================
         // PEER MANAGEMENT
         // ========================================
-        struct PeerInfo {
+        struct PeerInfo {                // Fields ordered by size, so the table carries no padding
             uint8_t mac[6];
+            int8_t rssi;             // Smoothed RSSI of frames heard from this neighbour (dBm), 0 = none yet
+            uint8_t delivery;        // Smoothed share of unicasts the driver confirmed (%), 100 for a new peer
             uint32_t lastSeen;
+            uint32_t slotsHeard;     // Slots of the nodes it hears (last HELLO)
+            uint32_t helloHeardUs;   // esp_timer time its last timed HELLO arrived (low 32 bits)
+            uint16_t helloSeq;       // Seq of that HELLO
+            uint16_t etx;            // Expected transmissions per delivered frame x 100 (100 = lossless)
+            int16_t rssiX16;         // Averages kept in fixed point (internal)
+            uint16_t deliveryX256;
             bool valid;
+            uint8_t failStreak;      // Consecutive failed sends, evicted at linkFailLimit
+            bool poor;               // Below LINK_POOR_PCT and not yet back to LINK_GOOD_PCT: not used as next hop
+            uint8_t masterHops;      // Hops from this neighbour to its nearest MASTER (last HELLO), MASTER_HOPS_NONE = none
+            bool uplinkViaMe;        // Its own uplink is this node: never used as ours (split horizon)
+            bool cached;             // Restored from the peer cache and not heard since boot: one failed send evicts it
+            uint8_t epoch;           // Boot epoch of its last HELLO, 0 = none yet (a change means it rebooted)
+            bool compact;            // Its last HELLO advertised compactHeaders: frames to it may use compact_hdr_t
+            uint8_t slot;            // Its TDMA slot (last HELLO), TDMA_SLOT_NONE = none
+            uint8_t evictedFrames;   // Frames the driver still held when it was evicted from there: not charged to delivery
+            bool helloTimed;         // helloSeq/helloHeardUs hold its last HELLO with a HelloSync
         };
 
+        // Hysteresis on the delivery average: a link is avoided for unicast once it drops below POOR
+        // and used again once it climbs back to GOOD (flooded frames keep probing it meanwhile)
+        static constexpr uint8_t LINK_POOR_PCT = 40;
+        static constexpr uint8_t LINK_GOOD_PCT = 70;
+
         PeerInfo* getPeerTable();        // Access peer table
         uint8_t* getNodeMac();           // Get this node's MAC address
         String macToStr(const uint8_t *mac);  // Helper: MAC to string
 
-        int findPeer(const uint8_t *mac);
-        void touchPeer(const uint8_t *mac);
+        // MASTER gradient: a MASTER advertises 0 in its HELLOs, every REPEATER the best neighbour's distance + 1.
+        // The uplink is the usable neighbour with the fewest hops to a MASTER, ties going to the lower ETX
+        static constexpr uint8_t MASTER_HOPS_NONE = 0xFF;
+        uint32_t getHelloInterval();          // Current Trickle interval (helloInterval when helloIntervalMin is 0)
+        uint8_t getMasterDistance();          // Hops from this node to the nearest MASTER, MASTER_HOPS_NONE if unknown
+        bool getUplink(uint8_t *mac);         // Current uplink towards the nearest MASTER, false if none
+
+        int findPeer(const uint8_t *mac);     // Slot index in getPeerTable(), or -1
+        void touchPeer(const uint8_t *mac, int8_t rssi = 0);   // rssi 0 = not measured
+        void removePeer(size_t slot);         // Drop slot from the table (does not touch the ESP-NOW driver)
+
+        // ========================================
+        // ROUTING
+        // ========================================
+        // Routes are learned from traffic: a packet from src_mac that arrived via neighbour X
+        // after hop_count hops means src_mac is reachable through X in hop_count + 1 hops.
+        // Unicasts use the route when one exists and flood otherwise.
+        struct RouteInfo {
+            uint8_t dest[6];         // Final destination
+            uint8_t nextHop[6];      // Neighbour to hand the packet to
+            uint32_t lastUpdated;
+            uint16_t srtt;           // Smoothed ACK round trip to dest (ms), 0 = not measured yet
+            uint16_t rttvar;         // Round-trip variation (ms)
+            uint8_t hopCount;        // Hops to dest via nextHop
+            bool valid;
+            bool cached;             // Restored from the peer cache: any learned route replaces it
+        };
+
+        struct RouteStats {
+            uint32_t hits;           // Unicasts sent along a learned route
+            uint32_t misses;         // Unicasts flooded because no route was known
+            uint32_t learned;        // Routes added or changed
+            uint32_t expired;        // Routes dropped (timeout or next hop lost)
+            uint32_t uplinkSends;    // sendToMaster frames sent or relayed to an uplink
+            uint32_t uplinkMisses;   // sendToMaster frames flooded because no uplink was known
+        };
+
+        RouteInfo* getRouteTable();           // Access route table (ROUTE_TABLE_SIZE entries, check valid)
+        int findRoute(const uint8_t *dest);   // Slot index in getRouteTable(), or -1
+        size_t getRouteCount();
+        RouteStats getRouteStats();
+        void resetRouteStats();
+
+        // ========================================
+        // STATISTICS
+        // ========================================
+        // All counters are cumulative since boot or the last resetStats()
+        struct MeshStats {
+            uint32_t rxPackets;      // Frames taken from the driver for processing
+            uint32_t delivered;      // Payloads handed to this node's application
+            uint32_t forwarded;      // Frames relayed for other nodes
+            uint32_t flooded;        // Frames sent to every peer (broadcasts, unicasts without a route)
+            uint32_t duplicates;     // Frames dropped as already seen
+            uint32_t hopLimitDrops;  // Frames not relayed because hop_count reached maxHops
+            uint32_t sizeDrops;      // Frames too short, over maxPayload or with a bad payload_len
+            uint32_t sendFailures;   // Frames the driver reported as not delivered (OnDataSent)
+            uint32_t retries;        // Unicast retransmissions
+            uint32_t failedMessages; // Unicasts given up after maxRetries
+            uint32_t peersAdded;
+            uint32_t peersRemoved;   // Pruned for inactivity or evicted after linkFailLimit failed sends
+            uint32_t pendingFull;    // Unicasts sent without retries because every pending slot was taken
+            uint32_t floodSuppressed; // Broadcast relays cancelled (floodCounterK) or skipped (floodForwardPct)
+            uint32_t helloSent;      // HELLO beacons broadcast
+            uint32_t helloSuppressed; // Beacons skipped because helloRedundancy neighbours had beaconed
+            uint32_t driverAdds;     // Neighbours registered with the ESP-NOW driver for a send
+            uint32_t driverEvictions; // Least recently used neighbours deleted from the driver to make room
+            uint32_t compactSent;    // Frames sent with a compact header
+            uint32_t idMisses;       // Compact frames dropped: a node ID this node can't resolve
+            uint32_t idConflicts;    // Node IDs found shared by two MACs (then always sent as MACs)
+            uint32_t mailboxHeld;    // Frames held for a sleeping LEAF neighbour
+            uint32_t mailboxDropped; // Held frames given up (the LEAF didn't wake in time) or refused (mailbox full)
+        };
+
+        MeshStats getStats();
+        void resetStats();
+
+        // Received by a MASTER from nodes with telemetryInterval set
+        struct TelemetryReport {
+            NodeRole role;
+            uint8_t peers;           // Valid peer table entries
+            uint8_t routes;          // Learned routes
+            uint32_t uptimeMs;       // Sender's millis()
+            MeshStats stats;
+        };
+
+        typedef void (*TelemetryCallback)(const uint8_t *src_mac, const TelemetryReport &report);
+        void setTelemetryCallback(TelemetryCallback cb);
+
+        // ========================================
+        // DELIVERY REPORTS
+        // ========================================
+        // Every unicast sent without MSG_TYPE_NO_ACK ends in exactly one report: delivered when an ACK
+        // arrives, failed after maxRetries retransmissions went unanswered
+        struct SendResult {
+            uint8_t dest_mac[6];
+            uint16_t seq;            // Matches getLastSeq() right after the sendData() call (first fragment when fragmented)
+            bool delivered;
+            uint8_t attempts;        // Transmissions made, 1 = ACKed without a retry (fragmented: sum over fragments)
+            uint32_t rttMs;          // First transmission to ACK (0 when failed)
+        };
+
+        typedef void (*SendCallback)(const SendResult &result);
+        void setSendCallback(SendCallback cb);   // Called from checkPendingMessages(), never from the WiFi task
+        uint16_t getLastSeq();                   // Sequence number of the last frame sendData() built
+
+        // ========================================
+        // PACKET BUFFER POOL
+        // ========================================
+        struct PacketPoolStats {
+            uint8_t inUse;           // Buffers currently taken
+            uint8_t highWater;       // Most buffers ever taken at once
+            uint32_t exhausted;      // Packets dropped because every buffer was taken
+        };
+
+        PacketPoolStats getPacketPoolStats();
+
+        // ========================================
+        // RECEIVE QUEUE (RX_POLL / RX_TASK)
+        // ========================================
+        struct RxQueueStats {
+            uint16_t depth;          // Packets waiting right now
+            uint16_t highWater;      // Deepest the queue has been
+            uint32_t enqueued;       // Packets accepted by the callback
+            uint32_t dropped;        // Packets lost because the queue was full
+            uint32_t processed;
+            uint32_t maxLatencyUs;   // Longest callback-to-processing delay
+            uint32_t avgLatencyUs;   // Mean callback-to-processing delay
+        };
+
+        RxQueueStats getRxQueueStats();
+        void resetRxQueueStats();
+
+        // ========================================
+        // TRANSMIT QUEUE (txMaxInFlight)
+        // ========================================
+        // Every frame, own or forwarded, is classified by its header and sent in this order
+        enum TxClass : uint8_t {
+            TX_ACK,         // ACKs, own and relayed
+            TX_CONTROL,     // HELLO beacons, telemetry
+            TX_APP,         // Own messages, fragments and retries
+            TX_FORWARD,     // Frames relayed for other nodes
+            TX_CLASS_COUNT
+        };
+
+        struct TxQueueStats {
+            uint8_t inFlight;                        // Frames the driver has not reported yet
+            uint8_t depth[TX_CLASS_COUNT];           // Frames waiting right now
+            uint8_t highWater[TX_CLASS_COUNT];       // Deepest each class has been
+            uint32_t dropped[TX_CLASS_COUNT];        // Frames lost to a full queue (TX_APP: refused to the sender)
+            uint32_t sent;                           // Frames handed to the driver
+            uint32_t queued;                         // ... of which waited for a send callback first
+            uint32_t driverErrors;                   // esp_now_send() refusals
+            uint32_t stalls;                         // In-flight count reset after a lost send callback
+            uint32_t maxWaitUs;                      // Longest time a frame waited in the queue
+            uint32_t avgWaitUs;                      // Mean over queued frames
+        };
+
+        TxQueueStats getTxQueueStats();
+        void resetTxQueueStats();
+
+        // ========================================
+        // TIME SYNC (timeSync / tdmaSlots)
+        // ========================================
+        // Mesh time is a MASTER's esp_timer clock in microseconds; with several MASTERs each node follows its nearest.
+        // Each HELLO carries the sender's mesh time at the send report of its previous one; the receiver pairs that with
+        // when it heard the previous HELLO and fits offset and drift over the last SYNC_SAMPLES pairs from its uplink
+        struct SyncStatus {
+            bool synced;             // Following a MASTER with a drift estimate (a MASTER always is)
+            uint8_t hops;            // Hops to that MASTER, MASTER_HOPS_NONE when not synced
+            int32_t driftPpb;        // Rate of mesh time against the local clock, minus 1 (parts per billion)
+            int32_t lastOffsetUs;    // Last uplink timestamp minus this node's mesh time at the same moment
+            uint32_t samples;        // Uplink timestamps paired with a reception
+            uint32_t steps;          // Clock set outright: first stamp, or off by more than SYNC_STEP_US
+            uint32_t outliers;       // Pairs left out of a fit (SYNC_OUTLIER_US)
+            uint8_t slot;            // TDMA slot, TDMA_SLOT_NONE = none
+            uint32_t slotChanges;    // Slots given up for a neighbour's or a neighbour's neighbour's
+        };
+
+        static constexpr uint8_t TDMA_MAX_SLOTS = 32;      // Slots are advertised in 32-bit maps
+        static constexpr uint8_t TDMA_SLOT_NONE = 0xFF;
+        static constexpr uint32_t SYNC_STEP_US = 5000;
+
+        uint64_t getMeshTimeUs();            // Mesh time now; the local clock until synced
+        bool isTimeSynced();
+        SyncStatus getSyncStatus();
 
         // ========================================
         // LOW-LEVEL SEND (Advanced Users)
@@ -168,68 +742,718 @@ class ENowMesh {
         // ========================================
         // STATIC CALLBACKS (Internal Use)
         // ========================================
+        // The ESP-NOW driver has a single send/recv callback without a context
+        // pointer, so these dispatch to the instance that last called registerCallbacks()
         static void OnDataSent(const esp_now_send_info_t *info, esp_now_send_status_t status);
         static void OnDataRecv(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len);
 
+        // Per-instance handlers behind the static callbacks
+        // Host-side harnesses (extras/sim) call these directly to run many meshes in one process
+        void handleDataSent(const esp_now_send_info_t *info, esp_now_send_status_t status);
+        void handleDataRecv(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len);
+
         // ========================================
         // USER CALLBACK
         // ========================================
         // Called when a message destined for this node is received
         typedef void (*MessageCallback)(const uint8_t *src_mac, const char *payload, size_t len);
         void setMessageCallback(MessageCallback cb);
+        // payload is a NUL-terminated copy, so text messages can be used as C strings
+
+        // Header fields of a received frame, passed alongside the payload view
+        struct RxInfo {
+            const uint8_t *src_mac;   // Original sender
+            const uint8_t *dest_mac;  // Unicast: this node; broadcast/role traffic: FF:FF:FF:FF:FF:FF
+            const uint8_t *from_mac;  // Immediate sender (last hop)
+            uint16_t seq;
+            uint8_t hop_count;        // Forwards taken to reach this node (0 = direct from src)
+            uint8_t msg_type;         // MSG_TYPE_* flags as sent
+            int8_t rssi;              // Of the last hop, 0 if unknown
+        };
+
+        // Called with a view into the received frame: no copy, no terminator.
+        // info and payload are only valid until the callback returns; copy what must outlive it.
+        // Can be set together with the MessageCallback (both are called).
+        typedef void (*ReceiveCallback)(const RxInfo &info, const uint8_t *payload, size_t len);
+        void setReceiveCallback(ReceiveCallback cb);
 
     private:
         // ========================================
         // INTERNAL STRUCTURES
         // ========================================
+
+        // Occupancy bitmap, bit i set = slot i live. Sweeps visit only the live slots, found with
+        // count-trailing-zeros, instead of loading every slot to test a flag in it:
+        //   for (int i : bitmap) ...
+        // Each 32-slot word is read once, when the sweep reaches it, so freeing the current slot
+        // (or an earlier one) mid-sweep is safe
+        template <size_t SLOTS>
+        struct SlotBitmap {
+            static constexpr size_t WORDS = (SLOTS + 31) / 32;
+            uint32_t word[WORDS];
+
+            void clearAll() { for (size_t w = 0; w < WORDS; ++w) word[w] = 0; }
+            void set(size_t i) { word[i / 32] |= 1u << (i % 32); }
+            void clear(size_t i) { word[i / 32] &= ~(1u << (i % 32)); }
+            bool test(size_t i) const { return (word[i / 32] >> (i % 32)) & 1u; }
+
+            struct Iterator {
+                const uint32_t *word;
+                size_t w;
+                uint32_t bits;           // Live slots of word w not visited yet
+                int operator*() const { return (int)(w * 32 + __builtin_ctz(bits)); }
+                Iterator &operator++() { bits &= bits - 1; skip(); return *this; }
+                bool operator!=(const Iterator &o) const { return w != o.w; }
+                void skip() { while (!bits && ++w < WORDS) bits = word[w]; }
+            };
+            Iterator begin() const { Iterator it{word, 0, word[0]}; it.skip(); return it; }
+            Iterator end() const { return Iterator{word, WORDS, 0}; }
+
+            // Lowest free slot below limit, -1 if none
+            int firstFree(size_t limit) const {
+                if (limit > SLOTS) limit = SLOTS;
+                for (size_t w = 0; w < WORDS && w * 32 < limit; ++w) {
+                    uint32_t bits = ~word[w];
+                    if (!bits) continue;
+                    size_t i = w * 32 + __builtin_ctz(bits);
+                    return i < limit ? (int)i : -1;
+                }
+                return -1;
+            }
+        };
+
+        // Open-addressing hash index (linear probing) from MAC to table slot, plus the bitmap of used slots.
+        // Keys live in the indexed table itself (or a key array beside it): the MAC of slot i is at keys + i * stride.
+        template <size_t BUCKETS, size_t SLOTS>
+        struct MacIndex {
+            static_assert((BUCKETS & (BUCKETS - 1)) == 0, "index size must be a power of two");
+            static_assert(BUCKETS >= 2 * SLOTS, "index size must be at least 2x the table size");
+            static_assert(SLOTS < 0x7FFF, "table too large for 16-bit slot numbers");
+
+            int16_t bucket[BUCKETS];        // Slot number, -1 = empty bucket
+            SlotBitmap<SLOTS> used;         // Slots holding a key: table sweeps visit only these
+            uint16_t freeCount;
+
+            static uint16_t home(const uint8_t *mac) {
+                // The vendor OUI (first 3 bytes) is shared by most nodes, so mix mostly the NIC-specific bytes
+                uint32_t x = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+                x ^= ((uint32_t)mac[0] << 8) | mac[1];
+                x *= 0x9E3779B1u;
+                return (uint16_t)((x >> 16) & (BUCKETS - 1));
+            }
+
+            void reset() {
+                for (size_t b = 0; b < BUCKETS; ++b) bucket[b] = -1;
+                used.clearAll();
+                freeCount = SLOTS;
+            }
+
+            int find(const uint8_t *mac, const uint8_t *keys, size_t stride) const {
+                for (uint16_t b = home(mac);; b = (b + 1) & (BUCKETS - 1)) {
+                    int16_t slot = bucket[b];
+                    if (slot < 0) return -1;
+                    if (memcmp(keys + slot * stride, mac, 6) == 0) return slot;
+                }
+            }
+
+            // Takes the lowest free slot and files it under mac; the caller then writes the key into that slot
+            int insert(const uint8_t *mac) {
+                if (freeCount == 0) return -1;
+                uint16_t slot = (uint16_t)used.firstFree(SLOTS);
+                used.set(slot);
+                freeCount--;
+                uint16_t b = home(mac);
+                while (bucket[b] >= 0) b = (b + 1) & (BUCKETS - 1);  // Never full: 2x the table
+                bucket[b] = (int16_t)slot;
+                return slot;
+            }
+
+            // Backward-shift deletion keeps probe runs intact without tombstones
+            void remove(size_t slot, const uint8_t *keys, size_t stride) {
+                const uint16_t mask = BUCKETS - 1;
+                uint16_t hole = home(keys + slot * stride);
+                while (bucket[hole] != (int16_t)slot) hole = (hole + 1) & mask;
+                for (uint16_t j = (hole + 1) & mask; bucket[j] >= 0; j = (j + 1) & mask) {
+                    uint16_t h = home(keys + bucket[j] * stride);
+                    bool movable = (hole <= j) ? (h <= hole || h > j) : (h <= hole && h > j);
+                    if (movable) {
+                        bucket[hole] = bucket[j];
+                        hole = j;
+                    }
+                }
+                bucket[hole] = -1;
+                used.clear(slot);
+                freeCount++;
+            }
+        };
         
-        // Duplicate detection
-        struct SeenPacket {
-            uint8_t src_mac[6];
-            uint16_t seq;
-            uint32_t timestamp;
+        // Duplicate detection: per source, the highest seq seen and a bitmap of the 32 before it.
+        // The MAC keys and lastSeen times the lookups and sweeps read are kept in arrays of their own
+        // Sources number ACKed unicasts apart from their other frames (seqAcked()), so each gets a window per space
+        struct SeenSource {
+            uint8_t epoch;
+            uint8_t started;         // Bit per space: highSeq[space] and window[space] hold a frame
+            uint16_t highSeq[2];     // [0] other frames, [1] ACKed unicasts
+            uint32_t window[2];      // Bit i set = (highSeq - 1 - i) already seen
+        };
+        struct LateSeen {
+            uint8_t mac[6];
+            uint8_t epoch;
             bool valid;
+            uint16_t seq;
+            uint32_t time;           // millis() it left the window, or arrived behind it
+        };
+        enum SeenResult : uint8_t {
+            SEEN_NEW,
+            SEEN_DUPLICATE,
+            SEEN_STALE               // Not an ACKed unicast and further behind highSeq than the window: new or duplicate can't be told
         };
         
         // Pending message tracking (for ACK/retry)
+        enum PendingState : uint8_t {
+            PENDING_FREE,
+            PENDING_WAITING,         // Sent, no ACK yet
+            PENDING_DELIVERED,       // ACKed, report not yet handed to the send callback
+            PENDING_FAILED           // Fragment out of retries, not yet handed to its transfer
+        };
+
+        // Hot metadata only: the frames kept for retransmission are in pendingFrames, which the ACK
+        // and timer sweeps never touch, and which slots are in use or waiting is in two bitmaps
         struct PendingMessage {
             uint8_t dest_mac[6];
             uint16_t seq;
-            uint32_t sendTime;
+            uint32_t firstSendTime;
+            uint32_t sendTime;       // Last (re)transmission
+            uint32_t timeout;        // Wait after sendTime before the next attempt (backed off)
+            uint32_t rto;            // Adaptive timeout for dest when first sent
+            uint32_t rttMs;          // Set on ACK
             uint8_t retryCount;
-            char payload[233];  // Max: 250 - 17 byte header
-            uint8_t payloadLen;
-            bool waiting;
+            PendingState state;
+            uint8_t frameLen;
+            int8_t fragSlot;         // Outgoing transfer this fragment belongs to, -1 for a whole message
+            uint8_t fragIndex;
+            uint16_t fragMsgId;      // Guards against a transfer slot reused since this fragment was sent
+            bool held;               // Waits in a sleeping LEAF's mailbox: its ACK gives no RTT sample
+        };
+
+        // Follows the CTRL_FRAGMENT kind byte. Every fragment but the last carries
+        // ceil(totalLen / count) bytes, so the offset is index times that
+        struct __attribute__((packed)) FragmentHeader {
+            uint16_t msgId;
+            uint16_t totalLen;
+            uint8_t index;
+            uint8_t count;
+        };
+        static constexpr size_t FRAG_OVERHEAD = 1 + sizeof(FragmentHeader);
+
+        enum FragTxState : uint8_t {
+            FRAG_FREE,
+            FRAG_SENDING,
+            FRAG_DONE                // Ended, report not yet handed to the send callback
+        };
+
+        // Large message being sent; fragTxBusy must be held to touch it
+        struct FragTx {
+            uint8_t dest_mac[6];
+            uint8_t msg_type;
+            FragTxState state;
+            bool delivered;          // FRAG_DONE: outcome
+            bool unicast;            // dest_mac is valid, else the fragments are broadcast
+            bool acked;              // Fragments wait for ACKs, else they count as done once sent
+            uint16_t msgId;
+            uint16_t totalLen;
+            uint8_t count;
+            uint8_t nextIndex;       // First fragment not sent yet
+            uint8_t inFlight;        // Sent, awaiting ACK or failure
+            uint16_t firstSeq;       // Reported as SendResult.seq
+            uint16_t attempts;
+            uint32_t startTime;
+            uint32_t rttMs;          // FRAG_DONE: first fragment sent to last one ACKed
+            uint64_t done;           // Bit i set = fragment i ACKed
+            uint8_t data[FRAG_MAX_MESSAGE_SIZE];
+        };
+
+        // Large message being reassembled
+        struct FragRx {
+            uint8_t src_mac[6];
+            bool active;
+            uint16_t msgId;
+            uint16_t totalLen;
+            uint8_t count;
+            uint8_t received;
+            uint32_t lastTime;       // Last new fragment, for fragTimeout
+            uint64_t have;           // Bit i set = fragment i stored
+            uint8_t data[FRAG_MAX_MESSAGE_SIZE + 1];  // +1 for the NUL handed to the MessageCallback
+        };
+
+        // Small messages held for aggregateDelayMs; data is a complete CTRL_BUNDLE payload
+        struct AggBundle {
+            uint8_t dest_mac[6];     // Final destination; all 0xFF for broadcasts
+            uint8_t msg_type;        // Of the aggregated messages, CONTROL is added when sent
+            bool valid;
+            uint16_t seq;            // Taken when the bundle opens, so getLastSeq() matches its SendResult
+            uint32_t firstTime;      // When the oldest record was added
+            uint8_t count;
+            uint8_t len;
+            uint8_t data[ESP_NOW_MAX_IE_DATA_LEN];
+        };
+
+        // Broadcast relay waiting out its backoff (floodCounterK)
+        struct FloodHold {
+            uint8_t src_mac[6];
+            uint8_t exclude[6];      // Neighbour it came from
+            uint16_t seq;
+            uint8_t epoch;
+            uint8_t heard;           // Copies received so far
+            bool valid;
+            uint8_t len;
+            uint32_t dueTime;
+            uint8_t frame[ESP_NOW_MAX_IE_DATA_LEN];   // Ready to send, hop_count already incremented
+        };
+
+        // ACKs held back for coalescing, one entry per sender being acknowledged
+        struct PendingAck {
+            uint8_t dest_mac[6];
+            uint32_t firstTime;      // When the oldest held seq arrived
+            uint16_t seqs[ACK_COALESCE_MAX];
+            uint8_t count;
+            bool valid;
         };
 
         // User message callback
         MessageCallback userCallback = nullptr;
+        ReceiveCallback receiveCallback = nullptr;
+        SendCallback sendCallback = nullptr;
+        TelemetryCallback telemetryCallback = nullptr;
+
+        // Counter slots behind MeshStats, in field order
+        enum StatId : uint8_t {
+            STAT_RX, STAT_DELIVERED, STAT_FORWARDED, STAT_FLOODED, STAT_DUPLICATES, STAT_HOP_LIMIT,
+            STAT_SIZE_DROPS, STAT_SEND_FAILURES, STAT_RETRIES, STAT_FAILED_MESSAGES, STAT_PEERS_ADDED,
+            STAT_PEERS_REMOVED, STAT_PENDING_FULL, STAT_FLOOD_SUPPRESSED, STAT_HELLO_SENT,
+            STAT_HELLO_SUPPRESSED, STAT_DRIVER_ADDS, STAT_DRIVER_EVICTIONS, STAT_COMPACT_SENT, STAT_ID_MISSES,
+            STAT_ID_CONFLICTS, STAT_MAILBOX_HELD, STAT_MAILBOX_DROPPED,
+            STAT_COUNT
+        };
+        static_assert(sizeof(MeshStats) == STAT_COUNT * sizeof(uint32_t), "MeshStats must mirror StatId");
+        static constexpr uint8_t TELEMETRY_VERSION = 6;   // Bump with every counter appended to StatId
+
+        // HELLO payload: "HELLO:<role>", a NUL, then the sender's MASTER gradient (older nodes send the text only)
+        static constexpr uint8_t UPLINK_CANDIDATES = 3;   // Uplinks tried in turn when the driver refuses a send
+        static constexpr uint32_t HELLO_MIN_GAP_MS = 1000; // Triggered HELLOs without Trickle are at least this far apart
+        struct __attribute__((packed)) HelloGradient {
+            uint8_t masterHops;      // Sender's distance to the nearest MASTER, MASTER_HOPS_NONE = none
+            uint8_t uplink[6];       // Sender's uplink, all zero if none or a MASTER
+        };
+        // After the gradient, from nodes with compactHeaders or timeSync set
+        static constexpr uint8_t HELLO_COMPACT = 0x01;
+        static constexpr uint8_t HELLO_SYNC = 0x02;       // HelloSync follows
+        static constexpr uint8_t HELLO_ID_CONFLICTS = 2;
+        struct __attribute__((packed)) HelloIds {
+            uint8_t flags;           // HELLO_COMPACT: the sender decodes compact headers
+            uint16_t conflicts[HELLO_ID_CONFLICTS];   // Node IDs it knows two MACs for, 0 = none
+        };
+        // Last in the HELLO, so driverSend() finds it at the end of the frame
+        static constexpr uint8_t SYNC_SYNCED = 0x01;
+        static constexpr uint8_t SYNC_FOLLOW_UP = 0x02;
+        struct __attribute__((packed)) HelloSync {
+            uint8_t flags;           // SYNC_SYNCED: meshTimeUs follows a MASTER; SYNC_FOLLOW_UP: prevEndUs did too
+            uint8_t slot;            // Sender's TDMA slot, TDMA_SLOT_NONE = none
+            uint32_t slotsHeard;     // Slots of the nodes it hears, its own included
+            uint32_t slotsShared;    // Slots it hears from two nodes: their owners pick again
+            uint16_t prevSeq;        // Sender's previous HELLO
+            uint64_t prevEndUs;      // Sender's mesh time when the driver reported that HELLO sent
+            uint64_t meshTimeUs;     // This frame's end on air as estimated when it went to the driver
+        };
+        static constexpr uint8_t SYNC_SAMPLES = 8;
+        static constexpr uint32_t SYNC_DRIFT_SPAN_MS = 20000;   // Pairs spanning less give no drift estimate yet
+        static constexpr int32_t SYNC_DRIFT_MAX_PPB = 50000;    // Crystals are within +-50ppm of each other
+        static constexpr uint32_t SYNC_OUTLIER_US = 200;        // Pairs off the fit by less are always kept
+        static constexpr uint32_t TDMA_GUARD_US = 500;          // Kept clear at both ends of a slot for sync error
+        struct SyncSample {
+            int64_t localUs;         // esp_timer time a HELLO arrived
+            int64_t meshUs;          // Uplink's prevEndUs for it
+        };
+
+        // Mailboxes for sleeping LEAF neighbours. A LEAF registers with every MASTER/REPEATER in range each time it
+        // wakes (CTRL_POLL); until awakeUntil passes it is sent to directly, after that its unicasts are held
+        struct __attribute__((packed)) MailboxPoll {
+            uint32_t sleepMs;        // Sender's sleepIntervalMs
+            uint16_t awakeMs;        // How long it listens from now
+        };
+        struct __attribute__((packed)) MailboxHeld {
+            uint8_t dest[6];         // The sleeping LEAF
+            uint16_t seq;            // Held frame, as numbered by its source
+            uint32_t holdMs;         // How long it is kept
+        };
+        struct Sleeper {
+            uint8_t mac[6];
+            uint16_t awakeMs;
+            uint32_t sleepMs;
+            uint32_t lastHeard;      // Last poll or frame from it
+            uint32_t awakeUntil;
+        };
+        struct MailboxFrame {
+            uint8_t leaf[6];
+            uint8_t len;
+            uint32_t heldAt;
+            uint32_t expires;
+            uint8_t frame[ESP_NOW_MAX_IE_DATA_LEN];
+        };
+
+        // Node ID table (compactHeaders). knownBy lists neighbours that sent this node compact frames naming
+        // the entry: they have it in their own table, so frames to them may carry its ID
+        static constexpr uint8_t NODE_ID_KNOWN_BY = 3;
+        static constexpr uint8_t NODE_ID_HEARD_CONFLICTS = 4;
+        struct NodeIdEntry {
+            uint8_t mac[6];
+            uint16_t id;
+            uint32_t lastUsed;
+            uint16_t knownBy[NODE_ID_KNOWN_BY];   // Node IDs of those neighbours, 0 = none
+            bool conflict;           // Another known MAC has the same ID: never sent or resolved as an ID
+        };
+
+        // Peer cache records, one NVS blob per table
+        static constexpr uint8_t PEER_CACHE_VERSION = 1;
+        struct __attribute__((packed)) CachedPeer {
+            uint8_t mac[6];
+            uint8_t masterHops;
+            uint8_t uplinkViaMe;
+        };
+        struct __attribute__((packed)) CachedRoute {
+            uint8_t dest[6];
+            uint8_t nextHop[6];
+            uint8_t hopCount;
+        };
+
+        // Telemetry payload (after the CTRL_TELEMETRY kind byte), little-endian as on the ESP32.
+        // Counters are only ever appended: a shorter report from an older version has the newer ones zeroed
+        struct __attribute__((packed)) TelemetryPayload {
+            uint8_t version;
+            uint8_t role;
+            uint8_t peers;
+            uint8_t routes;
+            uint32_t uptimeMs;
+            uint32_t counters[STAT_COUNT];
+        };
+
+        // Received frame parked between the driver callback and processing
+        struct RxSlot {
+            uint8_t src[6];
+            uint8_t dest[6];
+            wifi_pkt_rx_ctrl_t rxCtrl;
+            uint32_t enqueuedUs;
+            uint16_t len;
+            uint8_t data[ESP_NOW_MAX_IE_DATA_LEN];
+        };
+
+        struct TxSlot {
+            uint8_t mac[6];          // Driver address: next hop, peer or broadcast
+            uint8_t len;
+            uint8_t next;            // Next slot in its class FIFO or the free list, TX_NONE at the end
+            uint32_t enqueuedUs;
+            uint8_t data[ESP_NOW_MAX_IE_DATA_LEN];
+        };
+        static constexpr uint8_t TX_NONE = 0xFF;
+        static constexpr uint32_t TX_STALL_MS = 1000;   // No send callback for this long: assume it was lost
+        static_assert(TX_QUEUE_SIZE >= 1 && TX_QUEUE_SIZE < TX_NONE, "TX_QUEUE_SIZE must be 1..254");
+
+        static constexpr size_t PACKET_BUFFER_SIZE = ESP_NOW_MAX_IE_DATA_LEN + 1;  // +1 for the NUL handed to callbacks
+        static_assert(PACKET_POOL_SIZE >= 1 && PACKET_POOL_SIZE <= 32, "PACKET_POOL_SIZE must be 1..32");
 
         // ========================================
-        // STATIC STORAGE
+        // INSTANCE STORAGE
         // ========================================
-        static PeerInfo peersStatic[PEER_TABLE_SIZE];
-        static uint8_t myMacStatic[6];
-        static ENowMesh* instance;
-        static uint16_t sequenceCounter;
-        
-        static SeenPacket seenPacketsStatic[DUP_DETECT_BUFFER_SIZE];
-        static uint16_t seenPacketsIndex;
-        static portMUX_TYPE seenPacketsMux;
-        
-        static PendingMessage pendingMessages[MAX_PENDING_MESSAGES];
-        static portMUX_TYPE pendingMux;
+        static ENowMesh* instance;  // Target of the static driver callbacks
+
+        PeerInfo peers[PEER_TABLE_SIZE] = {};
+        MacIndex<PEER_INDEX_SIZE, PEER_TABLE_SIZE> peerIndex;
+        portMUX_TYPE peersMux = portMUX_INITIALIZER_UNLOCKED;
+
+        // Neighbours currently registered with the ESP-NOW driver, LRU by use tick
+        struct DriverPeer {
+            uint8_t mac[6];
+            uint8_t inDriver;        // Frames handed to esp_now_send() and not yet reported
+            uint32_t lastUsed;
+        };
+        DriverPeer driverPeers[DRIVER_PEER_SLOTS] = {};
+        SlotBitmap<DRIVER_PEER_SLOTS> driverPeerUsed = {};
+        uint32_t driverPeerTick = 0;
+        portMUX_TYPE driverPeersMux = portMUX_INITIALIZER_UNLOCKED;
+        uint8_t myMac[6] = {};
+
+        NodeIdEntry nodeIds[NODE_ID_TABLE_SIZE] = {};
+        MacIndex<NODE_ID_INDEX_SIZE, NODE_ID_TABLE_SIZE> nodeIdIndex;
+        uint16_t heardIdConflicts[NODE_ID_HEARD_CONFLICTS] = {};   // From neighbours' HELLOs, oldest replaced
+        uint8_t heardIdConflictNext = 0;
+        uint32_t nodeIdTick = 0;
+        portMUX_TYPE nodeIdMux = portMUX_INITIALIZER_UNLOCKED;
+
+        // Lock-free pool: bit i of packetPoolUsed set = buffer i taken
+        alignas(4) uint8_t packetPool[PACKET_POOL_SIZE][PACKET_BUFFER_SIZE];
+        std::atomic<uint32_t> packetPoolUsed{0};
+        std::atomic<uint32_t> packetPoolHighWater{0};
+        std::atomic<uint32_t> packetPoolExhausted{0};
+
+        // Single-producer (driver callback) / single-consumer (poll or RX task) ring
+        RxSlot rxQueue[RX_QUEUE_SIZE];
+        std::atomic<uint16_t> rxHead{0};   // Next slot to write (producer only)
+        std::atomic<uint16_t> rxTail{0};   // Next slot to read (consumer only)
+        std::atomic<uint32_t> rxDropped{0};
+        std::atomic<uint32_t> rxEnqueued{0};   // Producer-written, but read and reset from the app
+        std::atomic<uint16_t> rxHighWater{0};
+        uint32_t rxProcessed = 0;          // Consumer-owned counters
+        uint32_t rxMaxLatencyUs = 0;
+        uint64_t rxTotalLatencyUs = 0;
+        TaskHandle_t rxTaskHandle = nullptr;
+
+        // Per-class FIFOs linked through one slot array, all guarded by txMux
+        TxSlot txSlots[TX_QUEUE_SIZE];
+        uint8_t txHead[TX_CLASS_COUNT];
+        uint8_t txTail[TX_CLASS_COUNT];
+        uint8_t txCount[TX_CLASS_COUNT] = {};
+        uint8_t txFree = TX_NONE;
+        uint8_t txInFlight = 0;
+        uint32_t txLastEventMs = 0;    // Last hand-off to or callback from the driver
+        uint8_t txHighWater[TX_CLASS_COUNT] = {};
+        uint32_t txDropped[TX_CLASS_COUNT] = {};
+        uint32_t txSent = 0;
+        uint32_t txQueued = 0;
+        uint32_t txDriverErrors = 0;
+        uint32_t txStalls = 0;
+        uint32_t txMaxWaitUs = 0;
+        uint64_t txTotalWaitUs = 0;
+        portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED;
+
+        RouteInfo routes[ROUTE_TABLE_SIZE] = {};
+        MacIndex<ROUTE_INDEX_SIZE, ROUTE_TABLE_SIZE> routeIndex;
+        RouteStats routeStats = {};
+        portMUX_TYPE routesMux = portMUX_INITIALIZER_UNLOCKED;
+
+        uint8_t seenMacs[DUP_SOURCE_TABLE_SIZE][6] = {};   // Index keys
+        uint32_t seenLastSeen[DUP_SOURCE_TABLE_SIZE] = {};
+        SeenSource seenSources[DUP_SOURCE_TABLE_SIZE] = {};
+        MacIndex<DUP_SOURCE_INDEX_SIZE, DUP_SOURCE_TABLE_SIZE> seenIndex;
+        LateSeen lateSeen[LATE_SEEN_SIZE] = {};
+        portMUX_TYPE seenMux = portMUX_INITIALIZER_UNLOCKED;
+
+        PendingMessage pendingMessages[MAX_PENDING_MESSAGES] = {};
+        SlotBitmap<MAX_PENDING_MESSAGES> pendingUsed = {};      // Slots not PENDING_FREE
+        SlotBitmap<MAX_PENDING_MESSAGES> pendingWaiting = {};   // PENDING_WAITING slots
+        alignas(4) uint8_t pendingFrames[MAX_PENDING_MESSAGES][ESP_NOW_MAX_IE_DATA_LEN];   // Original frames, resent with the same seq
+        portMUX_TYPE pendingMux = portMUX_INITIALIZER_UNLOCKED;
+
+        PendingAck ackQueue[ACK_QUEUE_SIZE] = {};
+        portMUX_TYPE ackMux = portMUX_INITIALIZER_UNLOCKED;
+
+        std::atomic<uint32_t> stats[STAT_COUNT] = {};
+
+        FragTx fragTx[FRAG_TX_SLOTS] = {};
+        std::atomic<bool> fragTxBusy{false};   // Try-lock only: servicing skips a round, startTransfer() fails
+        FragRx fragRx[FRAG_RX_SLOTS] = {};
+        uint16_t fragMsgCounter = 0;   // Random start at boot, like seqCounter
+
+        FloodHold floodHolds[FLOOD_HOLD_SIZE] = {};
+        std::atomic<uint8_t> floodHeld{0};    // Valid entries, lets the receive path skip the scan
+        portMUX_TYPE floodMux = portMUX_INITIALIZER_UNLOCKED;
+
+        AggBundle aggQueue[AGG_QUEUE_SIZE] = {};
+        portMUX_TYPE aggMux = portMUX_INITIALIZER_UNLOCKED;
+
+        Sleeper sleepers[MAILBOX_LEAVES] = {};
+        SlotBitmap<MAILBOX_LEAVES> sleeperUsed = {};
+        std::atomic<uint8_t> sleeperCount{0};   // Registered sleepers, lets the send and receive paths skip the lock
+        MailboxFrame mailbox[MAILBOX_SIZE] = {};
+        SlotBitmap<MAILBOX_SIZE> mailboxUsed = {};
+        portMUX_TYPE mailboxMux = portMUX_INITIALIZER_UNLOCKED;
+
+        // Mesh time = syncRefMesh + (local - syncRefLocal) x (1 + syncDriftPpb / 1e9)
+        SyncSample syncSamples[SYNC_SAMPLES] = {};
+        uint8_t syncSampleCount = 0;
+        uint8_t syncSampleNext = 0;
+        bool syncValid = false;           // syncRef set: stepped to a stamp at least once
+        int64_t syncRefLocal = 0;
+        int64_t syncRefMesh = 0;
+        int32_t syncDriftPpb = 0;
+        bool synced = false;
+        uint8_t syncHops = MASTER_HOPS_NONE;
+        uint32_t syncLastHeard = 0;       // millis() of the last uplink HelloSync
+        int32_t syncLastOffsetUs = 0;
+        uint32_t syncSamplesTaken = 0;
+        uint32_t syncSteps = 0;
+        uint32_t syncOutliers = 0;
+        uint8_t tdmaSlot = TDMA_SLOT_NONE;
+        bool tdmaRepick = false;          // A neighbour claims our slot: pick another before the next HELLO
+        uint32_t tdmaPickedAt = 0;
+        uint32_t tdmaSlotChanges = 0;
+        portMUX_TYPE syncMux = portMUX_INITIALIZER_UNLOCKED;
+        uint32_t driverSent = 0;          // Frames esp_now_send() accepted and send reports, while syncEnabled():
+        uint32_t driverReported = 0;      // reports come in send order, so a count finds our HELLO's
+        bool helloAwaiting = false;       // Own HELLO with the driver, the driverSent-th frame
+        uint32_t helloSendIdx = 0;
+        uint16_t helloSendSeq = 0;
+        bool helloEndValid = false;       // helloEndMeshUs is mesh time at its send report (for SYNC_FOLLOW_UP)
+        uint16_t helloEndSeq = 0;
+        int64_t helloEndMeshUs = 0;
+        esp_timer_handle_t slotTimer = nullptr;   // Wakes txPump() at the start of our slot
+        uint32_t rxHeardUs = 0;           // micros() of the driver callback for the frame being processed
 
         // ========================================
         // INTERNAL STATE
         // ========================================
-        NodeRole role = ROLE_MASTER;
+        NodeRole role = FORWARDING ? ROLE_MASTER : ROLE_LEAF;
         uint32_t lastHelloTime = 0;  // Track last HELLO beacon time
+        uint8_t advertisedMasterHops = MASTER_HOPS_NONE;   // Gradient sent in the last HELLO
+        std::atomic<bool> helloSoon{false};  // Fixed schedule: send the next HELLO after HELLO_MIN_GAP_MS
+        // Trickle state (RFC 6206): interval length, its start, the beacon time within it and the HELLOs heard
+        uint32_t trickleInterval = 0;   // 0 = not started
+        uint32_t trickleStart = 0;
+        uint32_t trickleFireAt = 0;     // Offset from trickleStart, drawn from [I/2, I)
+        uint8_t trickleHeard = 0;
+        bool trickleFired = false;
+        portMUX_TYPE helloMux = portMUX_INITIALIZER_UNLOCKED;
+        uint32_t lastPeerCacheSave = 0;
+        uint32_t peerCacheHash = 0;      // Of the last snapshot written, to skip unchanged ones
+        uint32_t lastTelemetryTime = 0;
+        uint32_t telemetryDelay = 0;    // Jittered wait before the next report; 0 = not yet drawn
+        uint16_t lastSeq = 0;
+        std::atomic<uint16_t> seqCounter{0};  // Next seq to send, random start at boot
+        std::atomic<uint16_t> ackedSeqCounter{0};  // The same for ACKed unicasts, so retries aren't pushed out of windows by other frames
+        uint8_t bootEpoch = 0;
 
         // ========================================
         // HELPER METHODS
         // ========================================
-        bool isDuplicate(const uint8_t *src_mac, uint16_t seq);
+        void resetPeerTable();
+        int findPeerLocked(const uint8_t *mac);      // Callers hold peersMux
+        int insertPeerLocked(const uint8_t *mac);
+        void removePeerLocked(size_t slot);
+        bool linkUsable(const uint8_t *mac);         // Known neighbour whose link is not poor
+        bool recordSendOutcome(const uint8_t *mac, bool ok);   // Updates the link average, true = evict the peer
+
+        void resetRouteTable();
+        void learnRoute(const uint8_t *dest, const uint8_t *nextHop, uint8_t hopCount);
+        void dropRoutesVia(const uint8_t *nextHop);
+        void pruneRoutes();
+        bool routeNextHop(const uint8_t *dest, uint8_t *nextHop);   // Counts a hit or miss
+        esp_err_t sendUnicastFrame(const uint8_t *dest, const uint8_t *exclude_mac, const uint8_t *data, size_t len, bool allowFlood = true);
+
+        size_t rankUplinks(const uint8_t *exclude_mac, uint8_t (*out)[6], size_t max, uint8_t *bestHops);   // Best first
+        // From a HELLO: gradient and boot epoch, true if either changed
+        bool notePeerHello(const uint8_t *mac, uint8_t epoch, uint16_t seq, const uint8_t *payload, size_t len);
+        void refreshMasterDistance();                // Triggers an early HELLO when our distance changed
+        void startTrickleLocked(uint32_t now, uint32_t interval);   // Callers hold helloMux
+        void resetHelloTimer();                      // Topology changed: beacon soon
+        void noteHelloHeard(bool consistent);        // A neighbour's HELLO, false if it changed our tables
+
+        esp_err_t registerDriverPeer(const uint8_t *mac);   // esp_now_add_peer(), ESP_OK if already registered
+        esp_err_t acquireDriverPeer(const uint8_t *mac);    // Registered for one more send, evicting the LRU neighbour if needed
+        void releaseDriverSend(const uint8_t *mac);         // That send was reported or refused
+        int lruDriverPeerLocked(uint32_t tick, int skip);
+        void noteEvictedFrames(const uint8_t *mac, uint8_t frames);
+        bool takeEvictedFrame(const uint8_t *mac);          // Report for a frame sent before its neighbour was evicted
+        void releaseDriverPeer(const uint8_t *mac);         // Deleted from the driver if registered
+        esp_err_t driverSend(const uint8_t *mac, const uint8_t *data, size_t len);   // esp_now_send() on demand
+
+        void resetNodeIds();
+        int noteNodeIdLocked(const uint8_t *mac);    // Finds or adds the entry, -1 if none; callers hold nodeIdMux
+        void noteIdConflictLocked(uint16_t id);
+        void noteNodeIds(const packet_hdr_t &hdr, const uint8_t *from, bool compact);   // Every accepted frame
+        void forgetKnownBy(uint16_t neighbourId);    // The neighbour restarted with an empty table
+        size_t encodeCompact(const uint8_t *mac, const uint8_t *frame, size_t len, uint8_t *out);   // 0 = send as is
+        size_t decodeCompact(const uint8_t *from, const uint8_t *frame, size_t len, uint8_t *out);  // 0 = drop
+        size_t snapshotPeers(CachedPeer *out);       // PEER_TABLE_SIZE entries of room
+        size_t snapshotRoutes(CachedRoute *out);     // ROUTE_TABLE_SIZE entries of room
+        void loadPeerCache();                        // From initEspNow(), with peerCacheInterval set
+        // Unicast to the best uplink, then the next ones if the driver refuses; ESP_ERR_NOT_FOUND when there is none
+        esp_err_t sendUplinkFrame(const uint8_t *exclude_mac, const uint8_t *data, size_t len);
+
+        void resetTxQueue();
+        TxClass txClassOf(const uint8_t *frame, size_t len);
+        esp_err_t txSend(const uint8_t *mac, const uint8_t *data, size_t len);   // Replaces esp_now_send()
+        bool txEnqueueLocked(TxClass c, const uint8_t *mac, const uint8_t *data, size_t len);   // Callers hold txMux
+        void txPump();                               // Hands queued frames to the driver up to txMaxInFlight
+        void serviceTxQueue(uint32_t now);           // Recovers from lost send callbacks, from checkPendingMessages()
+
+        bool enqueueRx(const esp_now_recv_info_t *info, const uint8_t *data, int len);
+        size_t drainRx(size_t maxPackets);
+        static void rxTaskLoop(void *arg);
+        void processPacket(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len);
+
+        uint8_t* acquirePacketBuffer();              // nullptr when the pool is empty
+        void releasePacketBuffer(uint8_t *buf);
+
+        bool holdFlood(const packet_hdr_t &hdr, const uint8_t *from, const uint8_t *frame, size_t len);   // false = relay now
+        void noteFloodCopy(const packet_hdr_t &hdr);  // Duplicate heard: counts towards floodCounterK
+        void serviceFloods(uint32_t now);             // Relays holds whose backoff has ended
+
+        int findSleeperLocked(const uint8_t *mac);   // Callers hold mailboxMux
+        bool sleeperAsleep(const uint8_t *mac);      // Registered and past its awake window
+        uint32_t sleeperGrace(const uint8_t *mac);   // Extra peer timeout for a registered sleeper, 0 = none
+        void handlePoll(const RxInfo &rx, const uint8_t *payload, size_t len);
+        void noteSleeperHeard(const uint8_t *mac);   // Any frame from a sleeper means it is awake
+        bool holdForSleeper(const uint8_t *dest, const uint8_t *frame, size_t len);   // true = held or dropped
+        void flushMailbox(const uint8_t *mac);       // Sends its held frames, oldest first
+        void serviceMailboxes(uint32_t now);         // Expiry and flushes, from checkPendingMessages()
+        void handleHeld(const uint8_t *payload, size_t len);
+        void extendPending(const uint8_t *dest, uint16_t seq, uint32_t holdMs);
+
+        bool syncEnabled() const { return timeSync || tdmaSlots; }
+        uint8_t slotCount() const { return tdmaSlots < TDMA_MAX_SLOTS ? tdmaSlots : TDMA_MAX_SLOTS; }
+        int64_t meshTimeAtLocked(int64_t localUs);   // Callers hold syncMux
+        bool fitSyncLocked();                        // Callers hold syncMux; true once drift is estimated
+        size_t buildHelloSync(uint8_t *out);         // HelloSync with the stamp left to driverSend(), returns its size
+        bool hasHelloSync(const uint8_t *frame, size_t len);   // Own HELLO ending in a HelloSync
+        void stampHelloSync(uint8_t *frame, size_t len);       // Writes stamp and follow-up, len = bytes for the driver
+        void noteDriverSend(bool hello, uint16_t seq);         // esp_now_send() accepted a frame
+        void noteDriverReport();                     // Send report, first thing in handleDataSent()
+        void noteHelloSync(const uint8_t *mac, uint8_t masterHops, const HelloSync &hs, int64_t heardAt, int64_t prevHeardAt);
+        void serviceSync(uint32_t now);              // Uplink lost, from checkPendingMessages()
+        void pickSlot();                             // Before a HELLO: first slot or a repick
+        uint8_t activeSlot(int64_t *meshUs);         // Own slot and mesh time now, TDMA_SLOT_NONE = send freely
+        uint32_t slotWaitUs(int64_t meshUs, uint8_t slot, size_t len, uint8_t inFlight);   // 0 = may send now
+        void armSlotTimer(uint32_t waitUs);
+        static void slotTimerCb(void *arg);
+        static uint32_t airtimeUs(size_t len);       // At the 1 Mbps default rate
+
+        void queueAck(const uint8_t *dest, uint16_t seq);
+        void flushAcks(uint32_t now);
+        void sendAck(const uint8_t *dest, uint16_t *seqs, size_t count);   // Overwrites seqs
+        void handleAck(const uint8_t *src, const uint8_t *payload, size_t len);
+        void updateRtt(const uint8_t *dest, uint32_t sampleMs);
+        uint32_t ackTimeoutFor(const uint8_t *dest);   // SRTT + 4 x RTTVAR, or ackTimeout before the first sample
+        uint32_t backoffTimeout(uint32_t rto, uint8_t retry);
+        void setPendingStateLocked(size_t slot, PendingState state);   // Callers hold pendingMux
+
+        uint16_t nextSeq(bool acked = false);   // acked: seqAcked() of the frame
+        static bool seqAcked(const uint8_t *dest_mac, uint8_t msg_type);   // Unicast asking for an ACK: numbered apart
+        void resetSeenSources();
+        void pruneSeenSources();
+        SeenResult checkSeen(const uint8_t *src_mac, uint8_t epoch, uint16_t seq, bool acked);   // Records seq when new
+        bool checkLateSeenLocked(const uint8_t *src_mac, uint8_t epoch, uint16_t seq, uint32_t now);  // Records it, true if it was there
+        void addLateSeenLocked(const uint8_t *src_mac, uint8_t epoch, uint16_t seq, uint32_t now);
+
+        void countStat(StatId id) { stats[id].fetch_add(1, std::memory_order_relaxed); }
+        // Builds and sends one frame (header, fragment header if frag is set, data) numbered seq.
+        // ACKed unicasts get a pending entry, tied to transfer fragSlot for fragments; a fragment that finds the
+        // pending table full is not sent
+        esp_err_t sendFrame(const uint8_t *dest_mac, uint8_t msg_type, uint16_t seq, const uint8_t *data, size_t len,
+                            int fragSlot = -1, const FragmentHeader *frag = nullptr);
+        esp_err_t startTransfer(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type);
+        esp_err_t pumpTransfer(int slot);            // Sends fragments up to fragWindow
+        void serviceTransfers();                     // Settles finished fragments, then refills the windows
+        void finishFragment(int slot, uint16_t msgId, uint8_t index, bool delivered, uint8_t attempts);
+        void endTransfer(int slot, bool delivered);
+        void reportTransfers();                      // FRAG_DONE -> send callback, from checkPendingMessages()
+        bool fragmentFits(const uint8_t *src_mac, const uint8_t *payload, size_t len);
+        void handleFragment(const RxInfo &rx, const uint8_t *payload, size_t len);
+        size_t bundleCapacity() const;
+        esp_err_t aggregate(const uint8_t *data, size_t len, const uint8_t *dest_mac, uint8_t msg_type);
+        void flushBundles(uint32_t now, bool all);   // Sends bundles older than aggregateDelayMs, or every one
+        esp_err_t sendBundle(const AggBundle &b);
+        void handleBundle(const RxInfo &rx, const uint8_t *payload, size_t len);
+        void deliverPayload(const RxInfo &rx, const uint8_t *payload, size_t len, char *text);
+        void handleControl(const RxInfo &rx, const uint8_t *payload, size_t len);
         const char* msgTypeToStr(uint8_t msg_type);  // Helper for debug logging
 };
 